@@ -0,0 +1,128 @@
+/**
+ * @file bench_multi.c
+ * @brief Micro-benchmark for the multi-pattern engines in multi.c.
+ * Scans the same text with the Teddy prefilter and the Aho-Corasick automaton for growing
+ * pattern sets and several pattern lengths, to show where one overtakes the other.
+ * Every match is consumed the way mygrep does it: the scan resumes after the matching line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "multi.h"
+#include "search.h"
+
+#define TEXT_SIZE (32u << 20)
+#define REPEATS 3
+#define MAX_PATTERNS 64
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static const char *run_teddy(const void *engine, const char *hay, size_t len, size_t *match_len) {
+    return teddy_find(engine, hay, len, match_len);
+}
+
+static const char *run_ac(const void *engine, const char *hay, size_t len, size_t *match_len) {
+    return ac_find(engine, hay, len, match_len);
+}
+
+/**
+ * Counts matching lines like scan_buffer in mygrep.c and returns the best throughput in GB/s.
+ */
+static double measure(const char *(*find)(const void *, const char *, size_t, size_t *), const void *engine,
+                      const char *text, size_t *lines) {
+    double best = 0.0;
+    for (int r = 0; r < REPEATS; r++) {
+        double start = now_seconds();
+        const char *p = text, *end = text + TEXT_SIZE;
+        size_t count = 0, match_len;
+        while (p < end) {
+            const char *hit = find(engine, p, (size_t)(end - p), &match_len);
+            if (!hit) break;
+            const char *newline = memchr(hit, '\n', (size_t)(end - hit));
+            p = newline ? newline + 1 : end;
+            count++;
+        }
+        double gbps = (double)TEXT_SIZE / (now_seconds() - start) / 1e9;
+        if (gbps > best) best = gbps;
+        *lines = count;
+    }
+    return best;
+}
+
+int main(void) {
+    static const size_t counts[] = {2, 4, 8, 12, 16, 24, 32, 48, 64};
+    static const size_t lengths[] = {1, 2, 3, 5, 8, 16};
+    static const char alphabet[] = "etaoinshrdlucmfwypvbgkqjxzETAOINSHRDLU0123456789      ";
+
+    search_init();
+
+    char *text = malloc(TEXT_SIZE);
+    if (!text) {
+        perror("Memory allocation failed");
+        return EXIT_FAILURE;
+    }
+
+    // Log-like text: lines of 40-120 random characters
+    srand(42);
+    for (size_t i = 0; i < TEXT_SIZE;) {
+        size_t line = 40 + (size_t)rand() % 80;
+        for (size_t k = 0; k < line && i < TEXT_SIZE; k++) {
+            text[i++] = alphabet[(size_t)rand() % (sizeof(alphabet) - 1)];
+        }
+        if (i < TEXT_SIZE) text[i++] = '\n';
+    }
+
+    printf("text %u MiB, GB/s (best of %d), matching lines in parentheses\n", TEXT_SIZE >> 20, REPEATS);
+    printf("%5s %5s %20s %20s\n", "len", "count", "teddy", "aho-corasick");
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            size_t len = lengths[l], count = counts[c];
+            char storage[MAX_PATTERNS][17];
+            char *patterns[MAX_PATTERNS];
+            size_t pattern_lengths[MAX_PATTERNS];
+
+            // Random patterns over a slightly different alphabet, so some occur and most do not
+            for (size_t p = 0; p < count; p++) {
+                for (size_t k = 0; k < len; k++) storage[p][k] = "abcdefghijklmnopqrstuvwxyz#"[(size_t)rand() % 27];
+                storage[p][len] = '\0';
+                patterns[p] = storage[p];
+                pattern_lengths[p] = len;
+            }
+
+            teddy_t *teddy = teddy_build(patterns, pattern_lengths, count, 0);
+            ac_automaton_t *ac = ac_build(patterns, pattern_lengths, count, 0);
+            if (!ac) {
+                perror("ac_build");
+                return EXIT_FAILURE;
+            }
+
+            char teddy_cell[32] = "-", ac_cell[32];
+            size_t teddy_lines = 0, ac_lines = 0;
+            if (teddy) {
+                double gbps = measure(run_teddy, teddy, text, &teddy_lines);
+                snprintf(teddy_cell, sizeof(teddy_cell), "%.2f (%zu)", gbps, teddy_lines);
+            }
+            double gbps = measure(run_ac, ac, text, &ac_lines);
+            snprintf(ac_cell, sizeof(ac_cell), "%.2f (%zu)", gbps, ac_lines);
+            printf("%5zu %5zu %20s %20s\n", len, count, teddy_cell, ac_cell);
+            fflush(stdout);
+
+            if (teddy && teddy_lines != ac_lines) {
+                fprintf(stderr, "bench_multi: engines disagree on the number of matching lines\n");
+                return EXIT_FAILURE;
+            }
+            teddy_free(teddy);
+            ac_free(ac);
+        }
+    }
+
+    free(text);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file bench_search.c
+ * @brief Micro-benchmark for the literal search kernels in search.c.
+ * Compares strstr, memmem, every compiled-in kernel, Horspool, Two-Way and the guarded scan
+ * across keyword lengths, then strcasestr against the case-insensitive kernels.
+ * The keyword is placed only at the very end of the haystack, so every run scans the full buffer.
+ */
+
+#define _GNU_SOURCE // Required for memmem and strcasestr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "search.h"
+
+#define HAY_SIZE (64u << 20)
+#define REPEATS 5
+
+static const char *hay;
+static size_t hay_len;
+
+static const char *run_strstr(const char *h, size_t n, const char *k, size_t m) {
+    (void)n;
+    (void)m;
+    return strstr(h, k);
+}
+
+static const char *run_memmem(const char *h, size_t n, const char *k, size_t m) {
+    return memmem(h, n, k, m);
+}
+
+static const char *run_strcasestr(const char *h, size_t n, const char *k, size_t m) {
+    (void)n;
+    (void)m;
+    return strcasestr(h, k);
+}
+
+static const char *run_plan(const char *h, size_t n, const char *k, size_t m, search_algo_t algo) {
+    search_plan_t plan;
+    search_plan_init(&plan, k, m, 0);
+    plan.algo = algo;
+    return search_plan_find(&plan, h, n);
+}
+
+static const char *run_horspool(const char *h, size_t n, const char *k, size_t m) {
+    return run_plan(h, n, k, m, SEARCH_HORSPOOL);
+}
+
+static const char *run_two_way(const char *h, size_t n, const char *k, size_t m) {
+    return run_plan(h, n, k, m, SEARCH_TWO_WAY);
+}
+
+static const char *run_guarded(const char *h, size_t n, const char *k, size_t m) {
+    return run_plan(h, n, k, m, SEARCH_GUARDED);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Runs one kernel REPEATS times and returns the best throughput in GB/s.
+ */
+static double measure(search_fn fn, const char *needle, size_t needle_len) {
+    double best = 0.0;
+    for (int r = 0; r < REPEATS; r++) {
+        double start = now_seconds();
+        const char *found = fn(hay, hay_len, needle, needle_len);
+        double elapsed = now_seconds() - start;
+        if (found != hay + hay_len - needle_len) {
+            fprintf(stderr, "bench_search: kernel returned a wrong position\n");
+            exit(EXIT_FAILURE);
+        }
+        double gbps = (double)hay_len / elapsed / 1e9;
+        if (gbps > best) best = gbps;
+    }
+    return best;
+}
+
+struct kernel {
+    const char *name;
+    search_fn fn;
+    const char *cpu; // CPU feature required to run the kernel, NULL for portable ones
+};
+
+/**
+ * Prints one row per keyword length and one column per kernel.
+ */
+static void run_table(char *buf, const struct kernel *kernels, size_t kernel_count) {
+    static const size_t lengths[] = {2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 128, 256, 512, 1024};
+
+    printf("%6s", "len");
+    for (size_t k = 0; k < kernel_count; k++) printf(" %10s", kernels[k].name);
+    printf("\n");
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t needle_len = lengths[l];
+        char needle[1025];
+
+        // Needle = realistic prefix from the text plus a terminating '#', planted at the end
+        memcpy(needle, buf + 1000, needle_len - 1);
+        needle[needle_len - 1] = '#';
+        needle[needle_len] = '\0';
+        hay = buf;
+        hay_len = HAY_SIZE;
+        memcpy(buf + HAY_SIZE - needle_len, needle, needle_len);
+
+        printf("%6zu", needle_len);
+        for (size_t k = 0; k < kernel_count; k++) {
+            if (kernels[k].fn == NULL || (kernels[k].cpu && !search_cpu_supports(kernels[k].cpu))) {
+                printf(" %10s", "-");
+                continue;
+            }
+            printf(" %10.2f", measure(kernels[k].fn, needle, needle_len));
+            fflush(stdout);
+        }
+        printf("\n");
+
+        // Restore the text so the next needle is only found at the end
+        for (size_t i = HAY_SIZE - needle_len; i < HAY_SIZE; i++) buf[i] = 'e';
+    }
+}
+
+int main(void) {
+    static const char alphabet[] = "etaoinshrdlucmfwypvbgkqjxz      \n";
+
+    search_init();
+
+    char *buf = malloc(HAY_SIZE + 1);
+    if (!buf) {
+        perror("Memory allocation failed");
+        return EXIT_FAILURE;
+    }
+
+    // English-like letter distribution; the needle uses '#', which never occurs in the text
+    srand(42);
+    for (size_t i = 0; i < HAY_SIZE; i++) {
+        buf[i] = alphabet[(size_t)rand() % (sizeof(alphabet) - 1)];
+    }
+    buf[HAY_SIZE] = '\0';
+
+    const struct kernel sensitive[] = {
+        {"strstr", run_strstr, NULL},
+        {"memmem", run_memmem, NULL},
+        {"scalar", search_scalar, NULL},
+        {"sse2", search_sse2, "sse2"},
+        {"avx2", search_avx2, "avx2"},
+        {"avx512", search_avx512, "avx512"},
+        {"horspool", run_horspool, NULL},
+        {"two-way", run_two_way, NULL},
+        {"guarded", run_guarded, NULL},
+    };
+    const struct kernel insensitive[] = {
+        {"strcasestr", run_strcasestr, NULL},
+        {"scalar_ci", search_scalar_ci, NULL},
+        {"sse2_ci", search_sse2_ci, "sse2"},
+        {"avx2_ci", search_avx2_ci, "avx2"},
+        {"avx512_ci", search_avx512_ci, "avx512"},
+    };
+
+    printf("haystack %u MiB, dispatched kernel: %s, GB/s (best of %d)\n\n",
+           HAY_SIZE >> 20, search_kernel_name(), REPEATS);
+    run_table(buf, sensitive, sizeof(sensitive) / sizeof(sensitive[0]));
+    printf("\n");
+    run_table(buf, insensitive, sizeof(insensitive) / sizeof(insensitive[0]));
+
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1210 @@
+/**
+ * @file dfa.c
+ * @brief ERE parser, Thompson NFA construction and a lazily built, cached DFA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "dfa.h"
+
+#define NFA_MAX_NODES 500000  // Guards against huge expansions such as (a{1000}){1000}
+#define REPEAT_MAX 1000       // Largest bound accepted in {m,n}
+#define UNICODE_MAX 0x10FFFF
+#define SURROGATE_MIN 0xD800  // UTF-16 surrogates, which UTF-8 does not encode
+#define SURROGATE_MAX 0xDFFF
+
+/* ---------------------------------------------------------------------------------------
+ * Parsing: pattern -> syntax tree
+ * ------------------------------------------------------------------------------------- */
+
+typedef struct {
+    uint8_t bits[32];
+} byteset_t;
+
+typedef enum { RE_EMPTY, RE_SET, RE_BOL, RE_EOL, RE_CAT, RE_ALT, RE_REPEAT } re_kind_t;
+
+typedef struct {
+    re_kind_t kind;
+    int set;          // RE_SET: index into the set pool
+    int min, max;     // RE_REPEAT: max < 0 means unbounded
+    int left, right;  // Children; RE_REPEAT only uses left
+} re_node_t;
+
+typedef struct {
+    const char *pat;
+    size_t len;
+    size_t pos;
+    int depth;        // Open parentheses
+    int case_insensitive;
+    re_node_t *nodes;
+    size_t node_count, node_cap;
+    byteset_t *sets;
+    size_t set_count, set_cap;
+    const char *error;
+} parser_t;
+
+typedef enum { N_CHAR, N_SPLIT, N_BOL, N_EOL, N_MATCH } nfa_kind_t;
+
+typedef struct {
+    nfa_kind_t kind;
+    int set;          // N_CHAR: index into the set pool
+    int out, out2;    // Successors; out2 only for N_SPLIT (-1 if unused)
+} nfa_node_t;
+
+struct dfa_program {
+    nfa_node_t *nodes;
+    size_t count, cap;
+    byteset_t *sets;
+    size_t set_count;
+    int start;
+    char *literal;    // Required literal for the prefilter, NULL if none
+    size_t literal_len;
+    int is_literal;
+};
+
+static inline int set_has(const byteset_t *s, unsigned char c) {
+    return (s->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static inline void set_put(byteset_t *s, unsigned char c) {
+    s->bits[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+/**
+ * Adds a byte to a set; with -i, letters are added in both cases.
+ */
+static void set_add(parser_t *p, byteset_t *s, unsigned char c) {
+    set_put(s, c);
+    if (p->case_insensitive && isalpha(c)) {
+        set_put(s, (unsigned char)tolower(c));
+        set_put(s, (unsigned char)toupper(c));
+    }
+}
+
+static int new_set(parser_t *p) {
+    if (p->set_count == p->set_cap) {
+        size_t cap = p->set_cap ? p->set_cap * 2 : 16;
+        byteset_t *sets = realloc(p->sets, cap * sizeof(*sets));
+        if (!sets) {
+            p->error = "out of memory";
+            return -1;
+        }
+        p->sets = sets;
+        p->set_cap = cap;
+    }
+    memset(&p->sets[p->set_count], 0, sizeof(byteset_t));
+    return (int)p->set_count++;
+}
+
+static int new_node(parser_t *p, re_kind_t kind, int left, int right) {
+    if (p->node_count == p->node_cap) {
+        size_t cap = p->node_cap ? p->node_cap * 2 : 32;
+        re_node_t *nodes = realloc(p->nodes, cap * sizeof(*nodes));
+        if (!nodes) {
+            p->error = "out of memory";
+            return -1;
+        }
+        p->nodes = nodes;
+        p->node_cap = cap;
+    }
+    re_node_t *n = &p->nodes[p->node_count];
+    n->kind = kind;
+    n->set = -1;
+    n->min = n->max = 0;
+    n->left = left;
+    n->right = right;
+    return (int)p->node_count++;
+}
+
+static int new_set_node(parser_t *p, int set) {
+    int n = new_node(p, RE_SET, -1, -1);
+    if (n >= 0) p->nodes[n].set = set;
+    return n;
+}
+
+static int literal_node(parser_t *p, unsigned char c) {
+    int set = new_set(p);
+    if (set < 0) return -1;
+    set_add(p, &p->sets[set], c);
+    return new_set_node(p, set);
+}
+
+/* ---------------------------------------------------------------------------------------
+ * UTF-8: the automaton works on bytes, so a multibyte character becomes a sequence of byte
+ * sets, and a set of characters an alternation of such sequences
+ * ------------------------------------------------------------------------------------- */
+
+typedef struct {
+    uint32_t lo, hi;
+} cp_range_t;
+
+/**
+ * Decodes the well-formed UTF-8 character at the start of s (no overlong forms or
+ * surrogates).
+ * @return Its length, or 0 if s does not start with one.
+ */
+static size_t utf8_decode(const char *s, size_t len, uint32_t *cp) {
+    const unsigned char *u = (const unsigned char *)s;
+    if (len == 0) return 0;
+    if (u[0] < 0x80) {
+        *cp = u[0];
+        return 1;
+    }
+    size_t n = u[0] >= 0xC2 && u[0] <= 0xDF ? 2 : u[0] >= 0xE0 && u[0] <= 0xEF ? 3 : u[0] >= 0xF0 && u[0] <= 0xF4 ? 4 : 0;
+    if (n == 0 || len < n) return 0;
+    uint32_t c = u[0] & (0x7F >> n);
+    for (size_t i = 1; i < n; i++) {
+        if ((u[i] & 0xC0) != 0x80) return 0;
+        c = (c << 6) | (u[i] & 0x3F);
+    }
+    static const uint32_t min[5] = {0, 0, 0x80, 0x800, 0x10000};
+    if (c < min[n] || c > UNICODE_MAX || (c >= SURROGATE_MIN && c <= SURROGATE_MAX)) return 0;
+    *cp = c;
+    return n;
+}
+
+static size_t utf8_encode(uint32_t c, unsigned char *out) {
+    if (c < 0x80) {
+        out[0] = (unsigned char)c;
+        return 1;
+    }
+    static const unsigned char lead[5] = {0, 0, 0xC0, 0xE0, 0xF0};
+    size_t n = c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+    for (size_t i = n - 1; i > 0; i--) {
+        out[i] = (unsigned char)(0x80 | (c & 0x3F));
+        c >>= 6;
+    }
+    out[0] = (unsigned char)(lead[n] | c);
+    return n;
+}
+
+static int alt_node(parser_t *p, int left, int right) {
+    if (left < 0) return right;
+    if (right < 0) return left;
+    return new_node(p, RE_ALT, left, right);
+}
+
+/**
+ * Builds the byte sequences of the multibyte characters lo..hi (no surrogates in between).
+ * The range is split until the characters share their encoded length and every byte
+ * position spans a plain byte range, so that one concatenation of byte sets covers it.
+ * @return The node, or -1 on error.
+ */
+static int utf8_range_node(parser_t *p, uint32_t lo, uint32_t hi) {
+    static const uint32_t length_max[] = {0x7FF, 0xFFFF};
+    for (size_t i = 0; i < sizeof(length_max) / sizeof(length_max[0]); i++) {
+        if (lo <= length_max[i] && hi > length_max[i]) {
+            int left = utf8_range_node(p, lo, length_max[i]);
+            if (left < 0) return -1;
+            int right = utf8_range_node(p, length_max[i] + 1, hi);
+            return right < 0 ? -1 : new_node(p, RE_ALT, left, right);
+        }
+    }
+    unsigned char first[4], last[4];
+    size_t n = utf8_encode(lo, first);
+    utf8_encode(hi, last);
+    for (size_t i = 1; i < n; i++) {
+        uint32_t m = ((uint32_t)1 << (6 * i)) - 1; // The last i continuation bytes
+        if ((lo & ~m) == (hi & ~m)) continue;
+        uint32_t split = 0;
+        if ((lo & m) != 0) {
+            split = lo | m;
+        } else if ((hi & m) != m) {
+            split = (hi & ~m) - 1;
+        } else {
+            continue;
+        }
+        int left = utf8_range_node(p, lo, split);
+        if (left < 0) return -1;
+        int right = utf8_range_node(p, split + 1, hi);
+        return right < 0 ? -1 : new_node(p, RE_ALT, left, right);
+    }
+    int seq = -1;
+    for (size_t i = 0; i < n; i++) {
+        int set = new_set(p);
+        if (set < 0) return -1;
+        for (int b = first[i]; b <= last[i]; b++) set_put(&p->sets[set], (unsigned char)b);
+        int byte = new_set_node(p, set);
+        if (byte < 0) return -1;
+        seq = seq < 0 ? byte : new_node(p, RE_CAT, seq, byte);
+        if (seq < 0) return -1;
+    }
+    return seq;
+}
+
+/**
+ * Builds the alternation of the multibyte characters in sorted, disjoint ranges of code
+ * points from 0x80 on, leaving out the surrogates.
+ * @return The node, -1 on error, or -2 if the ranges are empty.
+ */
+static int utf8_ranges_node(parser_t *p, const cp_range_t *ranges, size_t count) {
+    int result = -2;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t lo = ranges[i].lo, hi = ranges[i].hi;
+        while (lo <= hi) {
+            uint32_t end = hi;
+            if (lo >= SURROGATE_MIN && lo <= SURROGATE_MAX) {
+                lo = SURROGATE_MAX + 1;
+                continue;
+            }
+            if (lo < SURROGATE_MIN && hi >= SURROGATE_MIN) end = SURROGATE_MIN - 1;
+            int node = utf8_range_node(p, lo, end);
+            if (node < 0) return -1;
+            result = result == -2 ? node : new_node(p, RE_ALT, result, node);
+            if (result < 0) return -1;
+            lo = end + 1;
+        }
+    }
+    return result;
+}
+
+/**
+ * Combines the ASCII bytes of a set with the multibyte characters of some ranges.
+ * @return The node, or -1 on error.
+ */
+static int char_class_node(parser_t *p, const byteset_t *ascii, const cp_range_t *ranges, size_t count) {
+    int set = new_set(p);
+    if (set < 0) return -1;
+    p->sets[set] = *ascii;
+    int node = new_set_node(p, set);
+    int multibyte = utf8_ranges_node(p, ranges, count);
+    if (node < 0 || multibyte == -1) return -1;
+    return multibyte == -2 ? node : alt_node(p, node, multibyte);
+}
+
+/**
+ * Builds a node for the ASCII bytes of a set or any multibyte character ('.', \w, \S).
+ */
+static int any_char_node(parser_t *p, const byteset_t *ascii) {
+    static const cp_range_t all = {0x80, UNICODE_MAX};
+    return char_class_node(p, ascii, &all, 1);
+}
+
+/**
+ * Parses the multibyte character the pattern continues with as a sequence of its bytes, so
+ * that a following quantifier applies to all of them.
+ * @return The node, or -1 on error.
+ */
+static int multibyte_literal(parser_t *p, size_t n) {
+    int seq = -1;
+    for (size_t i = 0; i < n; i++) {
+        int byte = literal_node(p, (unsigned char)p->pat[p->pos++]);
+        if (byte < 0) return -1;
+        seq = seq < 0 ? byte : new_node(p, RE_CAT, seq, byte);
+        if (seq < 0) return -1;
+    }
+    return seq;
+}
+
+static int peek(const parser_t *p) {
+    return p->pos < p->len ? (unsigned char)p->pat[p->pos] : -1;
+}
+
+/**
+ * Adds the members of a [:name:] class. Returns 0 if the name is unknown.
+ */
+static int add_named_class(parser_t *p, byteset_t *s, const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {
+        {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+        {"lower", islower}, {"space", isspace}, {"blank", isblank}, {"punct", ispunct},
+        {"print", isprint}, {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit},
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) == len && memcmp(classes[i].name, name, len) == 0) {
+            for (int c = 0; c < 256; c++) {
+                if (classes[i].test(c)) set_add(p, s, (unsigned char)c);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Orders code point ranges by their start (for qsort).
+ */
+static int compare_ranges(const void *a, const void *b) {
+    const cp_range_t *x = a, *y = b;
+    return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+/**
+ * Reads one character of a bracket expression as a code point.
+ * @return 0 on success, -1 (with p->error set) if the bytes are not valid UTF-8.
+ */
+static int bracket_char(parser_t *p, uint32_t *cp) {
+    size_t n = utf8_decode(p->pat + p->pos, p->len - p->pos, cp);
+    if (n == 0) {
+        p->error = "invalid UTF-8 in bracket expression";
+        return -1;
+    }
+    p->pos += n;
+    return 0;
+}
+
+/**
+ * Parses a bracket expression; the opening '[' has been consumed. ASCII members go into a
+ * byte set; multibyte members are collected as code point ranges and compiled into byte
+ * sequences, so that e.g. [ß] matches the two bytes of "ß" together and nothing else.
+ */
+static int parse_bracket(parser_t *p) {
+    byteset_t s;
+    memset(&s, 0, sizeof(s));
+    cp_range_t *ranges = NULL;
+    size_t count = 0, cap = 0;
+    int result = -1;
+
+    int negate = 0;
+    if (peek(p) == '^') {
+        negate = 1;
+        p->pos++;
+    }
+
+    int first = 1;
+    for (;;) {
+        int c = peek(p);
+        if (c < 0) {
+            p->error = "unmatched [";
+            goto done;
+        }
+        if (c == ']' && !first) {
+            p->pos++;
+            break;
+        }
+        first = 0;
+
+        if (c == '[' && p->pos + 1 < p->len && p->pat[p->pos + 1] == ':') {
+            const char *name = p->pat + p->pos + 2;
+            const char *close = NULL;
+            for (size_t i = p->pos + 2; i + 1 < p->len; i++) {
+                if (p->pat[i] == ':' && p->pat[i + 1] == ']') {
+                    close = p->pat + i;
+                    break;
+                }
+            }
+            if (!close || !add_named_class(p, &s, name, (size_t)(close - name))) {
+                p->error = "invalid character class";
+                goto done;
+            }
+            p->pos = (size_t)(close - p->pat) + 2;
+            continue;
+        }
+        if (c == '[' && p->pos + 1 < p->len && (p->pat[p->pos + 1] == '=' || p->pat[p->pos + 1] == '.')) {
+            p->error = "equivalence classes and collating symbols are not supported";
+            goto done;
+        }
+
+        uint32_t lo, hi;
+        if (bracket_char(p, &lo) == -1) goto done;
+        hi = lo;
+        if (peek(p) == '-' && p->pos + 1 < p->len && p->pat[p->pos + 1] != ']') {
+            p->pos++;
+            if (bracket_char(p, &hi) == -1) goto done;
+            if (hi < lo) {
+                p->error = "invalid range end";
+                goto done;
+            }
+        }
+        for (uint32_t b = lo; b <= hi && b < 0x80; b++) set_add(p, &s, (unsigned char)b);
+        if (hi >= 0x80) {
+            if (count == cap) {
+                cap = cap ? cap * 2 : 8;
+                cp_range_t *grown = realloc(ranges, cap * sizeof(*ranges));
+                if (!grown) {
+                    p->error = "out of memory";
+                    goto done;
+                }
+                ranges = grown;
+            }
+            ranges[count].lo = lo < 0x80 ? 0x80 : lo;
+            ranges[count].hi = hi;
+            count++;
+        }
+    }
+
+    // Sort and merge the multibyte ranges, then complement them for [^...]
+    if (count > 1) qsort(ranges, count, sizeof(*ranges), compare_ranges);
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (merged > 0 && ranges[i].lo <= ranges[merged - 1].hi + 1) {
+            if (ranges[i].hi > ranges[merged - 1].hi) ranges[merged - 1].hi = ranges[i].hi;
+        } else {
+            ranges[merged++] = ranges[i];
+        }
+    }
+    count = merged;
+    for (int i = 16; i < 32; i++) s.bits[i] = 0; // Bytes from 0x80 on only occur in sequences
+    if (negate) {
+        for (int i = 0; i < 16; i++) s.bits[i] = (uint8_t)~s.bits[i];
+        s.bits['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7)); // A line never contains '\n'
+        cp_range_t *gaps = malloc((count + 1) * sizeof(*gaps));
+        if (!gaps) {
+            p->error = "out of memory";
+            goto done;
+        }
+        size_t gap_count = 0;
+        uint32_t next = 0x80;
+        for (size_t i = 0; i < count; i++) {
+            if (ranges[i].lo > next) gaps[gap_count++] = (cp_range_t){next, ranges[i].lo - 1};
+            next = ranges[i].hi + 1;
+        }
+        if (next <= UNICODE_MAX) gaps[gap_count++] = (cp_range_t){next, UNICODE_MAX};
+        free(ranges);
+        ranges = gaps;
+        count = gap_count;
+    }
+    result = char_class_node(p, &s, ranges, count);
+
+done:
+    free(ranges);
+    return result;
+}
+
+/**
+ * Builds the class for one of the GNU escapes \w \W \s \S.
+ */
+static int escape_class(parser_t *p, int c) {
+    byteset_t s;
+    memset(s.bits, 0, sizeof(s.bits));
+    for (int b = 0; b < 0x80; b++) {
+        int in;
+        if (c == 'w' || c == 'W') {
+            in = isalnum(b) || b == '_';
+        } else {
+            in = isspace(b);
+        }
+        if (c == 'W' || c == 'S') in = !in && b != '\n';
+        if (in) set_put(&s, (unsigned char)b);
+    }
+    // Multibyte characters count as word characters and not as spaces
+    if (c == 'w' || c == 'S') return any_char_node(p, &s);
+    int set = new_set(p);
+    if (set < 0) return -1;
+    p->sets[set] = s;
+    return new_set_node(p, set);
+}
+
+static int parse_alt(parser_t *p);
+
+static int parse_atom(parser_t *p) {
+    int c = peek(p);
+    p->pos++;
+    switch (c) {
+        case '(': {
+            p->depth++;
+            int inner;
+            if (peek(p) == ')') {
+                inner = new_node(p, RE_EMPTY, -1, -1);
+            } else {
+                inner = parse_alt(p);
+            }
+            if (inner < 0) return -1;
+            if (peek(p) != ')') {
+                p->error = "unmatched (";
+                return -1;
+            }
+            p->pos++;
+            p->depth--;
+            return inner;
+        }
+        case '[':
+            return parse_bracket(p);
+        case '.': {
+            byteset_t ascii;
+            memset(ascii.bits, 0, sizeof(ascii.bits));
+            for (int b = 0; b < 0x80; b++) {
+                if (b != '\n') set_put(&ascii, (unsigned char)b);
+            }
+            return any_char_node(p, &ascii);
+        }
+        case '^':
+            return new_node(p, RE_BOL, -1, -1);
+        case '$':
+            return new_node(p, RE_EOL, -1, -1);
+        case '\\': {
+            int e = peek(p);
+            if (e < 0) {
+                p->error = "trailing backslash";
+                return -1;
+            }
+            p->pos++;
+            if (e == 'w' || e == 'W' || e == 's' || e == 'S') return escape_class(p, e);
+            return literal_node(p, (unsigned char)e);
+        }
+        default: {
+            // Includes a quantifier or '{' with nothing to repeat, and ')' outside a group.
+            // A byte that starts no valid UTF-8 character stands for itself.
+            uint32_t cp;
+            size_t n = utf8_decode(p->pat + p->pos - 1, p->len - (p->pos - 1), &cp);
+            if (n > 1) {
+                p->pos--;
+                return multibyte_literal(p, n);
+            }
+            return literal_node(p, (unsigned char)c);
+        }
+    }
+}
+
+/**
+ * Parses "{m}", "{m,}", "{m,n}" or (as in GNU grep) "{,n}" at the current position.
+ * Returns 0 (position unchanged) if the text is not a valid interval, in which case '{'
+ * is an ordinary character.
+ */
+static int parse_interval(parser_t *p, int *min, int *max) {
+    size_t pos = p->pos + 1;
+    long lo = 0, hi;
+    if (pos >= p->len || !(isdigit((unsigned char)p->pat[pos]) || p->pat[pos] == ',')) return 0;
+    while (pos < p->len && isdigit((unsigned char)p->pat[pos])) {
+        lo = lo * 10 + (p->pat[pos++] - '0');
+        if (lo > REPEAT_MAX) lo = REPEAT_MAX + 1;
+    }
+    hi = lo;
+    if (pos < p->len && p->pat[pos] == ',') {
+        pos++;
+        hi = -1;
+        if (pos < p->len && isdigit((unsigned char)p->pat[pos])) {
+            hi = 0;
+            while (pos < p->len && isdigit((unsigned char)p->pat[pos])) {
+                hi = hi * 10 + (p->pat[pos++] - '0');
+                if (hi > REPEAT_MAX) hi = REPEAT_MAX + 1;
+            }
+        }
+    }
+    if (pos >= p->len || p->pat[pos] != '}') return 0;
+
+    if (lo > REPEAT_MAX || hi > REPEAT_MAX || (hi >= 0 && hi < lo)) {
+        p->error = "invalid repetition count";
+        return -1;
+    }
+    p->pos = pos + 1;
+    *min = (int)lo;
+    *max = (int)hi;
+    return 1;
+}
+
+static int parse_piece(parser_t *p) {
+    int atom = parse_atom(p);
+    if (atom < 0) return -1;
+
+    for (;;) {
+        int c = peek(p), min, max;
+        if (c == '*') {
+            min = 0;
+            max = -1;
+            p->pos++;
+        } else if (c == '+') {
+            min = 1;
+            max = -1;
+            p->pos++;
+        } else if (c == '?') {
+            min = 0;
+            max = 1;
+            p->pos++;
+        } else if (c == '{') {
+            int r = parse_interval(p, &min, &max);
+            if (r < 0) return -1;
+            if (r == 0) break;
+        } else {
+            break;
+        }
+        int rep = new_node(p, RE_REPEAT, atom, -1);
+        if (rep < 0) return -1;
+        p->nodes[rep].min = min;
+        p->nodes[rep].max = max;
+        atom = rep;
+    }
+    return atom;
+}
+
+static int parse_branch(parser_t *p) {
+    int result = -1;
+    for (;;) {
+        int c = peek(p);
+        if (c < 0 || c == '|' || (c == ')' && p->depth > 0)) break;
+        int piece = parse_piece(p);
+        if (piece < 0) return -1;
+        result = result < 0 ? piece : new_node(p, RE_CAT, result, piece);
+        if (result < 0) return -1;
+    }
+    return result < 0 ? new_node(p, RE_EMPTY, -1, -1) : result;
+}
+
+static int parse_alt(parser_t *p) {
+    int result = parse_branch(p);
+    while (result >= 0 && peek(p) == '|') {
+        p->pos++;
+        int branch = parse_branch(p);
+        if (branch < 0) return -1;
+        result = new_node(p, RE_ALT, result, branch);
+    }
+    return result;
+}
+
+/* ---------------------------------------------------------------------------------------
+ * Compilation: syntax tree -> Thompson NFA
+ * ------------------------------------------------------------------------------------- */
+
+static int nfa_add(dfa_program_t *prog, nfa_kind_t kind, int set, int out, int out2) {
+    if (prog->count >= NFA_MAX_NODES) return -1;
+    if (prog->count == prog->cap) {
+        size_t cap = prog->cap ? prog->cap * 2 : 64;
+        nfa_node_t *nodes = realloc(prog->nodes, cap * sizeof(*nodes));
+        if (!nodes) return -1;
+        prog->nodes = nodes;
+        prog->cap = cap;
+    }
+    nfa_node_t *n = &prog->nodes[prog->count];
+    n->kind = kind;
+    n->set = set;
+    n->out = out;
+    n->out2 = out2;
+    return (int)prog->count++;
+}
+
+/**
+ * Compiles a subtree so that it continues with node `next`; returns the entry node.
+ * Building back to front means every successor already exists when a node is created.
+ */
+static int compile_node(dfa_program_t *prog, const parser_t *p, int node, int next) {
+    if (next < 0) return -1;
+    const re_node_t *n = &p->nodes[node];
+
+    switch (n->kind) {
+        case RE_EMPTY:
+            return next;
+        case RE_SET:
+            return nfa_add(prog, N_CHAR, n->set, next, -1);
+        case RE_BOL:
+            return nfa_add(prog, N_BOL, -1, next, -1);
+        case RE_EOL:
+            return nfa_add(prog, N_EOL, -1, next, -1);
+        case RE_CAT:
+            return compile_node(prog, p, n->left, compile_node(prog, p, n->right, next));
+        case RE_ALT: {
+            int left = compile_node(prog, p, n->left, next);
+            int right = compile_node(prog, p, n->right, next);
+            if (left < 0 || right < 0) return -1;
+            return nfa_add(prog, N_SPLIT, -1, left, right);
+        }
+        case RE_REPEAT: {
+            int tail = next;
+            if (n->max < 0) {
+                // Loop: the split either enters the body (which returns to the split) or leaves
+                int loop = nfa_add(prog, N_SPLIT, -1, -1, next);
+                if (loop < 0) return -1;
+                int body = compile_node(prog, p, n->left, loop);
+                if (body < 0) return -1;
+                prog->nodes[loop].out = body;
+                tail = loop;
+            } else {
+                // Optional copies: each either runs the body and continues, or skips to the end
+                for (int i = n->min; i < n->max; i++) {
+                    int body = compile_node(prog, p, n->left, tail);
+                    if (body < 0) return -1;
+                    tail = nfa_add(prog, N_SPLIT, -1, body, next);
+                    if (tail < 0) return -1;
+                }
+            }
+            for (int i = 0; i < n->min; i++) {
+                tail = compile_node(prog, p, n->left, tail);
+                if (tail < 0) return -1;
+            }
+            return tail;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Returns the byte a set stands for if it is a single literal (with -i: both cases of one
+ * letter), or -1 otherwise.
+ */
+static int set_literal(const parser_t *p, const byteset_t *s) {
+    int found = -1, count = 0;
+    for (int c = 0; c < 256; c++) {
+        if (set_has(s, (unsigned char)c)) {
+            count++;
+            if (found < 0) found = c;
+        }
+    }
+    if (count == 1) return found;
+    if (count == 2 && p->case_insensitive && isupper(found) && set_has(s, (unsigned char)tolower(found))) {
+        return tolower(found);
+    }
+    return -1;
+}
+
+typedef struct {
+    char *best;
+    size_t best_len;
+    char *run;
+    size_t run_len;
+    int simple;       // Every item so far was a plain literal
+} literal_scan_t;
+
+static void end_run(literal_scan_t *ls) {
+    if (ls->run_len > ls->best_len) {
+        memcpy(ls->best, ls->run, ls->run_len);
+        ls->best_len = ls->run_len;
+    }
+    ls->run_len = 0;
+}
+
+/**
+ * Walks the top-level concatenation and collects the longest run of consecutive literal
+ * bytes; any other item (class, repetition, alternation, anchor) ends a run.
+ */
+static void scan_literals(const parser_t *p, int node, literal_scan_t *ls) {
+    const re_node_t *n = &p->nodes[node];
+    if (n->kind == RE_CAT) {
+        scan_literals(p, n->left, ls);
+        scan_literals(p, n->right, ls);
+        return;
+    }
+    if (n->kind == RE_SET) {
+        int c = set_literal(p, &p->sets[n->set]);
+        if (c >= 0) {
+            ls->run[ls->run_len++] = (char)c;
+            return;
+        }
+    }
+    if (n->kind == RE_REPEAT && n->min >= 1 && p->nodes[n->left].kind == RE_SET) {
+        // x+ or x{2,}: at least one x is required, but the next literal need not follow it
+        int c = set_literal(p, &p->sets[p->nodes[n->left].set]);
+        if (c >= 0) ls->run[ls->run_len++] = (char)c;
+    }
+    if (n->kind != RE_EMPTY) ls->simple = 0;
+    end_run(ls);
+}
+
+dfa_program_t *dfa_compile(const char *pattern, size_t len, int case_insensitive, const char **error) {
+    parser_t p;
+    memset(&p, 0, sizeof(p));
+    p.pat = pattern;
+    p.len = len;
+    p.case_insensitive = case_insensitive;
+
+    dfa_program_t *prog = calloc(1, sizeof(*prog));
+    if (!prog) {
+        *error = "out of memory";
+        return NULL;
+    }
+
+    int root = parse_alt(&p);
+    if (root >= 0 && p.pos < p.len) {
+        p.error = "unmatched )";
+        root = -1;
+    }
+    if (root < 0) {
+        *error = p.error ? p.error : "out of memory";
+        goto fail;
+    }
+
+    int match = nfa_add(prog, N_MATCH, -1, -1, -1);
+    prog->start = compile_node(prog, &p, root, match);
+    if (prog->start < 0) {
+        *error = "regular expression too large";
+        goto fail;
+    }
+
+    // The literal can be at most as long as the pattern itself
+    literal_scan_t ls = {malloc(len + 1), 0, malloc(len + 1), 0, 1};
+    if (!ls.best || !ls.run) {
+        free(ls.best);
+        free(ls.run);
+        *error = "out of memory";
+        goto fail;
+    }
+    scan_literals(&p, root, &ls);
+    end_run(&ls);
+    free(ls.run);
+    if (ls.best_len > 0) {
+        prog->literal = ls.best;
+        prog->literal_len = ls.best_len;
+        prog->is_literal = ls.simple;
+    } else {
+        free(ls.best);
+    }
+
+    prog->sets = p.sets;
+    prog->set_count = p.set_count;
+    free(p.nodes);
+    return prog;
+
+fail:
+    free(p.nodes);
+    free(p.sets);
+    dfa_free(prog);
+    return NULL;
+}
+
+const char *dfa_required_literal(const dfa_program_t *prog, size_t *len) {
+    *len = prog->literal_len;
+    return prog->literal;
+}
+
+int dfa_is_literal(const dfa_program_t *prog) {
+    return prog->literal != NULL && prog->is_literal;
+}
+
+void dfa_free(dfa_program_t *prog) {
+    if (!prog) return;
+    free(prog->nodes);
+    free(prog->sets);
+    free(prog->literal);
+    free(prog);
+}
+
+/* ---------------------------------------------------------------------------------------
+ * Lazy DFA: states are sorted sets of NFA nodes, built on first use and cached
+ * ------------------------------------------------------------------------------------- */
+
+typedef struct {
+    int32_t next[256];  // Successor per input byte, -1 while not yet computed
+    int *set;           // Sorted NFA nodes (N_CHAR, N_EOL and N_MATCH only)
+    size_t set_len;
+    uint32_t hash;
+    int accept;         // The pattern has matched
+    int accept_eol;     // The pattern matches if the line ends here ('^' too, in the start state)
+} dstate_t;
+
+// Offsets of states in the arena are kept to a multiple of this
+#define STATE_ALIGN ((size_t)16)
+
+/**
+ * @brief The states of one thread. All memory is allocated with the cache, so that
+ * scanning never allocates: states are cut from the arena, and once it is full the cache
+ * is flushed.
+ */
+struct dfa_cache {
+    const dfa_program_t *prog;
+    char *arena;        // The states and their NFA sets
+    size_t arena_size;
+    size_t used;        // Bytes of the arena taken
+    dstate_t **states;  // max_states entries
+    size_t count, max_states;
+    int32_t *table;     // Open addressing hash of state indices, -1 = empty; at most half full
+    size_t table_size;
+    int32_t start;      // State at the beginning of a line, -1 until built
+    unsigned flushes;   // Incremented whenever the cache is emptied
+    int *stack;         // Scratch space for closures, one slot per NFA node
+    int *list;
+    size_t list_len;
+    uint32_t *mark;     // Per NFA node: generation in which it was last visited
+    uint32_t generation;
+};
+
+static void sift_down(int *a, size_t root, size_t end) {
+    for (size_t child; (child = 2 * root + 1) < end; root = child) {
+        if (child + 1 < end && a[child + 1] > a[child]) child++;
+        if (a[root] >= a[child]) break;
+        int t = a[root];
+        a[root] = a[child];
+        a[child] = t;
+    }
+}
+
+/**
+ * Sorts a set of NFA nodes in place (heapsort: qsort may allocate).
+ */
+static void sort_ints(int *a, size_t n) {
+    for (size_t i = n / 2; i > 0; i--) sift_down(a, i - 1, n);
+    for (size_t end = n; end > 1; end--) {
+        int t = a[0];
+        a[0] = a[end - 1];
+        a[end - 1] = t;
+        sift_down(a, 0, end - 1);
+    }
+}
+
+/**
+ * Arena bytes taken by a state whose set has len nodes.
+ */
+static size_t state_bytes(size_t len) {
+    size_t bytes = sizeof(dstate_t) + (len ? len : 1) * sizeof(int);
+    return (bytes + STATE_ALIGN - 1) & ~(STATE_ALIGN - 1);
+}
+
+static void next_generation(dfa_cache_t *c) {
+    if (++c->generation == 0) {
+        memset(c->mark, 0, c->prog->count * sizeof(*c->mark));
+        c->generation = 1;
+    }
+}
+
+/**
+ * Adds the epsilon closure of an NFA node to the scratch list. '^' is only passed at the
+ * start of a line; '$' nodes are kept in the set and resolved by the end-of-line check.
+ */
+static void closure_add(dfa_cache_t *c, int node, int at_bol) {
+    const nfa_node_t *nodes = c->prog->nodes;
+    size_t top = 0;
+    c->stack[top++] = node;
+
+    while (top > 0) {
+        int n = c->stack[--top];
+        if (n < 0 || c->mark[n] == c->generation) continue;
+        c->mark[n] = c->generation;
+
+        switch (nodes[n].kind) {
+            case N_SPLIT:
+                // Every node is pushed at most once per generation, so the stack cannot overflow
+                c->stack[top++] = nodes[n].out2;
+                c->stack[top++] = nodes[n].out;
+                break;
+            case N_BOL:
+                if (at_bol) c->stack[top++] = nodes[n].out;
+                break;
+            default:
+                c->list[c->list_len++] = n;
+                break;
+        }
+    }
+}
+
+/**
+ * Checks whether an end of line reached in this set completes a match, by following '$'
+ * nodes and epsilon edges only. At the start of a line, i.e. for an empty line, '^' is
+ * passed as well, so that "$^" matches there as it does in grep.
+ */
+static int accepts_at_eol(dfa_cache_t *c, const int *set, size_t set_len, int at_bol) {
+    const nfa_node_t *nodes = c->prog->nodes;
+    size_t top = 0;
+    next_generation(c);
+    for (size_t i = 0; i < set_len; i++) {
+        if (nodes[set[i]].kind == N_EOL) c->stack[top++] = nodes[set[i]].out;
+    }
+    while (top > 0) {
+        int n = c->stack[--top];
+        if (n < 0 || c->mark[n] == c->generation) continue;
+        c->mark[n] = c->generation;
+        switch (nodes[n].kind) {
+            case N_MATCH:
+                return 1;
+            case N_SPLIT:
+                c->stack[top++] = nodes[n].out2;
+                c->stack[top++] = nodes[n].out;
+                break;
+            case N_EOL:
+                c->stack[top++] = nodes[n].out;
+                break;
+            case N_BOL:
+                if (at_bol) c->stack[top++] = nodes[n].out;
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+static uint32_t hash_set(const int *set, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint32_t)set[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void cache_flush(dfa_cache_t *c) {
+    c->count = 0;
+    c->used = 0;
+    for (size_t i = 0; i < c->table_size; i++) c->table[i] = -1;
+    c->start = -1;
+    c->flushes++;
+}
+
+/**
+ * Returns the state for the set in the scratch list, creating it (and flushing the cache
+ * first if it is full) when it is not cached yet.
+ * @param at_bol The state is the start state. It differs from the state of the same set
+ * elsewhere in a line in its end-of-line check, so it is never shared with one.
+ */
+static int32_t cache_state(dfa_cache_t *c, int at_bol) {
+    sort_ints(c->list, c->list_len);
+    uint32_t hash = hash_set(c->list, c->list_len);
+
+    size_t slot = hash & (c->table_size - 1);
+    while (!at_bol && c->table[slot] >= 0) {
+        dstate_t *s = c->states[c->table[slot]];
+        if (s->hash == hash && s->set_len == c->list_len &&
+            memcmp(s->set, c->list, c->list_len * sizeof(*c->list)) == 0) {
+            return c->table[slot];
+        }
+        slot = (slot + 1) & (c->table_size - 1);
+    }
+
+    size_t bytes = state_bytes(c->list_len);
+    if (c->used + bytes > c->arena_size || c->count == c->max_states) {
+        cache_flush(c);
+        slot = hash & (c->table_size - 1); // Table is empty now
+    }
+
+    dstate_t *s = (dstate_t *)(c->arena + c->used);
+    int *set = (int *)(s + 1);
+    memcpy(set, c->list, c->list_len * sizeof(int));
+    for (int b = 0; b < 256; b++) s->next[b] = -1;
+    s->set = set;
+    s->set_len = c->list_len;
+    s->hash = hash;
+    s->accept = 0;
+    for (size_t i = 0; i < s->set_len; i++) {
+        if (c->prog->nodes[set[i]].kind == N_MATCH) s->accept = 1;
+    }
+    s->accept_eol = s->accept || accepts_at_eol(c, set, s->set_len, at_bol);
+
+    int32_t index = (int32_t)c->count;
+    c->states[c->count++] = s;
+    c->used += bytes;
+    if (!at_bol) c->table[slot] = index;
+    return index;
+}
+
+static int32_t start_state(dfa_cache_t *c) {
+    if (c->start < 0) {
+        next_generation(c);
+        c->list_len = 0;
+        closure_add(c, c->prog->start, 1);
+        c->start = cache_state(c, 1);
+    }
+    return c->start;
+}
+
+/**
+ * Computes the successor of state `from` on `byte`. Every step also restarts the NFA at
+ * the current position, which makes the search unanchored.
+ */
+static int32_t step(dfa_cache_t *c, int32_t from, unsigned char byte) {
+    const nfa_node_t *nodes = c->prog->nodes;
+    dstate_t *s = c->states[from];
+
+    next_generation(c);
+    c->list_len = 0;
+    for (size_t i = 0; i < s->set_len; i++) {
+        const nfa_node_t *n = &nodes[s->set[i]];
+        if (n->kind == N_CHAR && set_has(&c->prog->sets[n->set], byte)) closure_add(c, n->out, 0);
+    }
+    closure_add(c, c->prog->start, 0);
+
+    unsigned flushes = c->flushes;
+    int32_t to = cache_state(c, 0);
+    // After a flush `s` is gone; the transition is simply recomputed next time
+    if (c->flushes == flushes) s->next[byte] = to;
+    return to;
+}
+
+dfa_cache_t *dfa_cache_new(const dfa_program_t *prog, size_t budget_bytes) {
+    dfa_cache_t *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->prog = prog;
+    c->start = -1;
+    // The largest state (every node in its set) always fits after a flush
+    c->arena_size = (budget_bytes & ~(STATE_ALIGN - 1)) + state_bytes(prog->count);
+    c->max_states = c->arena_size / state_bytes(1);
+    c->table_size = 64;
+    while (c->table_size < 2 * c->max_states) c->table_size *= 2;
+    // Pages of the arena are only touched as states are built
+    c->arena = malloc(c->arena_size);
+    c->states = malloc(c->max_states * sizeof(*c->states));
+    c->table = malloc(c->table_size * sizeof(*c->table));
+    c->stack = malloc(prog->count * 2 * sizeof(*c->stack));
+    c->list = malloc(prog->count * sizeof(*c->list));
+    c->mark = calloc(prog->count, sizeof(*c->mark));
+    if (!c->arena || !c->states || !c->table || !c->stack || !c->list || !c->mark) {
+        dfa_cache_free(c);
+        return NULL;
+    }
+    for (size_t i = 0; i < c->table_size; i++) c->table[i] = -1;
+    return c;
+}
+
+void dfa_cache_free(dfa_cache_t *c) {
+    if (!c) return;
+    free(c->arena);
+    free(c->states);
+    free(c->table);
+    free(c->stack);
+    free(c->list);
+    free(c->mark);
+    free(c);
+}
+
+/**
+ * Advances the DFA from *state up to (not including) the next '\n' or `end`.
+ * @param state The state to start in; receives the state where the scan stopped.
+ * @param line_end Receives the position where the scan stopped.
+ * @return 1 if the pattern has matched, 0 if the scan reached '\n' or `end` first.
+ */
+static int run(dfa_cache_t *c, int32_t *state, const char *p, const char *end, const char **line_end) {
+    int32_t s = *state;
+    dstate_t *st = c->states[s];
+
+    while (!st->accept) {
+        if (p == end || *p == '\n') {
+            *line_end = p;
+            *state = s;
+            return 0;
+        }
+        unsigned char b = (unsigned char)*p++;
+        int32_t t = st->next[b];
+        s = t >= 0 ? t : step(c, s, b);
+        st = c->states[s];
+    }
+    *line_end = p;
+    *state = s;
+    return 1;
+}
+
+/**
+ * Runs the DFA from the start of a line up to (not including) the next '\n' or `end`.
+ * @param line_end Receives the position where the scan stopped.
+ * @return 1 if the line matches, 0 if not.
+ */
+static int run_line(dfa_cache_t *c, const char *p, const char *end, const char **line_end) {
+    int32_t s = start_state(c);
+    int result = run(c, &s, p, end, line_end);
+    return result != 0 ? result : c->states[s]->accept_eol;
+}
+
+int dfa_match_line(dfa_cache_t *c, const char *line, size_t len) {
+    const char *stop;
+    return run_line(c, line, line + len, &stop);
+}
+
+void dfa_partial_begin(dfa_partial_t *line) {
+    line->state = -1;
+    line->matched = 0;
+}
+
+int dfa_partial_feed(dfa_cache_t *c, dfa_partial_t *line, const char *piece, size_t len) {
+    if (line->matched) return 1;
+    int32_t s = line->state >= 0 ? (int32_t)line->state : start_state(c);
+    const char *stop;
+    line->matched = run(c, &s, piece, piece + len, &stop);
+    line->state = s;
+    return line->matched;
+}
+
+int dfa_partial_end(dfa_cache_t *c, dfa_partial_t *line) {
+    if (!line->matched) {
+        int32_t s = line->state >= 0 ? (int32_t)line->state : start_state(c);
+        line->matched = c->states[s]->accept_eol;
+    }
+    return line->matched;
+}
+
+const char *dfa_find_line(dfa_cache_t *c, const char *hay, size_t len) {
+    const char *p = hay, *end = hay + len;
+    while (p < end) {
+        const char *stop;
+        if (run_line(c, p, end, &stop) != 0) return p;
+        p = stop < end ? stop + 1 : end;
+    }
+    return NULL;
+}
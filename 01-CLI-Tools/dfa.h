@@ -0,0 +1,102 @@
+/**
+ * @file dfa.h
+ * @brief Extended regular expressions (-E) for mygrep, matched with a lazy DFA.
+ * A pattern is parsed and compiled once into a Thompson NFA (dfa_program_t). DFA states
+ * (sets of NFA states) are built on demand while scanning and cached per thread in a
+ * dfa_cache_t whose memory is allocated up front and bounded: when it is full, the cache
+ * is flushed and states are rebuilt as needed. Scanning never allocates.
+ *
+ * Supported syntax: literals, '.', bracket expressions (ranges, negation, [:class:]),
+ * '^', '$', grouping, '|', and the quantifiers '*', '+', '?', {m}, {m,}, {m,n}, plus the
+ * GNU escapes \w \W \s \S. Matching is line based: a line matches if the pattern matches
+ * anywhere inside it.
+ *
+ * Patterns and text are UTF-8. '.', bracket members and ranges match whole characters:
+ * the automaton runs on bytes, and a set of multibyte characters is compiled into an
+ * alternation of byte sequences. Bytes that do not form a valid character only match
+ * themselves as literals. Named classes and \s cover ASCII; \w takes every multibyte
+ * character as a word character.
+ */
+
+#ifndef DFA_H
+#define DFA_H
+
+#include <stddef.h>
+
+#define DFA_DEFAULT_CACHE_BYTES ((size_t)4 << 20) // Per-thread DFA state budget
+
+typedef struct dfa_program dfa_program_t;
+typedef struct dfa_cache dfa_cache_t;
+
+/**
+ * @brief Compiles an extended regular expression.
+ * @param pattern The pattern (need not be NUL-terminated).
+ * @param len Length of the pattern.
+ * @param case_insensitive Flag: 1 to match ASCII letters in either case.
+ * @param error Receives a static description if the pattern is invalid or too large.
+ * @return The compiled program, or NULL on error.
+ */
+dfa_program_t *dfa_compile(const char *pattern, size_t len, int case_insensitive, const char **error);
+
+/**
+ * @brief Longest literal every match must contain, for use as a prefilter.
+ * @param len Receives the literal length.
+ * @return The literal (lowercase if compiled case-insensitive), or NULL if there is none.
+ */
+const char *dfa_required_literal(const dfa_program_t *prog, size_t *len);
+
+/**
+ * @brief Reports whether the whole pattern is just its required literal (no operators),
+ * in which case a plain literal search gives the same result.
+ */
+int dfa_is_literal(const dfa_program_t *prog);
+
+void dfa_free(dfa_program_t *prog);
+
+/**
+ * @brief Creates an empty state cache. A cache must only be used by one thread at a time.
+ * @param budget_bytes Memory for cached states, allocated now (room for one state with
+ * every NFA node is added).
+ * @return The cache, or NULL with errno set if memory runs out.
+ */
+dfa_cache_t *dfa_cache_new(const dfa_program_t *prog, size_t budget_bytes);
+
+void dfa_cache_free(dfa_cache_t *cache);
+
+/**
+ * @brief Tests a single line (without its '\n').
+ * @return 1 if the pattern matches somewhere in the line, 0 otherwise.
+ */
+int dfa_match_line(dfa_cache_t *cache, const char *line, size_t len);
+
+/**
+ * @brief A line tested in pieces (for lines too long to buffer whole). The DFA state is
+ * carried from one piece to the next, so no part of the line has to be kept.
+ */
+typedef struct {
+    long state;   // DFA state after the last piece, -1 before the first
+    int matched;
+} dfa_partial_t;
+
+void dfa_partial_begin(dfa_partial_t *line);
+
+/**
+ * @brief Feeds the next piece of a line (without '\n'). Until dfa_partial_end, the cache
+ * must not be used for anything else.
+ * @return 1 if the pattern has already matched (later pieces are then ignored), 0 otherwise.
+ */
+int dfa_partial_feed(dfa_cache_t *cache, dfa_partial_t *line, const char *piece, size_t len);
+
+/**
+ * @brief Ends the line, resolving a trailing '$'.
+ * @return 1 if the line matches, 0 otherwise.
+ */
+int dfa_partial_end(dfa_cache_t *cache, dfa_partial_t *line);
+
+/**
+ * @brief Finds the first matching line of a buffer that starts at a line boundary.
+ * @return Pointer to the start of that line, or NULL if no line matches.
+ */
+const char *dfa_find_line(dfa_cache_t *cache, const char *hay, size_t len);
+
+#endif
@@ -0,0 +1,359 @@
+/**
+ * @file fold.c
+ * @brief Unicode simple case folding (see fold.h).
+ */
+
+#include <string.h>
+#include "fold.h"
+
+/**
+ * A run of characters that fold by the same distance: count characters from first on,
+ * step apart (2 for the alternating upper/lower pairs of Latin Extended, Cyrillic etc.).
+ */
+typedef struct {
+    uint32_t first;
+    uint8_t count;
+    uint8_t step;
+    int32_t delta;
+} fold_run_t;
+
+// Generated from the Simple_Case_Folding property of Unicode 14.0 (C + S entries of
+// CaseFolding.txt), sorted by first character
+static const fold_run_t fold_runs[] = {
+    {0x0041, 26, 1, 32},
+    {0x00B5, 1, 1, 775},
+    {0x00C0, 23, 1, 32},
+    {0x00D8, 7, 1, 32},
+    {0x0100, 24, 2, 1},
+    {0x0132, 3, 2, 1},
+    {0x0139, 8, 2, 1},
+    {0x014A, 23, 2, 1},
+    {0x0178, 1, 1, -121},
+    {0x0179, 3, 2, 1},
+    {0x017F, 1, 1, -268},
+    {0x0181, 1, 1, 210},
+    {0x0182, 2, 2, 1},
+    {0x0186, 1, 1, 206},
+    {0x0187, 1, 1, 1},
+    {0x0189, 2, 1, 205},
+    {0x018B, 1, 1, 1},
+    {0x018E, 1, 1, 79},
+    {0x018F, 1, 1, 202},
+    {0x0190, 1, 1, 203},
+    {0x0191, 1, 1, 1},
+    {0x0193, 1, 1, 205},
+    {0x0194, 1, 1, 207},
+    {0x0196, 1, 1, 211},
+    {0x0197, 1, 1, 209},
+    {0x0198, 1, 1, 1},
+    {0x019C, 1, 1, 211},
+    {0x019D, 1, 1, 213},
+    {0x019F, 1, 1, 214},
+    {0x01A0, 3, 2, 1},
+    {0x01A6, 1, 1, 218},
+    {0x01A7, 1, 1, 1},
+    {0x01A9, 1, 1, 218},
+    {0x01AC, 1, 1, 1},
+    {0x01AE, 1, 1, 218},
+    {0x01AF, 1, 1, 1},
+    {0x01B1, 2, 1, 217},
+    {0x01B3, 2, 2, 1},
+    {0x01B7, 1, 1, 219},
+    {0x01B8, 1, 1, 1},
+    {0x01BC, 1, 1, 1},
+    {0x01C4, 1, 1, 2},
+    {0x01C5, 1, 1, 1},
+    {0x01C7, 1, 1, 2},
+    {0x01C8, 1, 1, 1},
+    {0x01CA, 1, 1, 2},
+    {0x01CB, 9, 2, 1},
+    {0x01DE, 9, 2, 1},
+    {0x01F1, 1, 1, 2},
+    {0x01F2, 2, 2, 1},
+    {0x01F6, 1, 1, -97},
+    {0x01F7, 1, 1, -56},
+    {0x01F8, 20, 2, 1},
+    {0x0220, 1, 1, -130},
+    {0x0222, 9, 2, 1},
+    {0x023A, 1, 1, 10795},
+    {0x023B, 1, 1, 1},
+    {0x023D, 1, 1, -163},
+    {0x023E, 1, 1, 10792},
+    {0x0241, 1, 1, 1},
+    {0x0243, 1, 1, -195},
+    {0x0244, 1, 1, 69},
+    {0x0245, 1, 1, 71},
+    {0x0246, 5, 2, 1},
+    {0x0345, 1, 1, 116},
+    {0x0370, 2, 2, 1},
+    {0x0376, 1, 1, 1},
+    {0x037F, 1, 1, 116},
+    {0x0386, 1, 1, 38},
+    {0x0388, 3, 1, 37},
+    {0x038C, 1, 1, 64},
+    {0x038E, 2, 1, 63},
+    {0x0391, 17, 1, 32},
+    {0x03A3, 9, 1, 32},
+    {0x03C2, 1, 1, 1},
+    {0x03CF, 1, 1, 8},
+    {0x03D0, 1, 1, -30},
+    {0x03D1, 1, 1, -25},
+    {0x03D5, 1, 1, -15},
+    {0x03D6, 1, 1, -22},
+    {0x03D8, 12, 2, 1},
+    {0x03F0, 1, 1, -54},
+    {0x03F1, 1, 1, -48},
+    {0x03F4, 1, 1, -60},
+    {0x03F5, 1, 1, -64},
+    {0x03F7, 1, 1, 1},
+    {0x03F9, 1, 1, -7},
+    {0x03FA, 1, 1, 1},
+    {0x03FD, 3, 1, -130},
+    {0x0400, 16, 1, 80},
+    {0x0410, 32, 1, 32},
+    {0x0460, 17, 2, 1},
+    {0x048A, 27, 2, 1},
+    {0x04C0, 1, 1, 15},
+    {0x04C1, 7, 2, 1},
+    {0x04D0, 48, 2, 1},
+    {0x0531, 38, 1, 48},
+    {0x10A0, 38, 1, 7264},
+    {0x10C7, 1, 1, 7264},
+    {0x10CD, 1, 1, 7264},
+    {0x13F8, 6, 1, -8},
+    {0x1C80, 1, 1, -6222},
+    {0x1C81, 1, 1, -6221},
+    {0x1C82, 1, 1, -6212},
+    {0x1C83, 2, 1, -6210},
+    {0x1C85, 1, 1, -6211},
+    {0x1C86, 1, 1, -6204},
+    {0x1C87, 1, 1, -6180},
+    {0x1C88, 1, 1, 35267},
+    {0x1C90, 43, 1, -3008},
+    {0x1CBD, 3, 1, -3008},
+    {0x1E00, 75, 2, 1},
+    {0x1E9B, 1, 1, -58},
+    {0x1E9E, 1, 1, -7615},
+    {0x1EA0, 48, 2, 1},
+    {0x1F08, 8, 1, -8},
+    {0x1F18, 6, 1, -8},
+    {0x1F28, 8, 1, -8},
+    {0x1F38, 8, 1, -8},
+    {0x1F48, 6, 1, -8},
+    {0x1F59, 4, 2, -8},
+    {0x1F68, 8, 1, -8},
+    {0x1F88, 8, 1, -8},
+    {0x1F98, 8, 1, -8},
+    {0x1FA8, 8, 1, -8},
+    {0x1FB8, 2, 1, -8},
+    {0x1FBA, 2, 1, -74},
+    {0x1FBC, 1, 1, -9},
+    {0x1FBE, 1, 1, -7173},
+    {0x1FC8, 4, 1, -86},
+    {0x1FCC, 1, 1, -9},
+    {0x1FD8, 2, 1, -8},
+    {0x1FDA, 2, 1, -100},
+    {0x1FE8, 2, 1, -8},
+    {0x1FEA, 2, 1, -112},
+    {0x1FEC, 1, 1, -7},
+    {0x1FF8, 2, 1, -128},
+    {0x1FFA, 2, 1, -126},
+    {0x1FFC, 1, 1, -9},
+    {0x2126, 1, 1, -7517},
+    {0x212A, 1, 1, -8383},
+    {0x212B, 1, 1, -8262},
+    {0x2132, 1, 1, 28},
+    {0x2160, 16, 1, 16},
+    {0x2183, 1, 1, 1},
+    {0x24B6, 26, 1, 26},
+    {0x2C00, 48, 1, 48},
+    {0x2C60, 1, 1, 1},
+    {0x2C62, 1, 1, -10743},
+    {0x2C63, 1, 1, -3814},
+    {0x2C64, 1, 1, -10727},
+    {0x2C67, 3, 2, 1},
+    {0x2C6D, 1, 1, -10780},
+    {0x2C6E, 1, 1, -10749},
+    {0x2C6F, 1, 1, -10783},
+    {0x2C70, 1, 1, -10782},
+    {0x2C72, 1, 1, 1},
+    {0x2C75, 1, 1, 1},
+    {0x2C7E, 2, 1, -10815},
+    {0x2C80, 50, 2, 1},
+    {0x2CEB, 2, 2, 1},
+    {0x2CF2, 1, 1, 1},
+    {0xA640, 23, 2, 1},
+    {0xA680, 14, 2, 1},
+    {0xA722, 7, 2, 1},
+    {0xA732, 31, 2, 1},
+    {0xA779, 2, 2, 1},
+    {0xA77D, 1, 1, -35332},
+    {0xA77E, 5, 2, 1},
+    {0xA78B, 1, 1, 1},
+    {0xA78D, 1, 1, -42280},
+    {0xA790, 2, 2, 1},
+    {0xA796, 10, 2, 1},
+    {0xA7AA, 1, 1, -42308},
+    {0xA7AB, 1, 1, -42319},
+    {0xA7AC, 1, 1, -42315},
+    {0xA7AD, 1, 1, -42305},
+    {0xA7AE, 1, 1, -42308},
+    {0xA7B0, 1, 1, -42258},
+    {0xA7B1, 1, 1, -42282},
+    {0xA7B2, 1, 1, -42261},
+    {0xA7B3, 1, 1, 928},
+    {0xA7B4, 8, 2, 1},
+    {0xA7C4, 1, 1, -48},
+    {0xA7C5, 1, 1, -42307},
+    {0xA7C6, 1, 1, -35384},
+    {0xA7C7, 2, 2, 1},
+    {0xA7D0, 1, 1, 1},
+    {0xA7D6, 2, 2, 1},
+    {0xA7F5, 1, 1, 1},
+    {0xAB70, 80, 1, -38864},
+    {0xFF21, 26, 1, 32},
+    {0x10400, 40, 1, 40},
+    {0x104B0, 36, 1, 40},
+    {0x10570, 11, 1, 39},
+    {0x1057C, 15, 1, 39},
+    {0x1058C, 7, 1, 39},
+    {0x10594, 2, 1, 39},
+    {0x10C80, 51, 1, 64},
+    {0x118A0, 32, 1, 32},
+    {0x16E40, 32, 1, 32},
+    {0x1E900, 34, 1, 34},
+};
+
+// Folds of U+0080..U+07FF (Latin, Greek, Cyrillic, ...), the characters of most text that
+// is not ASCII; filled by fold_init from fold_runs
+static uint16_t fold_two_byte[0x800 - 0x80];
+
+static uint32_t fold_lookup(uint32_t c) {
+    // Last run starting at or before c
+    size_t lo = 0, hi = sizeof(fold_runs) / sizeof(fold_runs[0]);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (fold_runs[mid].first <= c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) return c;
+    const fold_run_t *run = &fold_runs[lo - 1];
+    uint32_t distance = c - run->first;
+    if (distance % run->step != 0 || distance / run->step >= run->count) return c;
+    return (uint32_t)((int32_t)c + run->delta);
+}
+
+void fold_init(void) {
+    for (uint32_t c = 0x80; c < 0x800; c++) fold_two_byte[c - 0x80] = (uint16_t)fold_lookup(c);
+}
+
+uint32_t fold_code_point(uint32_t c) {
+    if (c < 0x80) return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    if (c < 0x800) return fold_two_byte[c - 0x80];
+    return fold_lookup(c);
+}
+
+/**
+ * Decodes one UTF-8 character.
+ * @return Its length (1-4), or 0 if src does not start with a valid sequence.
+ */
+static size_t decode(const unsigned char *src, size_t len, uint32_t *c) {
+    size_t n;
+    uint32_t min;
+    if (src[0] < 0x80) {
+        *c = src[0];
+        return 1;
+    } else if (src[0] >= 0xC2 && src[0] <= 0xDF) {
+        n = 2;
+        min = 0x80;
+        *c = src[0] & 0x1F;
+    } else if (src[0] >= 0xE0 && src[0] <= 0xEF) {
+        n = 3;
+        min = 0x800;
+        *c = src[0] & 0x0F;
+    } else if (src[0] >= 0xF0 && src[0] <= 0xF4) {
+        n = 4;
+        min = 0x10000;
+        *c = src[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if (len < n) return 0;
+    for (size_t i = 1; i < n; i++) {
+        if ((src[i] & 0xC0) != 0x80) return 0;
+        *c = *c << 6 | (src[i] & 0x3F);
+    }
+    // Overlong forms, surrogates and values past U+10FFFF are not valid
+    if (*c < min || (*c >= 0xD800 && *c <= 0xDFFF) || *c > 0x10FFFF) return 0;
+    return n;
+}
+
+static size_t encode(uint32_t c, char *dst) {
+    if (c < 0x80) {
+        dst[0] = (char)c;
+        return 1;
+    }
+    if (c < 0x800) {
+        dst[0] = (char)(0xC0 | c >> 6);
+        dst[1] = (char)(0x80 | (c & 0x3F));
+        return 2;
+    }
+    if (c < 0x10000) {
+        dst[0] = (char)(0xE0 | c >> 12);
+        dst[1] = (char)(0x80 | (c >> 6 & 0x3F));
+        dst[2] = (char)(0x80 | (c & 0x3F));
+        return 3;
+    }
+    dst[0] = (char)(0xF0 | c >> 18);
+    dst[1] = (char)(0x80 | (c >> 12 & 0x3F));
+    dst[2] = (char)(0x80 | (c >> 6 & 0x3F));
+    dst[3] = (char)(0x80 | (c & 0x3F));
+    return 4;
+}
+
+size_t fold_char(const char *src, size_t len, char *dst, size_t *dst_len) {
+    uint32_t c;
+    size_t n = decode((const unsigned char *)src, len, &c);
+    if (n == 0) {
+        dst[0] = src[0];
+        *dst_len = 1;
+        return 1;
+    }
+    *dst_len = encode(fold_code_point(c), dst);
+    return n;
+}
+
+size_t fold_utf8(const char *src, size_t len, char *dst) {
+    size_t i = 0, out = 0;
+    while (i < len) {
+        unsigned char b = (unsigned char)src[i];
+        if (b < 0x80) {
+            dst[out++] = (char)((b >= 'A' && b <= 'Z') ? b + ('a' - 'A') : b);
+            i++;
+            continue;
+        }
+        if (b >= 0xC2 && b <= 0xDF && i + 1 < len && ((unsigned char)src[i + 1] & 0xC0) == 0x80) {
+            uint32_t c = fold_two_byte[((uint32_t)(b & 0x1F) << 6 | ((unsigned char)src[i + 1] & 0x3F)) - 0x80];
+            out += encode(c, dst + out);
+            i += 2;
+            continue;
+        }
+        size_t written;
+        i += fold_char(src + i, len - i, dst + out, &written);
+        out += written;
+    }
+    return out;
+}
+
+size_t fold_complete(const char *buf, size_t len) {
+    // Back up over at most three continuation bytes to the last lead byte
+    size_t start = len;
+    while (start > 0 && len - start < 3 && ((unsigned char)buf[start - 1] & 0xC0) == 0x80) start--;
+    if (start == 0) return len;
+    unsigned char lead = (unsigned char)buf[start - 1];
+    size_t need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    return len - (start - 1) < need ? start - 1 : len;
+}
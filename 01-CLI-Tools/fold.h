@@ -0,0 +1,49 @@
+/**
+ * @file fold.h
+ * @brief Unicode simple case folding of UTF-8 text for mygrep -i.
+ * Simple folding maps every character to one character (CaseFolding.txt, status C and S),
+ * so folded text keeps its line structure and a match can be mapped back character by
+ * character. Multi-character folds such as "ß" -> "ss" are not applied, and the Turkic
+ * dotted and dotless i fold as in other languages. Bytes that do not form a valid UTF-8
+ * sequence are copied unchanged.
+ */
+
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Folding grows text by at most half (two-byte letters such as U+023A fold to three bytes)
+#define FOLD_BOUND(len) ((len) + (len) / 2 + 4)
+
+/**
+ * @brief Builds the lookup table for two-byte characters. Call once before folding.
+ */
+void fold_init(void);
+
+/**
+ * @brief Folds one code point; characters without a case fold are returned unchanged.
+ */
+uint32_t fold_code_point(uint32_t c);
+
+/**
+ * @brief Folds the character at the start of src into dst (at most 4 bytes).
+ * @param dst_len Receives the number of bytes written.
+ * @return Number of bytes of src consumed (at least 1 if len > 0).
+ */
+size_t fold_char(const char *src, size_t len, char *dst, size_t *dst_len);
+
+/**
+ * @brief Folds UTF-8 text into dst, which must hold FOLD_BOUND(len) bytes.
+ * @return Length of the folded text.
+ */
+size_t fold_utf8(const char *src, size_t len, char *dst);
+
+/**
+ * @brief Length of the longest prefix of buf[0, len) that does not end inside a
+ * multibyte character, so that text can be folded in pieces.
+ */
+size_t fold_complete(const char *buf, size_t len);
+
+#endif
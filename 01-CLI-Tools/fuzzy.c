@@ -0,0 +1,287 @@
+/**
+ * @file fuzzy.c
+ * @brief Bit-parallel approximate matching (Wu-Manber bitap), behind an exact prefilter on
+ * pattern pieces.
+ *
+ * State vector R[j] has bit i set if the first i + 1 pattern bytes match the text ending
+ * at the current byte with at most j errors. For the next text byte c, with B[c] the set
+ * of pattern positions holding c:
+ *
+ *   R'[0] = (R[0] << 1 | 1) & B[c]
+ *   R'[j] = (R[j] << 1 | 1) & B[c]     match
+ *         | R[j-1]                     insertion: c is extra
+ *         | (R[j-1] << 1 | 1)          substitution: c replaces a pattern byte
+ *         | (R'[j-1] << 1 | 1)         deletion: a pattern byte is missing
+ *
+ * The pattern occurs with at most k errors wherever bit m - 1 of R[k] is set.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "fuzzy.h"
+#include "multi.h"
+
+// Shorter pieces match too much of any text for the prefilter to pay off
+#define FUZZY_MIN_PIECE 2
+
+/**
+ * @brief One pattern as a bitap automaton.
+ */
+typedef struct {
+    size_t len;
+    size_t words;         // 64-bit words per state vector: (len + 63) / 64
+    uint64_t *masks;      // 256 * words: B[c], bit i set if pattern byte i matches c
+} fuzzy_pattern_t;
+
+struct fuzzy {
+    fuzzy_pattern_t *patterns;
+    size_t count;
+    unsigned errors;
+    size_t max_len;
+    size_t max_words;
+    // Prefilter: the pieces (none if the patterns are too short)
+    char **pieces;        // NUL-terminated copies, lowercase with case_insensitive
+    size_t *piece_lengths;
+    size_t piece_count;
+    teddy_t *teddy;       // Small piece sets
+    ac_automaton_t *ac;   // Piece sets Teddy cannot take
+};
+
+/**
+ * Builds B[c] for every byte value.
+ */
+static int pattern_init(fuzzy_pattern_t *p, const char *pattern, size_t len, int case_insensitive) {
+    p->len = len;
+    p->words = (len + 63) / 64;
+    p->masks = calloc(256 * p->words, sizeof(uint64_t));
+    if (!p->masks) return -1;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)pattern[i];
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        p->masks[c * p->words + i / 64] |= bit;
+        if (case_insensitive && isalpha(c)) {
+            p->masks[(unsigned char)tolower(c) * p->words + i / 64] |= bit;
+            p->masks[(unsigned char)toupper(c) * p->words + i / 64] |= bit;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Runs a pattern that fits into one word over text; a '\n' starts over.
+ * @return Pointer to the byte at which the first match ends, or NULL.
+ */
+static const char *bitap_scan_word(const fuzzy_pattern_t *p, unsigned k, const char *text, size_t len) {
+    uint64_t r[FUZZY_MAX_ERRORS + 1];
+    const uint64_t accept = (uint64_t)1 << (p->len - 1);
+    for (unsigned j = 0; j <= k; j++) r[j] = ((uint64_t)1 << j) - 1; // j deletions at the start
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '\n') {
+            for (unsigned j = 0; j <= k; j++) r[j] = ((uint64_t)1 << j) - 1;
+            continue;
+        }
+        uint64_t b = p->masks[c];
+        uint64_t prev_old = r[0];
+        r[0] = ((r[0] << 1) | 1) & b;
+        for (unsigned j = 1; j <= k; j++) {
+            uint64_t old = r[j];
+            r[j] = (((old << 1) | 1) & b) | prev_old | ((prev_old | r[j - 1]) << 1) | 1;
+            prev_old = old;
+        }
+        if (r[k] & accept) return text + i;
+    }
+    return NULL;
+}
+
+/**
+ * Shifts a multi-word vector left by one bit, shifting in a 1 at bit 0.
+ */
+static uint64_t shifted_word(const uint64_t *v, size_t w) {
+    return (v[w] << 1) | (w > 0 ? v[w - 1] >> 63 : 1);
+}
+
+/**
+ * Like bitap_scan_word for patterns of more than 64 bytes.
+ * @param scratch Room for (k + 3) * p->words words.
+ */
+static const char *bitap_scan_multi(const fuzzy_pattern_t *p, unsigned k, const char *text, size_t len,
+                                    uint64_t *scratch) {
+    size_t words = p->words;
+    uint64_t *r = scratch;                       // (k + 1) vectors
+    uint64_t *prev_old = r + (k + 1) * words;    // R[j-1] before this byte
+    uint64_t *old = prev_old + words;            // R[j] before this byte
+    const size_t last = (p->len - 1) / 64;
+    const uint64_t accept = (uint64_t)1 << ((p->len - 1) % 64);
+
+    for (size_t i = 0; i <= len; i++) {
+        if (i == 0 || text[i - 1] == '\n') {
+            // Start over: j deletions at the start, as in bitap_scan_word
+            memset(r, 0, (k + 1) * words * sizeof(uint64_t));
+            for (unsigned j = 0; j <= k; j++) r[j * words] = ((uint64_t)1 << j) - 1;
+        }
+        if (i == len) break;
+        unsigned char c = (unsigned char)text[i];
+        if (c == '\n') continue;
+        const uint64_t *b = p->masks + c * words;
+
+        memcpy(prev_old, r, words * sizeof(uint64_t));
+        for (size_t w = words; w-- > 0;) r[w] = shifted_word(r, w) & b[w];
+        for (unsigned j = 1; j <= k; j++) {
+            uint64_t *rj = r + j * words;
+            const uint64_t *rp = rj - words;
+            memcpy(old, rj, words * sizeof(uint64_t));
+            for (size_t w = 0; w < words; w++) {
+                rj[w] = (shifted_word(old, w) & b[w]) | prev_old[w] | shifted_word(prev_old, w) | shifted_word(rp, w);
+            }
+            memcpy(prev_old, old, words * sizeof(uint64_t));
+        }
+        if (r[k * words + last] & accept) return text + i;
+    }
+    return NULL;
+}
+
+/**
+ * Runs every pattern over text.
+ * @return The earliest byte at which some match ends, or NULL.
+ */
+static const char *bitap_scan(const fuzzy_t *f, const char *text, size_t len, uint64_t *scratch) {
+    const char *best = NULL;
+    for (size_t p = 0; p < f->count; p++) {
+        // A later pattern only matters if it ends a match before the best so far
+        size_t limit = best ? (size_t)(best - text) + 1 : len;
+        const fuzzy_pattern_t *pat = &f->patterns[p];
+        const char *end = pat->words == 1 ? bitap_scan_word(pat, f->errors, text, limit)
+                                          : bitap_scan_multi(pat, f->errors, text, limit, scratch);
+        if (end != NULL) best = end;
+    }
+    return best;
+}
+
+/**
+ * Cuts every pattern into errors + 1 pieces of about equal length for the prefilter.
+ * @return 0, or -1 if a piece would be shorter than FUZZY_MIN_PIECE (no prefilter).
+ */
+static int build_pieces(fuzzy_t *f, char *const *patterns, const size_t *lengths, int case_insensitive) {
+    size_t parts = f->errors + 1;
+    for (size_t p = 0; p < f->count; p++) {
+        if (lengths[p] / parts < FUZZY_MIN_PIECE) return -1;
+    }
+
+    f->pieces = calloc(f->count * parts, sizeof(*f->pieces));
+    f->piece_lengths = malloc(f->count * parts * sizeof(*f->piece_lengths));
+    if (!f->pieces || !f->piece_lengths) return -2;
+    for (size_t p = 0; p < f->count; p++) {
+        for (size_t i = 0; i < parts; i++) {
+            size_t start = lengths[p] * i / parts, end = lengths[p] * (i + 1) / parts;
+            char *piece = malloc(end - start + 1);
+            if (!piece) return -2;
+            for (size_t b = start; b < end; b++) {
+                piece[b - start] = case_insensitive ? (char)tolower((unsigned char)patterns[p][b]) : patterns[p][b];
+            }
+            piece[end - start] = '\0'; // Teddy copies the terminator too
+            f->pieces[f->piece_count] = piece;
+            f->piece_lengths[f->piece_count++] = end - start;
+        }
+    }
+
+    // With at least one error there are always two pieces or more
+    f->teddy = teddy_build(f->pieces, f->piece_lengths, f->piece_count, case_insensitive);
+    if (f->teddy == NULL) {
+        f->ac = ac_build(f->pieces, f->piece_lengths, f->piece_count, case_insensitive);
+        if (f->ac == NULL) return -2;
+    }
+    return 0;
+}
+
+fuzzy_t *fuzzy_build(char *const *patterns, const size_t *lengths, size_t count, unsigned errors,
+                     int case_insensitive) {
+    fuzzy_t *f = calloc(1, sizeof(*f));
+    if (!f) return NULL;
+    f->errors = errors;
+    f->patterns = calloc(count, sizeof(*f->patterns));
+    if (!f->patterns) {
+        free(f);
+        errno = ENOMEM;
+        return NULL;
+    }
+    f->count = count;
+    for (size_t p = 0; p < count; p++) {
+        if (pattern_init(&f->patterns[p], patterns[p], lengths[p], case_insensitive) == -1) {
+            fuzzy_free(f);
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (lengths[p] > f->max_len) f->max_len = lengths[p];
+        if (f->patterns[p].words > f->max_words) f->max_words = f->patterns[p].words;
+    }
+
+    if (build_pieces(f, patterns, lengths, case_insensitive) == -2) {
+        fuzzy_free(f);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return f;
+}
+
+/**
+ * Finds the next piece at or after hay.
+ */
+static const char *find_piece(const fuzzy_t *f, const char *hay, size_t hay_len) {
+    size_t len;
+    if (f->teddy != NULL) return teddy_find(f->teddy, hay, hay_len, &len);
+    return ac_find(f->ac, hay, hay_len, &len);
+}
+
+size_t fuzzy_scratch_words(const fuzzy_t *f) {
+    return f->max_words > 1 ? (f->errors + 3) * f->max_words : 0;
+}
+
+const char *fuzzy_find(const fuzzy_t *f, const char *hay, size_t hay_len, uint64_t *scratch, size_t *match_len) {
+    *match_len = 1;
+
+    const char *end = hay + hay_len;
+    const char *found = NULL;
+    if (f->piece_count == 0) {
+        found = bitap_scan(f, hay, hay_len, scratch);
+    } else {
+        // A match is at most `span` bytes long, so it lies within `span` bytes of its piece
+        size_t span = f->max_len + f->errors;
+        const char *p = hay;
+        while (p < end && found == NULL) {
+            const char *piece = find_piece(f, p, (size_t)(end - p));
+            if (piece == NULL) break;
+            const char *from = (size_t)(piece - hay) > span ? piece - span : hay;
+            const char *to = (size_t)(end - piece) > span ? piece + span : end;
+            found = bitap_scan(f, from, (size_t)(to - from), scratch);
+            p = piece + 1;
+        }
+    }
+    return found;
+}
+
+size_t fuzzy_pieces(const fuzzy_t *f, const char *const **pieces, const size_t **lengths) {
+    *pieces = (const char *const *)f->pieces;
+    *lengths = f->piece_lengths;
+    return f->piece_count;
+}
+
+size_t fuzzy_max_span(const fuzzy_t *f) {
+    return f->max_len + f->errors;
+}
+
+void fuzzy_free(fuzzy_t *f) {
+    if (!f) return;
+    for (size_t p = 0; p < f->count; p++) free(f->patterns[p].masks);
+    free(f->patterns);
+    for (size_t i = 0; i < f->piece_count; i++) free(f->pieces[i]);
+    free(f->pieces);
+    free(f->piece_lengths);
+    teddy_free(f->teddy);
+    ac_free(f->ac);
+    free(f);
+}
@@ -0,0 +1,65 @@
+/**
+ * @file fuzzy.h
+ * @brief Approximate matching for mygrep --fuzzy: a line matches if it contains a string
+ * within a given edit distance (substitutions, insertions, deletions) of a pattern.
+ * Each pattern runs on a bit-parallel Wu-Manber (bitap) automaton, one bit per pattern
+ * byte and one state vector per allowed error, in a single 64-bit word or, for longer
+ * patterns, several words with the shift carried across them.
+ * A match with k errors contains at least one of k + 1 disjoint pieces of the pattern
+ * unchanged, so the pieces are searched as exact literals (Teddy's SIMD prefilter, or
+ * Aho-Corasick for large sets), and the automaton only runs on the bytes around each piece.
+ * Patterns too short to give pieces of two bytes are run over all of the text instead.
+ */
+
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FUZZY_MAX_ERRORS 8
+
+typedef struct fuzzy fuzzy_t;
+
+/**
+ * @brief Compiles patterns for approximate search.
+ * @param patterns The patterns; each must be longer than errors and free of '\n'.
+ * @param lengths Length of each pattern.
+ * @param count Number of patterns.
+ * @param errors Edit distance allowed, 1 to FUZZY_MAX_ERRORS.
+ * @param case_insensitive Flag: 1 to match ASCII letters in either case.
+ * @return The matcher, or NULL with errno set if memory runs out.
+ */
+fuzzy_t *fuzzy_build(char *const *patterns, const size_t *lengths, size_t count, unsigned errors,
+                     int case_insensitive);
+
+/**
+ * @brief Scratch words fuzzy_find needs for patterns longer than 64 bytes; 0 if all are
+ * shorter.
+ */
+size_t fuzzy_scratch_words(const fuzzy_t *f);
+
+/**
+ * @brief Finds the first line of hay that contains an approximate match. Matches never
+ * span a '\n'. Never allocates.
+ * @param scratch Room for fuzzy_scratch_words(f) words, used by one thread at a time.
+ * @param match_len Receives 1.
+ * @return Pointer to the last byte of a match in that line, or NULL if there is none.
+ */
+const char *fuzzy_find(const fuzzy_t *f, const char *hay, size_t hay_len, uint64_t *scratch, size_t *match_len);
+
+/**
+ * @brief The exact pieces one of which every match contains (lowercase if compiled
+ * case-insensitive), e.g. to select index blocks.
+ * @return Number of pieces; 0 if the patterns are too short to have any.
+ */
+size_t fuzzy_pieces(const fuzzy_t *f, const char *const **pieces, const size_t **lengths);
+
+/**
+ * @brief Longest text a match can span: the longest pattern plus the allowed errors.
+ */
+size_t fuzzy_max_span(const fuzzy_t *f);
+
+void fuzzy_free(fuzzy_t *f);
+
+#endif
@@ -0,0 +1,649 @@
+/**
+ * @file index.c
+ * @brief Building, mapping and querying the trigram index (see index.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "index.h"
+#include "search.h"
+#include "fold.h"
+
+#define INDEX_MAGIC "MYGRIDX2"
+#define TRIGRAM_SPACE ((size_t)1 << 24)
+#define FOLD_WINDOW ((size_t)64 << 10) // Text with multibyte characters is folded in pieces of this size
+#define NOT_REUSED UINT32_MAX
+
+/**
+ * On-disk layout: header, files[file_count], blocks[block_count], trigrams[trigram_count],
+ * postings[posting_count] (uint32_t block numbers), strings[strings_size].
+ */
+typedef struct {
+    char magic[8];
+    uint64_t file_count;
+    uint64_t block_count;
+    uint64_t trigram_count;
+    uint64_t posting_count;
+    uint64_t strings_size;
+} index_header_t;
+
+/**
+ * A trigram and its posting list. The table is sorted by trigram.
+ */
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;       // Blocks in the posting list
+    uint64_t postings;    // Position of the list in the posting array
+} index_trigram_t;
+
+struct index {
+    char *map;
+    size_t size;
+    const index_header_t *header;
+    const index_file_t *files;
+    const index_block_t *blocks;
+    const index_trigram_t *trigrams;
+    const uint32_t *postings;
+    const char *strings;
+};
+
+static inline unsigned char fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+/**
+ * Grows an array so that it holds at least `need` elements.
+ */
+static void reserve(void **array, size_t *capacity, size_t need, size_t elem_size) {
+    if (need <= *capacity) return;
+    size_t capacity_new = *capacity ? *capacity : 64;
+    while (capacity_new < need) capacity_new *= 2;
+    void *grown = realloc(*array, capacity_new * elem_size);
+    if (!grown) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    *array = grown;
+    *capacity = capacity_new;
+}
+
+static char *index_path(const char *dir, const char *suffix) {
+    size_t dir_len = strlen(dir);
+    int slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char *path = malloc(dir_len + slash + strlen(INDEX_FILE_NAME) + strlen(suffix) + 1);
+    if (!path) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(path, "%s%s%s%s", dir, slash ? "/" : "", INDEX_FILE_NAME, suffix);
+    return path;
+}
+
+/* ---------------------------------------------------------------------------------------
+ * Reading
+ * ------------------------------------------------------------------------------------- */
+
+index_t *index_open(const char *dir) {
+    char *path = index_path(dir, "");
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size < sizeof(index_header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    index_t *idx = malloc(sizeof(*idx));
+    if (!idx) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    idx->map = map;
+    idx->size = size;
+    idx->header = (const index_header_t *)map;
+
+    // Every count is checked against the file size before the tables are used
+    const index_header_t *h = idx->header;
+    size_t rest = size - sizeof(*h);
+    int valid = memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) == 0 &&
+                h->file_count <= rest / sizeof(index_file_t) &&
+                h->block_count <= rest / sizeof(index_block_t) &&
+                h->trigram_count <= rest / sizeof(index_trigram_t) &&
+                h->posting_count <= rest / sizeof(uint32_t) && h->strings_size <= rest &&
+                sizeof(*h) + h->file_count * sizeof(index_file_t) + h->block_count * sizeof(index_block_t) +
+                        h->trigram_count * sizeof(index_trigram_t) + h->posting_count * sizeof(uint32_t) +
+                        h->strings_size == size;
+    if (valid) {
+        idx->files = (const index_file_t *)(map + sizeof(*h));
+        idx->blocks = (const index_block_t *)(idx->files + h->file_count);
+        idx->trigrams = (const index_trigram_t *)(idx->blocks + h->block_count);
+        idx->postings = (const uint32_t *)(idx->trigrams + h->trigram_count);
+        idx->strings = (const char *)(idx->postings + h->posting_count);
+        valid = h->strings_size > 0 && idx->strings[h->strings_size - 1] == '\0';
+    }
+    for (uint64_t f = 0; valid && f < h->file_count; f++) {
+        const index_file_t *file = &idx->files[f];
+        valid = file->path < h->strings_size && file->first_block <= h->block_count &&
+                file->block_count <= h->block_count - file->first_block;
+    }
+    for (uint64_t b = 0; valid && b < h->block_count; b++) valid = idx->blocks[b].file < h->file_count;
+    for (uint64_t t = 0; valid && t < h->trigram_count; t++) {
+        const index_trigram_t *tri = &idx->trigrams[t];
+        valid = tri->postings <= h->posting_count && tri->count <= h->posting_count - tri->postings;
+    }
+    for (uint64_t p = 0; valid && p < h->posting_count; p++) valid = idx->postings[p] < h->block_count;
+    if (!valid) {
+        index_close(idx);
+        errno = EINVAL;
+        return NULL;
+    }
+    return idx;
+}
+
+void index_close(index_t *idx) {
+    if (!idx) return;
+    munmap(idx->map, idx->size);
+    free(idx);
+}
+
+const index_file_t *index_find_file(const index_t *idx, const char *path) {
+    size_t lo = 0, hi = idx->header->file_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(path, idx->strings + idx->files[mid].path);
+        if (cmp == 0) return &idx->files[mid];
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+const index_block_t *index_block(const index_t *idx, uint32_t block) {
+    return &idx->blocks[block];
+}
+
+static const index_trigram_t *find_trigram(const index_t *idx, uint32_t trigram) {
+    size_t lo = 0, hi = idx->header->trigram_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint32_t t = idx->trigrams[mid].trigram;
+        if (t == trigram) return &idx->trigrams[mid];
+        if (trigram < t) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_list_length(const void *a, const void *b) {
+    const index_trigram_t *x = *(const index_trigram_t *const *)a, *y = *(const index_trigram_t *const *)b;
+    return (x->count > y->count) - (x->count < y->count);
+}
+
+/**
+ * Marks the blocks that contain every trigram of a literal.
+ * @return 0 on success, -1 if the literal has no trigram to look up.
+ */
+static int mark_literal(const index_t *idx, const char *raw, size_t raw_len, unsigned char *candidates) {
+    // The index holds the trigrams of folded text; a literal occurs only where its folded form does
+    unsigned char *literal = malloc(FOLD_BOUND(raw_len));
+    if (!literal) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = fold_utf8(raw, raw_len, (char *)literal);
+    if (len < 3) {
+        free(literal);
+        return -1;
+    }
+    uint32_t *trigrams = malloc((len - 2) * sizeof(*trigrams));
+    const index_trigram_t **lists = malloc((len - 2) * sizeof(*lists));
+    if (!trigrams || !lists) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Trigrams across a newline are not indexed; a line never contains one
+    size_t count = 0;
+    for (size_t i = 0; i + 2 < len; i++) {
+        if (literal[i] == '\n' || literal[i + 1] == '\n' || literal[i + 2] == '\n') continue;
+        trigrams[count++] = (uint32_t)fold(literal[i]) << 16 | (uint32_t)fold(literal[i + 1]) << 8 | fold(literal[i + 2]);
+    }
+    qsort(trigrams, count, sizeof(*trigrams), compare_u32);
+
+    size_t lists_count = 0;
+    int missing = 0;
+    for (size_t i = 0; i < count && !missing; i++) {
+        if (i > 0 && trigrams[i] == trigrams[i - 1]) continue;
+        lists[lists_count] = find_trigram(idx, trigrams[i]);
+        if (lists[lists_count] == NULL) missing = 1; // No block has it, so none has the literal
+        lists_count++;
+    }
+    free(trigrams);
+    free(literal);
+    if (count == 0) {
+        free(lists);
+        return -1;
+    }
+    if (missing) {
+        free(lists);
+        return 0;
+    }
+
+    // Intersect starting from the shortest list; the result only shrinks
+    qsort(lists, lists_count, sizeof(*lists), compare_list_length);
+    size_t result_len = lists[0]->count;
+    uint32_t *result = malloc((result_len ? result_len : 1) * sizeof(*result));
+    if (!result) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(result, idx->postings + lists[0]->postings, result_len * sizeof(*result));
+    for (size_t l = 1; l < lists_count && result_len > 0; l++) {
+        const uint32_t *list = idx->postings + lists[l]->postings;
+        size_t list_len = lists[l]->count, kept = 0, j = 0;
+        for (size_t i = 0; i < result_len; i++) {
+            while (j < list_len && list[j] < result[i]) j++;
+            if (j < list_len && list[j] == result[i]) result[kept++] = result[i];
+        }
+        result_len = kept;
+    }
+    for (size_t i = 0; i < result_len; i++) candidates[result[i]] = 1;
+
+    free(result);
+    free(lists);
+    return 0;
+}
+
+unsigned char *index_candidates(const index_t *idx, const char *const *literals, const size_t *lengths,
+                                size_t count) {
+    if (count == 0) return NULL;
+    unsigned char *candidates = calloc(idx->header->block_count ? idx->header->block_count : 1, 1);
+    if (!candidates) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (mark_literal(idx, literals[i], lengths[i], candidates) == -1) {
+            free(candidates);
+            return NULL;
+        }
+    }
+    return candidates;
+}
+
+/* ---------------------------------------------------------------------------------------
+ * Building
+ * ------------------------------------------------------------------------------------- */
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t block;
+} posting_pair_t;
+
+typedef struct {
+    char *path;           // Relative to the indexed directory
+    index_file_t entry;
+    uint32_t order;       // Position in walk order, which the blocks refer to
+} build_file_t;
+
+typedef struct {
+    const char *prog;
+    const char *dir;
+    size_t prefix_len;    // Length of the "dir/" prefix of walked paths
+    const index_t *old;   // The previous index, or NULL
+    uint32_t *reused_first; // Per old file: its first block in the new index, or NOT_REUSED
+    build_file_t *files;
+    size_t file_count, file_capacity;
+    index_block_t *blocks;
+    size_t block_count, block_capacity;
+    posting_pair_t *pairs;
+    size_t pair_count, pair_capacity;
+    uint64_t *seen;       // Bit per trigram: already recorded for the current block
+    uint32_t *touched;    // Trigrams of the current block, for clearing `seen`
+    size_t touched_capacity;
+    char *folded;         // FOLD_BOUND(FOLD_WINDOW) bytes of folded text
+} builder_t;
+
+/**
+ * @brief Position of the trigram scan within a block, carried from one piece to the next.
+ */
+typedef struct {
+    uint32_t trigram;     // The last three bytes
+    size_t run;           // Bytes since the last newline
+    size_t touched;       // Distinct trigrams found so far
+} trigram_scan_t;
+
+static void scan_trigrams(builder_t *b, trigram_scan_t *scan, const unsigned char *p, size_t len) {
+    uint32_t t = scan->trigram;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '\n') {
+            scan->run = 0;
+            continue;
+        }
+        t = (t << 8 | fold(p[i])) & (TRIGRAM_SPACE - 1);
+        if (++scan->run < 3) continue;
+        uint64_t bit = (uint64_t)1 << (t & 63);
+        if (b->seen[t >> 6] & bit) continue;
+        b->seen[t >> 6] |= bit;
+        b->touched[scan->touched++] = t;
+    }
+    scan->trigram = t;
+}
+
+/**
+ * Records the distinct trigrams of one block's case folded text as (trigram, block) pairs.
+ */
+static void add_block_trigrams(builder_t *b, const unsigned char *p, size_t len, uint32_t block) {
+    size_t most = FOLD_BOUND(len);
+    reserve((void **)&b->touched, &b->touched_capacity, most < TRIGRAM_SPACE ? most : TRIGRAM_SPACE,
+            sizeof(*b->touched));
+    trigram_scan_t scan = {0, 0, 0};
+    for (size_t i = 0; i < len;) {
+        size_t n = len - i > FOLD_WINDOW ? fold_complete((const char *)p + i, FOLD_WINDOW) : len - i;
+        if (search_ascii_span((const char *)p + i, n) == n) {
+            scan_trigrams(b, &scan, p + i, n);
+        } else {
+            size_t folded_len = fold_utf8((const char *)p + i, n, b->folded);
+            scan_trigrams(b, &scan, (const unsigned char *)b->folded, folded_len);
+        }
+        i += n;
+    }
+
+    reserve((void **)&b->pairs, &b->pair_capacity, b->pair_count + scan.touched, sizeof(*b->pairs));
+    for (size_t i = 0; i < scan.touched; i++) {
+        b->pairs[b->pair_count].trigram = b->touched[i];
+        b->pairs[b->pair_count].block = block;
+        b->pair_count++;
+        b->seen[b->touched[i] >> 6] = 0;
+    }
+}
+
+static void add_block(builder_t *b, uint64_t offset, uint64_t length, uint64_t first_line, uint32_t file) {
+    if (b->block_count >= NOT_REUSED) {
+        fprintf(stderr, "%s: Too many blocks to index\n", b->prog);
+        exit(EXIT_FAILURE);
+    }
+    reserve((void **)&b->blocks, &b->block_capacity, b->block_count + 1, sizeof(*b->blocks));
+    index_block_t *block = &b->blocks[b->block_count++];
+    block->offset = offset;
+    block->length = length;
+    block->first_line = first_line;
+    block->file = file;
+    block->reserved = 0;
+}
+
+/**
+ * Cuts a mapped file into newline-aligned blocks and records their trigrams.
+ */
+static void index_content(builder_t *b, const char *data, size_t size, uint32_t file) {
+    uint64_t line = 1;
+    size_t offset = 0;
+    while (offset < size) {
+        size_t end = offset + INDEX_BLOCK_SIZE;
+        if (end >= size) {
+            end = size;
+        } else {
+            const char *newline = memchr(data + end, '\n', size - end);
+            end = newline ? (size_t)(newline - data) + 1 : size;
+        }
+        add_block(b, offset, end - offset, line, file);
+        add_block_trigrams(b, (const unsigned char *)data + offset, end - offset, (uint32_t)(b->block_count - 1));
+        line += search_count_byte(data + offset, end - offset, '\n');
+        offset = end;
+    }
+}
+
+static void index_visit(void *ctx, char *path) {
+    builder_t *b = ctx;
+    const char *rel = path + b->prefix_len;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "%s: Error opening input file '%s': %s\n", b->prog, path, strerror(errno));
+        if (fd != -1) close(fd);
+        free(path);
+        return;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        free(path);
+        return;
+    }
+
+    reserve((void **)&b->files, &b->file_capacity, b->file_count + 1, sizeof(*b->files));
+    uint32_t file = (uint32_t)b->file_count;
+    build_file_t *bf = &b->files[file];
+    bf->path = strdup(rel);
+    if (!bf->path) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    bf->order = file;
+    bf->entry.size = (uint64_t)st.st_size;
+    bf->entry.mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    bf->entry.mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    bf->entry.path = 0;
+    bf->entry.first_block = (uint32_t)b->block_count;
+
+    const index_file_t *old = b->old ? index_find_file(b->old, rel) : NULL;
+    if (old != NULL && old->size == bf->entry.size && old->mtime_sec == bf->entry.mtime_sec &&
+        old->mtime_nsec == bf->entry.mtime_nsec) {
+        // Unchanged: the blocks are copied now, their postings when the old lists are merged
+        b->reused_first[old - b->old->files] = (uint32_t)b->block_count;
+        for (uint32_t i = 0; i < old->block_count; i++) {
+            const index_block_t *ob = &b->old->blocks[old->first_block + i];
+            add_block(b, ob->offset, ob->length, ob->first_line, file);
+        }
+    } else if (st.st_size > 0) {
+        size_t size = (size_t)st.st_size;
+        char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "%s: Error reading input file '%s': %s\n", b->prog, path, strerror(errno));
+            free(bf->path);
+            close(fd);
+            free(path);
+            return;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        index_content(b, map, size, file);
+        munmap(map, size);
+    }
+    bf->entry.block_count = (uint32_t)(b->block_count - bf->entry.first_block);
+    b->file_count++;
+
+    close(fd);
+    free(path);
+}
+
+static int compare_build_files(const void *a, const void *b) {
+    return strcmp(((const build_file_t *)a)->path, ((const build_file_t *)b)->path);
+}
+
+/**
+ * Adds the postings of reused files from the old index, renumbered to their new blocks.
+ */
+static void merge_old_postings(builder_t *b) {
+    const index_t *old = b->old;
+    for (uint64_t t = 0; t < old->header->trigram_count; t++) {
+        const index_trigram_t *tri = &old->trigrams[t];
+        const uint32_t *list = old->postings + tri->postings;
+        for (uint32_t i = 0; i < tri->count; i++) {
+            uint32_t file = old->blocks[list[i]].file;
+            if (b->reused_first[file] == NOT_REUSED) continue;
+            reserve((void **)&b->pairs, &b->pair_capacity, b->pair_count + 1, sizeof(*b->pairs));
+            b->pairs[b->pair_count].trigram = tri->trigram;
+            b->pairs[b->pair_count].block = b->reused_first[file] + (list[i] - old->files[file].first_block);
+            b->pair_count++;
+        }
+    }
+}
+
+static int write_all(FILE *out, const void *data, size_t size) {
+    return size == 0 || fwrite(data, 1, size, out) == size ? 0 : -1;
+}
+
+/**
+ * Sorts the pairs into posting lists (a counting sort by trigram) and writes the index.
+ * @return 0 on success, -1 with errno set.
+ */
+static int write_index(builder_t *b, FILE *out) {
+    // Files are stored sorted by path for index_find_file; blocks follow the new numbering
+    qsort(b->files, b->file_count, sizeof(*b->files), compare_build_files);
+    uint32_t *position = malloc((b->file_count ? b->file_count : 1) * sizeof(*position));
+    uint32_t *counts = calloc(TRIGRAM_SPACE, sizeof(*counts));
+    uint32_t *postings = malloc((b->pair_count ? b->pair_count : 1) * sizeof(*postings));
+    if (!position || !counts || !postings) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t f = 0; f < b->file_count; f++) position[b->files[f].order] = (uint32_t)f;
+    for (size_t i = 0; i < b->block_count; i++) b->blocks[i].file = position[b->blocks[i].file];
+
+    size_t trigram_count = 0;
+    for (size_t i = 0; i < b->pair_count; i++) {
+        if (counts[b->pairs[i].trigram]++ == 0) trigram_count++;
+    }
+    index_trigram_t *trigrams = malloc((trigram_count ? trigram_count : 1) * sizeof(*trigrams));
+    if (!trigrams) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    // counts[] becomes the fill position of each list
+    size_t next = 0, slot = 0;
+    for (size_t t = 0; t < TRIGRAM_SPACE; t++) {
+        if (counts[t] == 0) continue;
+        trigrams[slot].trigram = (uint32_t)t;
+        trigrams[slot].count = counts[t];
+        trigrams[slot].postings = next;
+        slot++;
+        next += counts[t];
+        counts[t] = (uint32_t)(next - (size_t)trigrams[slot - 1].count);
+    }
+    for (size_t i = 0; i < b->pair_count; i++) postings[counts[b->pairs[i].trigram]++] = b->pairs[i].block;
+    // New blocks are recorded in order, but reused ones are appended after them
+    for (size_t t = 0; t < trigram_count; t++) {
+        uint32_t *list = postings + trigrams[t].postings;
+        for (uint32_t i = 1; i < trigrams[t].count; i++) {
+            if (list[i - 1] > list[i]) {
+                qsort(list, trigrams[t].count, sizeof(*list), compare_u32);
+                break;
+            }
+        }
+    }
+
+    size_t strings_size = 0;
+    for (size_t f = 0; f < b->file_count; f++) {
+        b->files[f].entry.path = strings_size;
+        strings_size += strlen(b->files[f].path) + 1;
+    }
+    index_header_t header;
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.file_count = b->file_count;
+    header.block_count = b->block_count;
+    header.trigram_count = trigram_count;
+    header.posting_count = b->pair_count;
+    header.strings_size = strings_size ? strings_size : 1;
+
+    int rc = write_all(out, &header, sizeof(header));
+    for (size_t f = 0; f < b->file_count && rc == 0; f++) rc = write_all(out, &b->files[f].entry, sizeof(index_file_t));
+    if (rc == 0) rc = write_all(out, b->blocks, b->block_count * sizeof(*b->blocks));
+    if (rc == 0) rc = write_all(out, trigrams, trigram_count * sizeof(*trigrams));
+    if (rc == 0) rc = write_all(out, postings, b->pair_count * sizeof(*postings));
+    for (size_t f = 0; f < b->file_count && rc == 0; f++) rc = write_all(out, b->files[f].path, strlen(b->files[f].path) + 1);
+    if (rc == 0 && strings_size == 0) rc = write_all(out, "", 1);
+
+    free(position);
+    free(counts);
+    free(postings);
+    free(trigrams);
+    return rc;
+}
+
+int index_build(const char *prog, const char *dir, const walk_filter_t *filter) {
+    builder_t b;
+    memset(&b, 0, sizeof(b));
+    b.prog = prog;
+    b.dir = dir;
+    size_t dir_len = strlen(dir);
+    b.prefix_len = dir_len + (dir_len > 0 && dir[dir_len - 1] != '/');
+    b.seen = calloc(TRIGRAM_SPACE / 64, sizeof(*b.seen));
+    b.folded = malloc(FOLD_BOUND(FOLD_WINDOW));
+    if (!b.seen || !b.folded) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // An unreadable or outdated index is simply rebuilt from scratch
+    index_t *old = index_open(dir);
+    if (old != NULL) {
+        b.old = old;
+        b.reused_first = malloc((old->header->file_count ? old->header->file_count : 1) * sizeof(*b.reused_first));
+        if (!b.reused_first) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        for (uint64_t f = 0; f < old->header->file_count; f++) b.reused_first[f] = NOT_REUSED;
+    }
+
+    walk_tree(prog, dir, filter, index_visit, &b);
+    if (old != NULL) merge_old_postings(&b);
+
+    char *tmp_path = index_path(dir, ".tmp");
+    char *final_path = index_path(dir, "");
+    int rc = -1;
+    FILE *out = fopen(tmp_path, "wb");
+    if (out != NULL) {
+        rc = write_index(&b, out);
+        if (fclose(out) == EOF) rc = -1;
+        // The new index replaces the old one atomically; searches never see a partial file
+        if (rc == 0 && rename(tmp_path, final_path) == -1) rc = -1;
+        if (rc == -1) {
+            int saved = errno;
+            unlink(tmp_path);
+            errno = saved;
+        }
+    }
+    if (rc == -1) fprintf(stderr, "%s: Error writing index '%s': %s\n", prog, final_path, strerror(errno));
+
+    index_close(old);
+    for (size_t f = 0; f < b.file_count; f++) free(b.files[f].path);
+    free(b.files);
+    free(b.blocks);
+    free(b.pairs);
+    free(b.seen);
+    free(b.touched);
+    free(b.folded);
+    free(b.reused_first);
+    free(tmp_path);
+    free(final_path);
+    return rc;
+}
@@ -0,0 +1,88 @@
+/**
+ * @file index.h
+ * @brief Persistent trigram index for mygrep --index-build / --index.
+ * Every file below a directory is cut into newline-aligned blocks, and the index maps each
+ * trigram (three consecutive bytes, ASCII-lowercased) to the sorted list of blocks that
+ * contain it. A keyword can only occur in blocks that contain all of its trigrams, so a
+ * search intersects those posting lists and runs the matcher on the surviving blocks only.
+ * The index is one file that is memory-mapped as it is: a header followed by the file,
+ * block and trigram tables, the posting lists and the path strings.
+ * Rebuilding reuses the entries of files whose size and modification time are unchanged,
+ * so only new and changed files are read again.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "walk.h"
+
+#define INDEX_FILE_NAME ".mygrep-index"        // Written into the indexed directory
+#define INDEX_FILE_GLOB ".mygrep-index*"       // Also matches the temporary file of a rebuild
+#define INDEX_BLOCK_SIZE ((size_t)256 << 10)   // Blocks are extended to the end of their last line
+
+/**
+ * @brief An indexed file, as stored in the index.
+ */
+typedef struct {
+    uint64_t size;
+    int64_t mtime_sec;     // Modification time when the file was indexed
+    int64_t mtime_nsec;
+    uint64_t path;         // Offset of the path (relative to the directory) in the string table
+    uint32_t first_block;  // The file's blocks are consecutive
+    uint32_t block_count;
+} index_file_t;
+
+/**
+ * @brief A block of an indexed file: whole lines, about INDEX_BLOCK_SIZE bytes.
+ */
+typedef struct {
+    uint64_t offset;       // Position in the file
+    uint64_t length;
+    uint64_t first_line;   // Number of the block's first line, counting from 1 (for -n)
+    uint32_t file;         // Index of the file the block belongs to
+    uint32_t reserved;
+} index_block_t;
+
+typedef struct index index_t;
+
+/**
+ * @brief Indexes every file that the walk of dir selects and writes dir/INDEX_FILE_NAME.
+ * An existing index is updated: files with unchanged size and modification time keep their
+ * entries without being read.
+ * @param prog Program name for error messages.
+ * @param filter Include/exclude globs for the walk; should exclude INDEX_FILE_GLOB.
+ * @return 0 on success, -1 after reporting an error on stderr.
+ */
+int index_build(const char *prog, const char *dir, const walk_filter_t *filter);
+
+/**
+ * @brief Maps the index of a directory.
+ * @return The index, or NULL with errno set if it is missing or not a valid index.
+ */
+index_t *index_open(const char *dir);
+
+void index_close(index_t *idx);
+
+/**
+ * @brief Looks up a file by its path relative to the indexed directory.
+ * @return The file's entry, or NULL if it is not indexed.
+ */
+const index_file_t *index_find_file(const index_t *idx, const char *path);
+
+const index_block_t *index_block(const index_t *idx, uint32_t block);
+
+/**
+ * @brief Selects the blocks that may contain any of the given literals: for each literal,
+ * the intersection of the posting lists of its trigrams.
+ * @param literals The keywords (compared ASCII case-insensitively).
+ * @param lengths Their lengths.
+ * @param count Number of literals; 0 means the search has no literal to narrow it down.
+ * @return One flag byte per block (malloc'ed), or NULL if every block is a candidate
+ * (no literals, or one shorter than a trigram).
+ */
+unsigned char *index_candidates(const index_t *idx, const char *const *literals, const size_t *lengths,
+                                size_t count);
+
+#endif
@@ -0,0 +1,551 @@
+/**
+ * @file matcher.c
+ * @brief Pattern collection, engine selection and the search over one buffer.
+ */
+
+#define _POSIX_C_SOURCE 200809L // Required for getline and open_memstream
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "matcher.h"
+#include "fold.h"
+
+// Pattern sets for the Teddy engine; see `make bench` (bench_multi) for the crossover.
+// With 1-byte patterns every occurrence of such a byte is a candidate, and Aho-Corasick
+// overtakes Teddy at about a dozen patterns.
+#define TEDDY_MIN_PATTERNS 2
+#define TEDDY_SINGLE_BYTE_MAX_PATTERNS 8
+
+// A single required byte is too common a prefilter hit: each hit re-runs the DFA over its
+// line, which is slower than letting the DFA scan everything once
+#define REGEX_PREFILTER_MIN_LITERAL 2
+
+// -i with Unicode folding: text is checked for multibyte characters and folded in windows
+// that start at FOLD_MIN_WINDOW bytes and double up to FOLD_WINDOW while nothing is found,
+// so the work of each search follows the distance to the next match
+#define FOLD_MIN_WINDOW ((size_t)128)
+#define FOLD_WINDOW ((size_t)64 << 10)
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init_tables(void) {
+    // Pick the fastest literal search kernel for this CPU
+    search_init();
+    fold_init(); // Case folding table
+}
+
+void matcher_init(void) {
+    pthread_once(&init_once, init_tables);
+}
+
+int matcher_add(matcher_t *m, const char *pattern, size_t len) {
+    if (m->count == m->capacity) {
+        size_t capacity = m->capacity ? m->capacity * 2 : 8;
+        char **patterns = realloc(m->patterns, capacity * sizeof(*patterns));
+        if (!patterns) return -1;
+        m->patterns = patterns;
+        size_t *lengths = realloc(m->lengths, capacity * sizeof(*lengths));
+        if (!lengths) return -1;
+        m->lengths = lengths;
+        m->capacity = capacity;
+    }
+
+    char *copy = malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, pattern, len);
+    copy[len] = '\0';
+
+    m->patterns[m->count] = copy;
+    m->lengths[m->count] = len;
+    m->count++;
+    return 0;
+}
+
+int matcher_add_list(matcher_t *m, const char *list) {
+    for (;;) {
+        const char *newline = strchr(list, '\n');
+        if (newline == NULL) return matcher_add(m, list, strlen(list));
+        if (matcher_add(m, list, (size_t)(newline - list)) == -1) return -1;
+        list = newline + 1;
+    }
+}
+
+int matcher_add_file(matcher_t *m, const char *path) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL) return -1;
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    int rc = 0;
+    while (rc == 0 && (read = getline(&line, &len, file)) != -1) {
+        if (read > 0 && line[read - 1] == '\n') read--;
+        rc = matcher_add(m, line, (size_t)read);
+    }
+    if (rc == 0 && ferror(file)) rc = -1;
+
+    int saved = errno;
+    free(line);
+    if (file != stdin) fclose(file);
+    errno = saved;
+    return rc;
+}
+
+static void free_dfa_cache(void *cache) {
+    dfa_cache_free(cache);
+}
+
+/**
+ * Returns the calling thread's scratch space for case folded text, created by
+ * matcher_prepare. It holds FOLD_BOUND(FOLD_WINDOW + 3 * m->max_len) bytes: the longest
+ * window fold_find_line folds.
+ */
+static char *matcher_fold_buffer(const matcher_t *m) {
+    return pthread_getspecific(m->fold_key);
+}
+
+/**
+ * Records why compiling failed.
+ * @return -1, for matcher_compile to return.
+ */
+static int matcher_error(matcher_t *m, const char *what, const char *why) {
+    snprintf(m->error, sizeof(m->error), "%s: %s", what, why);
+    return -1;
+}
+
+/**
+ * Applies Unicode simple case folding to the patterns (-i).
+ * @param keep_ascii Flag: fold only multibyte characters. A regular expression keeps its
+ * ASCII bytes: the regex parser folds ASCII case itself, and lowercasing would turn e.g.
+ * \W into \w.
+ * @return 0 on success, -1 if memory runs out.
+ */
+static int matcher_fold_patterns(matcher_t *m, int keep_ascii) {
+    for (size_t p = 0; p < m->count; p++) {
+        const char *pattern = m->patterns[p];
+        size_t len = m->lengths[p];
+        char *folded = malloc(FOLD_BOUND(len));
+        if (!folded) return -1;
+        size_t folded_len = 0;
+        for (size_t i = 0; i < len;) {
+            if (keep_ascii && (unsigned char)pattern[i] < 0x80) {
+                folded[folded_len++] = pattern[i++];
+                continue;
+            }
+            size_t written;
+            i += fold_char(pattern + i, len - i, folded + folded_len, &written);
+            folded_len += written;
+        }
+        free(m->patterns[p]);
+        m->patterns[p] = folded;
+        m->lengths[p] = folded_len;
+    }
+    return 0;
+}
+
+/**
+ * Whether -i needs Unicode folding for the (folded) patterns. The ASCII kernels are exact
+ * unless a pattern has multibyte characters, or letters that non-ASCII characters fold to:
+ * 'k' (KELVIN SIGN) and 's' (LATIN SMALL LETTER LONG S). A bracket expression may cover
+ * those letters with a range.
+ */
+static int matcher_needs_fold(const matcher_t *m, int extended) {
+    for (size_t p = 0; p < m->count; p++) {
+        for (size_t i = 0; i < m->lengths[p]; i++) {
+            unsigned char c = (unsigned char)m->patterns[p][i];
+            if (c >= 0x80 || tolower(c) == 'k' || tolower(c) == 's' || (extended && c == '[')) return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compiles the patterns as one extended regular expression, "(p1)|(p2)|...".
+ * A pattern without operators is turned back into a literal and takes the normal path.
+ * @return 1 if the matcher now uses the regex engine, 0 if the literal path applies, -1 on
+ * error.
+ */
+static int matcher_compile_regex(matcher_t *m) {
+    char *expr;
+    size_t len = 0;
+    FILE *stream = open_memstream(&expr, &len);
+    if (!stream) return matcher_error(m, "Failed to compile patterns", strerror(errno));
+    for (size_t p = 0; p < m->count; p++) {
+        if (m->count == 1) {
+            fwrite(m->patterns[p], 1, m->lengths[p], stream);
+        } else {
+            fprintf(stream, "%s(", p > 0 ? "|" : "");
+            fwrite(m->patterns[p], 1, m->lengths[p], stream);
+            fputc(')', stream);
+        }
+    }
+    fclose(stream);
+
+    const char *error;
+    dfa_program_t *regex = dfa_compile(expr, len, m->case_insensitive, &error);
+    free(expr);
+    if (regex == NULL) return matcher_error(m, "Invalid regular expression", error);
+
+    size_t literal_len;
+    const char *literal = dfa_required_literal(regex, &literal_len);
+    if (dfa_is_literal(regex)) {
+        // e.g. "foo" or "a\.b": the literal kernels find exactly the same lines
+        free(m->patterns[0]);
+        m->count = 0;
+        int rc = matcher_add(m, literal, literal_len);
+        dfa_free(regex);
+        return rc == 0 ? 0 : matcher_error(m, "Failed to compile patterns", strerror(errno));
+    }
+
+    int rc = pthread_key_create(&m->dfa_key, free_dfa_cache);
+    if (rc != 0) {
+        dfa_free(regex);
+        return matcher_error(m, "Error creating thread key", strerror(rc));
+    }
+    m->regex = regex;
+    if (literal != NULL && literal_len >= REGEX_PREFILTER_MIN_LITERAL) {
+        search_plan_init(&m->plan, literal, literal_len, m->case_insensitive);
+        m->prefilter = 1;
+    }
+    return 1;
+}
+
+int matcher_compile(matcher_t *m, int case_insensitive, int extended, unsigned errors) {
+    matcher_init();
+    m->case_insensitive = case_insensitive;
+    if (errors > 0 && extended) {
+        return matcher_error(m, "Invalid pattern", "approximate matching takes literal patterns only");
+    }
+    if (errors > FUZZY_MAX_ERRORS) return matcher_error(m, "Invalid pattern", "edit distance too large");
+    for (size_t p = 0; p < m->count; p++) {
+        // Deleting every byte of a pattern this short leaves the empty string
+        if (m->lengths[p] <= errors) m->match_all = 1;
+    }
+    if (m->match_all || m->count == 0) return 0;
+    if (errors > 0) {
+        // Bitap compares bytes, so -i folds ASCII letters only
+        m->fuzzy = fuzzy_build(m->patterns, m->lengths, m->count, errors, case_insensitive);
+        if (m->fuzzy == NULL) return matcher_error(m, "Failed to compile patterns", strerror(errno));
+        int rc = pthread_key_create(&m->fuzzy_key, free);
+        if (rc != 0) {
+            fuzzy_free(m->fuzzy);
+            m->fuzzy = NULL;
+            return matcher_error(m, "Error creating thread key", strerror(rc));
+        }
+        return 0;
+    }
+    if (case_insensitive) {
+        if (matcher_fold_patterns(m, extended) == -1) {
+            return matcher_error(m, "Failed to compile patterns", strerror(errno));
+        }
+        if (matcher_needs_fold(m, extended)) {
+            int rc = pthread_key_create(&m->fold_key, free);
+            if (rc != 0) return matcher_error(m, "Error creating thread key", strerror(rc));
+            m->unicode_fold = 1;
+        }
+    }
+    if (extended) {
+        int rc = matcher_compile_regex(m);
+        if (rc != 0) return rc == 1 ? 0 : -1;
+    }
+
+    // A regular expression that is a plain literal comes back with its ASCII case unfolded
+    if (case_insensitive && matcher_fold_patterns(m, 0) == -1) {
+        return matcher_error(m, "Failed to compile patterns", strerror(errno));
+    }
+    for (size_t p = 0; p < m->count; p++) {
+        if (m->lengths[p] > m->max_len) m->max_len = m->lengths[p];
+    }
+
+    if (m->count == 1) {
+        // Picks SIMD, Horspool or Two-Way once; every line and buffer reuses the tables
+        search_plan_init(&m->plan, m->patterns[0], m->lengths[0], case_insensitive);
+        return 0;
+    }
+
+    size_t min_len = m->lengths[0];
+    for (size_t p = 1; p < m->count; p++) {
+        if (m->lengths[p] < min_len) min_len = m->lengths[p];
+    }
+    if (m->count >= TEDDY_MIN_PATTERNS && (min_len >= 2 || m->count <= TEDDY_SINGLE_BYTE_MAX_PATTERNS)) {
+        // NULL if the set is too large or the CPU lacks SSSE3
+        m->teddy = teddy_build(m->patterns, m->lengths, m->count, case_insensitive);
+    }
+
+    if (m->teddy == NULL) {
+        m->ac = ac_build(m->patterns, m->lengths, m->count, case_insensitive);
+        if (m->ac == NULL) return matcher_error(m, "Failed to compile patterns", strerror(errno));
+    }
+    return 0;
+}
+
+void matcher_free(matcher_t *m) {
+    for (size_t p = 0; p < m->count; p++) free(m->patterns[p]);
+    free(m->patterns);
+    free(m->lengths);
+    teddy_free(m->teddy);
+    ac_free(m->ac);
+    if (m->fuzzy != NULL) {
+        free(pthread_getspecific(m->fuzzy_key));
+        pthread_key_delete(m->fuzzy_key);
+        fuzzy_free(m->fuzzy);
+    }
+    if (m->regex != NULL) {
+        // Worker threads free their caches on exit; the main thread's is freed here
+        dfa_cache_free(pthread_getspecific(m->dfa_key));
+        pthread_key_delete(m->dfa_key);
+        dfa_free(m->regex);
+    }
+    if (m->unicode_fold) {
+        free(pthread_getspecific(m->fold_key));
+        pthread_key_delete(m->fold_key);
+    }
+}
+
+int matcher_prepare(const matcher_t *m) {
+    if (m->regex != NULL && pthread_getspecific(m->dfa_key) == NULL) {
+        dfa_cache_t *cache = dfa_cache_new(m->regex, DFA_DEFAULT_CACHE_BYTES);
+        if (!cache) return -1;
+        int rc = pthread_setspecific(m->dfa_key, cache);
+        if (rc != 0) {
+            dfa_cache_free(cache);
+            errno = rc;
+            return -1;
+        }
+    }
+    if (m->unicode_fold && pthread_getspecific(m->fold_key) == NULL) {
+        char *folded = malloc(FOLD_BOUND(FOLD_WINDOW + 3 * m->max_len));
+        if (!folded) return -1;
+        int rc = pthread_setspecific(m->fold_key, folded);
+        if (rc != 0) {
+            free(folded);
+            errno = rc;
+            return -1;
+        }
+    }
+    size_t words = m->fuzzy != NULL ? fuzzy_scratch_words(m->fuzzy) : 0;
+    if (words > 0 && pthread_getspecific(m->fuzzy_key) == NULL) {
+        uint64_t *scratch = malloc(words * sizeof(*scratch));
+        if (!scratch) return -1;
+        int rc = pthread_setspecific(m->fuzzy_key, scratch);
+        if (rc != 0) {
+            free(scratch);
+            errno = rc;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+dfa_cache_t *matcher_dfa_cache(const matcher_t *m) {
+    return pthread_getspecific(m->dfa_key);
+}
+
+/**
+ * Finds the first line matching the regular expression. hay must start at a line boundary.
+ * With a prefilter, only lines containing the required literal are run through the DFA.
+ * @return Pointer to the start of the matching line, or NULL.
+ */
+static const char *regex_find(const matcher_t *m, const char *hay, size_t hay_len) {
+    dfa_cache_t *cache = matcher_dfa_cache(m);
+    if (!m->prefilter) return dfa_find_line(cache, hay, hay_len);
+
+    const char *end = hay + hay_len;
+    const char *p = hay;
+    while (p < end) {
+        const char *hit = search_plan_find(&m->plan, p, (size_t)(end - p));
+        if (hit == NULL) return NULL;
+
+        const char *line_start = hit;
+        while (line_start > p && line_start[-1] != '\n') line_start--;
+        const char *newline = memchr(hit, '\n', (size_t)(end - hit));
+        const char *line_end = newline ? newline : end;
+
+        if (dfa_match_line(cache, line_start, (size_t)(line_end - line_start))) return line_start;
+        p = newline ? newline + 1 : end;
+    }
+    return NULL;
+}
+
+/**
+ * Finds the first match of any pattern inside a byte buffer, comparing bytes (ASCII case
+ * folded with -i).
+ */
+static const char *matcher_find_bytes(const matcher_t *m, const char *hay, size_t hay_len, size_t *match_len) {
+    if (m->teddy != NULL) return teddy_find(m->teddy, hay, hay_len, match_len);
+    if (m->ac != NULL) return ac_find(m->ac, hay, hay_len, match_len);
+    if (m->regex != NULL) {
+        *match_len = 0;
+        return regex_find(m, hay, hay_len);
+    }
+    if (m->count == 0) return NULL;
+
+    *match_len = m->lengths[0];
+    return search_plan_find(&m->plan, hay, hay_len);
+}
+
+int regex_feed_folded(const matcher_t *m, dfa_cache_t *cache, dfa_partial_t *state, const char *text, size_t len) {
+    char *folded = matcher_fold_buffer(m);
+    for (size_t i = 0; i < len;) {
+        size_t n = len - i > FOLD_WINDOW ? fold_complete(text + i, FOLD_WINDOW) : len - i;
+        if (dfa_partial_feed(cache, state, folded, fold_utf8(text + i, n, folded))) return 1;
+        i += n;
+    }
+    return 0;
+}
+
+/**
+ * Maps a match in the folded form of raw back to raw, folding raw again one character
+ * at a time up to the match.
+ * @param offset Position of the match in the folded text.
+ * @param len Length of the match in the folded text.
+ * @param raw_len_out Receives the length of the match in raw.
+ */
+static const char *fold_locate(const char *raw, size_t raw_len, size_t offset, size_t len, size_t *raw_len_out) {
+    char scratch[4];
+    size_t r = 0, f = 0, written;
+    while (r < raw_len && f < offset) {
+        if ((unsigned char)raw[r] < 0x80) {
+            r++;
+            f++;
+            continue;
+        }
+        r += fold_char(raw + r, raw_len - r, scratch, &written);
+        f += written;
+    }
+    size_t start = r;
+    while (r < raw_len && f < offset + len) {
+        r += fold_char(raw + r, raw_len - r, scratch, &written);
+        f += written;
+    }
+    *raw_len_out = r - start;
+    return raw + start;
+}
+
+/**
+ * Searches the case folded form of one line (without its '\n'). Literals are searched in
+ * windows of FOLD_WINDOW bytes that overlap by the longest span a match can have, and a
+ * match is mapped back to the original bytes.
+ * @return Pointer to the match in the line (with a regex: to the line), or NULL.
+ */
+static const char *fold_find_line(const matcher_t *m, const char *line, size_t len, size_t *match_len) {
+    if (m->regex != NULL) {
+        dfa_cache_t *cache = matcher_dfa_cache(m);
+        dfa_partial_t state;
+        dfa_partial_begin(&state);
+        regex_feed_folded(m, cache, &state, line, len);
+        *match_len = 0;
+        return dfa_partial_end(cache, &state) ? line : NULL;
+    }
+
+    // A folded byte comes from at most three bytes (KELVIN SIGN folds to 'k')
+    size_t overlap = 3 * m->max_len;
+    char *folded = matcher_fold_buffer(m);
+    size_t start = 0;
+    for (;;) {
+        size_t end = len - start > FOLD_WINDOW + overlap ? start + fold_complete(line + start, FOLD_WINDOW + overlap)
+                                                         : len;
+        size_t kw_len;
+        const char *hit = matcher_find_bytes(m, folded, fold_utf8(line + start, end - start, folded), &kw_len);
+        if (hit != NULL) return fold_locate(line + start, end - start, (size_t)(hit - folded), kw_len, match_len);
+        if (end == len) return NULL;
+        start = end - overlap;
+        while (start > 0 && ((unsigned char)line[start] & 0xC0) == 0x80) start--;
+    }
+}
+
+/**
+ * Searches the case folded form of whole lines, at most FOLD_WINDOW bytes, and maps a match
+ * back to the original bytes (with a regex: the start of the matching line).
+ */
+static const char *fold_find_lines(const matcher_t *m, const char *text, size_t len, size_t *match_len) {
+    char *folded = matcher_fold_buffer(m);
+    size_t kw_len;
+    const char *hit = matcher_find_bytes(m, folded, fold_utf8(text, len, folded), &kw_len);
+    if (hit == NULL) return NULL;
+    return fold_locate(text, len, (size_t)(hit - folded), kw_len, match_len);
+}
+
+/**
+ * -i with Unicode folding: each window of whole lines is checked with the vectorized ASCII
+ * test. Pure-ASCII lines are searched as they are; from the first line with a multibyte
+ * character on, the window is folded before searching.
+ */
+static const char *unicode_find(const matcher_t *m, const char *hay, size_t hay_len, size_t *match_len) {
+    const char *end = hay + hay_len;
+    const char *p = hay;
+    size_t window = FOLD_MIN_WINDOW;
+    while (p < end) {
+        // Cut the window back to whole lines, or extend it to the end of a single long line
+        const char *stop = end;
+        if ((size_t)(end - p) > window) {
+            stop = p + window;
+            while (stop > p && stop[-1] != '\n') stop--;
+            if (stop == p) {
+                const char *newline = memchr(p + window, '\n', (size_t)(end - p - window));
+                stop = newline ? newline + 1 : end;
+            }
+        }
+        if (window < FOLD_WINDOW) window *= 2;
+
+        size_t len = (size_t)(stop - p);
+        size_t span = search_ascii_span(p, len);
+        const char *hit;
+        if (span == len) {
+            hit = matcher_find_bytes(m, p, len, match_len);
+        } else {
+            const char *line_start = p + span;
+            while (line_start > p && line_start[-1] != '\n') line_start--;
+            hit = line_start > p ? matcher_find_bytes(m, p, (size_t)(line_start - p), match_len) : NULL;
+            if (hit == NULL) {
+                if ((size_t)(stop - line_start) > FOLD_WINDOW) {
+                    // A single long line, folded in windows of its own
+                    size_t line_len = (size_t)(stop - line_start) - (stop[-1] == '\n');
+                    hit = fold_find_line(m, line_start, line_len, match_len);
+                } else {
+                    hit = fold_find_lines(m, line_start, (size_t)(stop - line_start), match_len);
+                }
+            }
+        }
+        if (hit != NULL) return hit;
+        p = stop;
+    }
+    return NULL;
+}
+
+const char *matcher_find(const matcher_t *m, const char *hay, size_t hay_len, size_t *match_len) {
+    if (m->match_all) {
+        *match_len = 0;
+        return hay;
+    }
+    if (m->fuzzy != NULL) return fuzzy_find(m->fuzzy, hay, hay_len, pthread_getspecific(m->fuzzy_key), match_len);
+    if (m->unicode_fold) return unicode_find(m, hay, hay_len, match_len);
+    return matcher_find_bytes(m, hay, hay_len, match_len);
+}
+
+size_t matcher_overlap(const matcher_t *m) {
+    if (m->match_all || m->regex != NULL) return 0;
+    if (m->fuzzy != NULL) return fuzzy_max_span(m->fuzzy) - 1;
+    // A folded match may span three times its length in the original
+    size_t span = m->unicode_fold ? 3 * m->max_len : m->max_len;
+    return span > 0 ? span - 1 : 0;
+}
+
+size_t matcher_literals(const matcher_t *m, const char **literal, size_t *literal_len,
+                        const char *const **literals, const size_t **lengths) {
+    if (m->match_all || m->count == 0) return 0;
+    if (m->regex != NULL) {
+        *literal = dfa_required_literal(m->regex, literal_len);
+        if (*literal == NULL) return 0;
+        *literals = literal;
+        *lengths = literal_len;
+        return 1;
+    }
+    if (m->fuzzy != NULL) return fuzzy_pieces(m->fuzzy, literals, lengths);
+    *literals = (const char *const *)m->patterns;
+    *lengths = m->lengths;
+    return m->count;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file matcher.h
+ * @brief The compiled search of libmygrep: keywords, flags and the engine chosen for them.
+ * Patterns are collected with matcher_add* and compiled once with matcher_compile. The
+ * result is read-only afterwards, so any number of threads can search any buffer with
+ * matcher_find; the scratch space of the regex, Unicode folding and fuzzy paths is kept per
+ * thread. A single pattern uses the SIMD literal kernels. Small pattern sets use the Teddy
+ * SIMD prefilter; larger ones are compiled into one Aho-Corasick automaton, so each input
+ * is scanned only once either way. Extended regular expressions run on a lazy DFA, behind a
+ * literal prefilter when the expression requires one, and approximate matching runs on
+ * bitap automata (fuzzy.h).
+ * The library never exits: each thread's scratch space is allocated by matcher_prepare,
+ * which must succeed before that thread calls matcher_find, and the scan_* and stream
+ * functions of scan.h call it and return SIZE_MAX (or -1) with errno set if it fails.
+ */
+
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "search.h"
+#include "multi.h"
+#include "dfa.h"
+#include "fuzzy.h"
+
+/**
+ * @brief A pattern set and its compiled form. Zero-initialize before the first matcher_add.
+ */
+typedef struct {
+    char **patterns;      // Owned copies, lowercased if case_insensitive is set
+    size_t *lengths;
+    size_t count;
+    size_t capacity;
+    int case_insensitive;
+    int match_all;        // Set if some pattern is empty: every line matches
+    search_plan_t plan;   // Built by matcher_compile for a single pattern
+    teddy_t *teddy;       // Built by matcher_compile for small pattern sets
+    ac_automaton_t *ac;   // Built by matcher_compile for pattern sets Teddy cannot take
+    dfa_program_t *regex; // Built by matcher_compile with extended unless the pattern is a plain literal
+    int prefilter;        // With regex: plan holds a literal that every matching line contains
+    pthread_key_t dfa_key; // With regex: each thread's DFA state cache
+    size_t max_len;       // Longest literal pattern, after folding
+    int unicode_fold;     // Case-insensitive: lines with multibyte characters are folded before searching
+    pthread_key_t fold_key; // With unicode_fold: each thread's fold buffer
+    fuzzy_t *fuzzy;       // Built by matcher_compile for approximate matching
+    pthread_key_t fuzzy_key; // With fuzzy: each thread's scratch words for long patterns
+    char error[128];      // Why matcher_compile failed
+} matcher_t;
+
+/**
+ * @brief Selects the search kernels for this CPU and builds the folding tables. Called by
+ * matcher_compile; runs once per process however often it is called.
+ */
+void matcher_init(void);
+
+/**
+ * @brief Appends a copy of a pattern to the matcher.
+ * @return 0 on success, -1 with errno set if memory runs out.
+ */
+int matcher_add(matcher_t *m, const char *pattern, size_t len);
+
+/**
+ * @brief Adds the patterns of a list. Like grep's -e, a newline separates several patterns.
+ * @return 0 on success, -1 with errno set if memory runs out.
+ */
+int matcher_add_list(matcher_t *m, const char *list);
+
+/**
+ * @brief Adds one pattern per line of a pattern file (-f). "-" reads the patterns from stdin.
+ * @return 0 on success, -1 with errno set if the file cannot be read.
+ */
+int matcher_add_file(matcher_t *m, const char *path);
+
+/**
+ * @brief Prepares the collected patterns for searching. Must be called once after the last
+ * matcher_add.
+ * @param case_insensitive Flag: 1 to match with Unicode simple case folding (ASCII only
+ * with errors).
+ * @param extended Flag: 1 to treat the patterns as extended regular expressions.
+ * @param errors Edit distance a match may have, up to FUZZY_MAX_ERRORS; 0 for exact
+ * matching. Cannot be combined with extended.
+ * @return 0 on success, -1 with a message in m->error.
+ */
+int matcher_compile(matcher_t *m, int case_insensitive, int extended, unsigned errors);
+
+/**
+ * @brief Frees the patterns and their compiled form. Other threads must have stopped
+ * searching; the caches they created are freed when they exit.
+ */
+void matcher_free(matcher_t *m);
+
+/**
+ * @brief Creates the calling thread's search state for m: its DFA cache, its buffer for
+ * case folded text and its fuzzy scratch words, where the patterns need them. Does nothing once they exist.
+ * matcher_find, matcher_dfa_cache and regex_feed_folded rely on it; scan_buffer and the
+ * stream functions call it.
+ * @return 0 on success, -1 with errno set if memory runs out.
+ */
+int matcher_prepare(const matcher_t *m);
+
+/**
+ * @brief Finds the first match of any pattern inside a byte buffer. Thread-safe, once
+ * matcher_prepare has succeeded on the calling thread.
+ * @param match_len Receives the length of the match: the keyword's length for literals,
+ * 0 for a regular expression, whose match is reported at the start of its line, and 1 for
+ * an approximate match, reported at its last byte.
+ * @return Pointer into hay, or NULL if no pattern occurs.
+ */
+const char *matcher_find(const matcher_t *m, const char *hay, size_t hay_len, size_t *match_len);
+
+/**
+ * @brief Bytes at the end of one block of a stream that must be searched again with the
+ * next block, so that a keyword split between the two is still found. Regular expressions
+ * need none: their DFA state is carried over instead.
+ */
+size_t matcher_overlap(const matcher_t *m);
+
+/**
+ * @brief Collects the literals every matching line contains one of, e.g. for
+ * index_candidates.
+ * @param literal, literal_len Storage for a single literal.
+ * @return Number of literals; 0 if the matcher has none to narrow the search down.
+ */
+size_t matcher_literals(const matcher_t *m, const char **literal, size_t *literal_len,
+                        const char *const **literals, const size_t **lengths);
+
+/**
+ * @brief Returns the calling thread's DFA cache for m->regex (see matcher_prepare).
+ */
+dfa_cache_t *matcher_dfa_cache(const matcher_t *m);
+
+/**
+ * @brief Runs the regular expression over the case folded form of text, as a piece of one
+ * line (with unicode_fold).
+ * @return 1 once the expression has matched, 0 otherwise.
+ */
+int regex_feed_folded(const matcher_t *m, dfa_cache_t *cache, dfa_partial_t *state, const char *text, size_t len);
+
+#endif
@@ -0,0 +1,392 @@
+/**
+ * @file multi.c
+ * @brief Aho-Corasick automaton with byte classes and a premultiplied transition table,
+ * plus a Teddy-style SIMD prefilter for small pattern sets.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "multi.h"
+#include "search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MULTI_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * Assigns an equivalence class to every byte. Class 0 is shared by all bytes that do not
+ * occur in any pattern; with case_insensitive, uppercase letters reuse the lowercase class.
+ */
+static uint32_t build_classes(uint8_t classes[256], char *const *patterns, const size_t *lengths,
+                              size_t count, int case_insensitive) {
+    int used[256] = {0};
+    for (size_t p = 0; p < count; p++) {
+        for (size_t i = 0; i < lengths[p]; i++) used[(unsigned char)patterns[p][i]] = 1;
+    }
+
+    uint32_t class_count = 1;
+    memset(classes, 0, 256);
+    for (int c = 0; c < 256; c++) {
+        if (case_insensitive && c >= 'A' && c <= 'Z') continue; // Assigned with the lowercase letter
+        if (!used[c]) continue;
+        if (class_count > 255) return 0; // Only if a pattern used every byte value, including '\n'
+        classes[c] = (uint8_t)class_count;
+        if (case_insensitive && c >= 'a' && c <= 'z') classes[c - ('a' - 'A')] = (uint8_t)class_count;
+        class_count++;
+    }
+    return class_count;
+}
+
+ac_automaton_t *ac_build(char *const *patterns, const size_t *lengths, size_t count, int case_insensitive) {
+    ac_automaton_t *ac = calloc(1, sizeof(*ac));
+    if (!ac) return NULL;
+
+    ac->class_count = build_classes(ac->classes, patterns, lengths, count, case_insensitive);
+    if (ac->class_count == 0) {
+        free(ac);
+        errno = EINVAL;
+        return NULL;
+    }
+    uint32_t ncls = ac->class_count;
+
+    // The trie can never have more states than pattern bytes plus the root
+    size_t max_states = 1;
+    for (size_t p = 0; p < count; p++) max_states += lengths[p];
+    if (max_states > (AC_ACCEPT - 1) / ncls) {
+        free(ac);
+        errno = EOVERFLOW;
+        return NULL;
+    }
+
+    uint32_t *delta = calloc(max_states * ncls, sizeof(uint32_t));
+    uint32_t *match_len = calloc(max_states, sizeof(uint32_t));
+    uint32_t *fail = calloc(max_states, sizeof(uint32_t));
+    uint32_t *queue = malloc(max_states * sizeof(uint32_t));
+    if (!delta || !match_len || !fail || !queue) {
+        free(delta);
+        free(match_len);
+        free(fail);
+        free(queue);
+        free(ac);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Phase 1: plain trie. Rows are indexed by state number here; 0 means "no child" because
+    // the root can never be a child.
+    uint32_t states = 1;
+    for (size_t p = 0; p < count; p++) {
+        uint32_t s = 0;
+        for (size_t i = 0; i < lengths[p]; i++) {
+            uint32_t *slot = &delta[(size_t)s * ncls + ac->classes[(unsigned char)patterns[p][i]]];
+            if (*slot == 0) *slot = states++;
+            s = *slot;
+        }
+        match_len[s] = (uint32_t)lengths[p];
+    }
+
+    // Phase 2: breadth-first failure links, resolved directly into the table so that
+    // scanning never has to follow a failure chain.
+    size_t head = 0, tail = 0;
+    for (uint32_t c = 0; c < ncls; c++) {
+        uint32_t child = delta[c];
+        if (child != 0) {
+            fail[child] = 0;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail) {
+        uint32_t s = queue[head++];
+        // A state also accepts if a shorter pattern ends at its longest proper suffix
+        if (match_len[s] == 0) match_len[s] = match_len[fail[s]];
+        for (uint32_t c = 0; c < ncls; c++) {
+            uint32_t *slot = &delta[(size_t)s * ncls + c];
+            uint32_t fallback = delta[(size_t)fail[s] * ncls + c];
+            if (*slot != 0) {
+                fail[*slot] = fallback;
+                queue[tail++] = *slot;
+            } else {
+                *slot = fallback;
+            }
+        }
+    }
+
+    // Phase 3: premultiply targets and tag accepting ones
+    for (size_t i = 0; i < (size_t)states * ncls; i++) {
+        uint32_t target = delta[i];
+        delta[i] = target * ncls | (match_len[target] != 0 ? AC_ACCEPT : 0);
+    }
+
+    free(fail);
+    free(queue);
+
+    // Return the unused part of the worst-case allocation (shared trie prefixes)
+    uint32_t *shrunk = realloc(delta, (size_t)states * ncls * sizeof(uint32_t));
+    ac->delta = shrunk ? shrunk : delta;
+    ac->match_len = match_len;
+    ac->state_count = states;
+    return ac;
+}
+
+const char *ac_find(const ac_automaton_t *ac, const char *hay, size_t hay_len, size_t *match_len) {
+    const uint32_t *delta = ac->delta;
+    const uint8_t *classes = ac->classes;
+    uint32_t s = 0;
+
+    for (size_t i = 0; i < hay_len; i++) {
+        s = delta[s + classes[(unsigned char)hay[i]]];
+        if (s & AC_ACCEPT) {
+            *match_len = ac->match_len[(s & ~AC_ACCEPT) / ac->class_count];
+            return hay + i + 1 - *match_len;
+        }
+    }
+    return NULL;
+}
+
+void ac_free(ac_automaton_t *ac) {
+    if (!ac) return;
+    free(ac->delta);
+    free(ac->match_len);
+    free(ac);
+}
+
+struct teddy {
+    uint8_t lo[TEDDY_MAX_FINGERPRINT][16]; // Low nibble -> bucket bits, per fingerprint offset
+    uint8_t hi[TEDDY_MAX_FINGERPRINT][16]; // High nibble -> bucket bits, per fingerprint offset
+    size_t fingerprint;                    // Number of leading pattern bytes in the tables (1-3)
+    char **patterns;
+    size_t *lengths;
+    size_t count;
+    uint8_t members[TEDDY_BUCKETS][TEDDY_MAX_PATTERNS]; // Pattern indices per bucket
+    uint8_t member_count[TEDDY_BUCKETS];
+    int case_insensitive;
+    const char *(*find)(const teddy_t *t, const char *hay, size_t hay_len, size_t *match_len);
+    const char *kernel;
+};
+
+static inline unsigned char ascii_lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+/**
+ * Checks all patterns of the given buckets at hay + pos; patterns are tried in bucket order.
+ */
+static inline const char *teddy_verify(const teddy_t *t, const char *hay, size_t hay_len, size_t pos,
+                                       unsigned buckets, size_t *match_len) {
+    while (buckets != 0) {
+        unsigned b = (unsigned)__builtin_ctz(buckets);
+        buckets &= buckets - 1;
+        for (unsigned k = 0; k < t->member_count[b]; k++) {
+            size_t p = t->members[b][k];
+            size_t len = t->lengths[p];
+            if (len > hay_len - pos) continue;
+
+            const char *cand = hay + pos;
+            int equal;
+            if (t->case_insensitive) {
+                size_t i = 0;
+                while (i < len && ascii_lower((unsigned char)cand[i]) == (unsigned char)t->patterns[p][i]) i++;
+                equal = (i == len);
+            } else {
+                equal = (memcmp(cand, t->patterns[p], len) == 0);
+            }
+            if (equal) {
+                *match_len = len;
+                return cand;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Scalar version of the nibble lookup, used for the last bytes of a buffer.
+ */
+static const char *teddy_find_tail(const teddy_t *t, const char *hay, size_t hay_len, size_t from,
+                                   size_t *match_len) {
+    if (hay_len < t->fingerprint) return NULL;
+    for (size_t pos = from; pos + t->fingerprint <= hay_len; pos++) {
+        unsigned buckets = 0xFF;
+        for (size_t j = 0; j < t->fingerprint && buckets != 0; j++) {
+            unsigned char c = (unsigned char)hay[pos + j];
+            buckets &= t->lo[j][c & 0x0F] & t->hi[j][c >> 4];
+        }
+        if (buckets != 0) {
+            const char *found = teddy_verify(t, hay, hay_len, pos, buckets, match_len);
+            if (found) return found;
+        }
+    }
+    return NULL;
+}
+
+#ifdef MULTI_X86
+
+__attribute__((target("ssse3")))
+static const char *teddy_find_ssse3(const teddy_t *t, const char *hay, size_t hay_len, size_t *match_len) {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo[TEDDY_MAX_FINGERPRINT], hi[TEDDY_MAX_FINGERPRINT];
+    size_t m = t->fingerprint;
+    for (size_t j = 0; j < m; j++) {
+        lo[j] = _mm_loadu_si128((const __m128i *)t->lo[j]);
+        hi[j] = _mm_loadu_si128((const __m128i *)t->hi[j]);
+    }
+
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= hay_len; i += 16) {
+        __m128i res = _mm_set1_epi8((char)0xFF);
+        for (size_t j = 0; j < m; j++) {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)(hay + i + j));
+            __m128i l = _mm_shuffle_epi8(lo[j], _mm_and_si128(chunk, nibble));
+            __m128i h = _mm_shuffle_epi8(hi[j], _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble));
+            res = _mm_and_si128(res, _mm_and_si128(l, h));
+        }
+        unsigned cand = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero)) & 0xFFFFu;
+        if (cand == 0) continue;
+
+        uint8_t buckets[16];
+        _mm_storeu_si128((__m128i *)buckets, res);
+        while (cand != 0) {
+            unsigned k = (unsigned)__builtin_ctz(cand);
+            const char *found = teddy_verify(t, hay, hay_len, i + k, buckets[k], match_len);
+            if (found) return found;
+            cand &= cand - 1;
+        }
+    }
+    return teddy_find_tail(t, hay, hay_len, i, match_len);
+}
+
+__attribute__((target("avx2")))
+static const char *teddy_find_avx2(const teddy_t *t, const char *hay, size_t hay_len, size_t *match_len) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo[TEDDY_MAX_FINGERPRINT], hi[TEDDY_MAX_FINGERPRINT];
+    size_t m = t->fingerprint;
+    // VPSHUFB looks up within each 128-bit lane, so the tables are repeated in both lanes
+    for (size_t j = 0; j < m; j++) {
+        lo[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)t->lo[j]));
+        hi[j] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)t->hi[j]));
+    }
+
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= hay_len; i += 32) {
+        __m256i res = _mm256_set1_epi8((char)0xFF);
+        for (size_t j = 0; j < m; j++) {
+            __m256i chunk = _mm256_loadu_si256((const __m256i *)(hay + i + j));
+            __m256i l = _mm256_shuffle_epi8(lo[j], _mm256_and_si256(chunk, nibble));
+            __m256i h = _mm256_shuffle_epi8(hi[j], _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble));
+            res = _mm256_and_si256(res, _mm256_and_si256(l, h));
+        }
+        unsigned cand = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(res, zero));
+        if (cand == 0) continue;
+
+        uint8_t buckets[32];
+        _mm256_storeu_si256((__m256i *)buckets, res);
+        while (cand != 0) {
+            unsigned k = (unsigned)__builtin_ctz(cand);
+            const char *found = teddy_verify(t, hay, hay_len, i + k, buckets[k], match_len);
+            if (found) return found;
+            cand &= cand - 1;
+        }
+    }
+    return teddy_find_tail(t, hay, hay_len, i, match_len);
+}
+
+#endif
+
+static void teddy_add_byte(teddy_t *t, size_t offset, unsigned char c, unsigned bucket) {
+    t->lo[offset][c & 0x0F] |= (uint8_t)(1u << bucket);
+    t->hi[offset][c >> 4] |= (uint8_t)(1u << bucket);
+}
+
+teddy_t *teddy_build(char *const *patterns, const size_t *lengths, size_t count, int case_insensitive) {
+#ifdef MULTI_X86
+    if (count == 0 || count > TEDDY_MAX_PATTERNS || !search_cpu_supports("ssse3")) return NULL;
+
+    teddy_t *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->patterns = calloc(count, sizeof(*t->patterns));
+    t->lengths = calloc(count, sizeof(*t->lengths));
+    if (!t->patterns || !t->lengths) {
+        teddy_free(t);
+        return NULL;
+    }
+
+    t->count = count;
+    t->case_insensitive = case_insensitive;
+    t->fingerprint = TEDDY_MAX_FINGERPRINT;
+    for (size_t p = 0; p < count; p++) {
+        if (lengths[p] < t->fingerprint) t->fingerprint = lengths[p];
+        t->lengths[p] = lengths[p];
+        t->patterns[p] = malloc(lengths[p] + 1);
+        if (!t->patterns[p]) {
+            teddy_free(t);
+            return NULL;
+        }
+        memcpy(t->patterns[p], patterns[p], lengths[p] + 1);
+    }
+    if (t->fingerprint == 0) {
+        teddy_free(t);
+        return NULL;
+    }
+
+    // Order patterns by their fingerprint bytes so that similar patterns share a bucket,
+    // which keeps the number of patterns to verify per candidate low (insertion sort, n <= 32)
+    size_t order[TEDDY_MAX_PATTERNS];
+    for (size_t k = 0; k < count; k++) {
+        size_t p = k, pos = k;
+        while (pos > 0 && memcmp(t->patterns[order[pos - 1]], t->patterns[p], t->fingerprint) > 0) {
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+        order[pos] = p;
+    }
+
+    // Contiguous runs of the sorted order form the buckets
+    for (size_t k = 0; k < count; k++) {
+        unsigned bucket = (unsigned)(k * TEDDY_BUCKETS / count);
+        size_t p = order[k];
+        t->members[bucket][t->member_count[bucket]++] = (uint8_t)p;
+        for (size_t j = 0; j < t->fingerprint; j++) {
+            unsigned char c = (unsigned char)t->patterns[p][j];
+            teddy_add_byte(t, j, c, bucket);
+            if (case_insensitive && c >= 'a' && c <= 'z') teddy_add_byte(t, j, (unsigned char)(c - ('a' - 'A')), bucket);
+        }
+    }
+
+    if (search_cpu_supports("avx2")) {
+        t->find = teddy_find_avx2;
+        t->kernel = "avx2";
+    } else {
+        t->find = teddy_find_ssse3;
+        t->kernel = "ssse3";
+    }
+    return t;
+#else
+    (void)patterns;
+    (void)lengths;
+    (void)count;
+    (void)case_insensitive;
+    return NULL;
+#endif
+}
+
+const char *teddy_find(const teddy_t *t, const char *hay, size_t hay_len, size_t *match_len) {
+    return t->find(t, hay, hay_len, match_len);
+}
+
+const char *teddy_kernel_name(const teddy_t *t) {
+    return t->kernel;
+}
+
+void teddy_free(teddy_t *t) {
+    if (!t) return;
+    if (t->patterns) {
+        for (size_t p = 0; p < t->count; p++) free(t->patterns[p]);
+    }
+    free(t->patterns);
+    free(t->lengths);
+    free(t);
+}
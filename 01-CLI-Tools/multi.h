@@ -0,0 +1,88 @@
+/**
+ * @file multi.h
+ * @brief Multi-pattern matching for mygrep (-e / -f).
+ * Large pattern sets are compiled once into an Aho-Corasick automaton, so every input byte
+ * is examined exactly once regardless of how many patterns are searched for. Small sets of
+ * up to TEDDY_MAX_PATTERNS patterns use a Teddy-style SIMD prefilter instead.
+ */
+
+#ifndef MULTI_H
+#define MULTI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AC_ACCEPT 0x80000000u // Set in a transition when the target state ends a pattern
+
+/**
+ * @brief A fully resolved Aho-Corasick automaton (failure links folded into the table).
+ * Input bytes are first mapped to equivalence classes: only bytes that occur in some
+ * pattern get their own class, everything else shares one. This keeps each row of the
+ * transition table as short as the pattern alphabet, which is what keeps large pattern
+ * sets cache-friendly. State numbers are premultiplied by class_count, so a transition
+ * is a single load: delta[state + classes[byte]].
+ */
+typedef struct {
+    uint32_t *delta;      // state_count * class_count transitions, AC_ACCEPT flag in the top bit
+    uint32_t *match_len;  // Per state: length of a pattern ending in that state (0 if none)
+    uint32_t class_count;
+    uint32_t state_count;
+    uint8_t classes[256]; // Byte -> equivalence class
+} ac_automaton_t;
+
+/**
+ * @brief Compiles a pattern set. Patterns must not contain '\n' and must be non-empty.
+ * @param patterns The patterns (lowercase if case_insensitive is set).
+ * @param lengths Length of each pattern.
+ * @param count Number of patterns.
+ * @param case_insensitive Flag: 1 to let 'A'-'Z' share the class of their lowercase letter.
+ * @return The automaton, or NULL with errno set if memory runs out or the table is too large.
+ */
+ac_automaton_t *ac_build(char *const *patterns, const size_t *lengths, size_t count, int case_insensitive);
+
+/**
+ * @brief Finds the first position in hay at which some pattern ends.
+ * @param match_len Receives the length of the matched pattern.
+ * @return Pointer to the start of that match, or NULL if no pattern occurs.
+ */
+const char *ac_find(const ac_automaton_t *ac, const char *hay, size_t hay_len, size_t *match_len);
+
+void ac_free(ac_automaton_t *ac);
+
+#define TEDDY_MAX_PATTERNS 32
+#define TEDDY_BUCKETS 8
+#define TEDDY_MAX_FINGERPRINT 3
+
+/**
+ * @brief Teddy-style SIMD prefilter for small pattern sets.
+ * Patterns are spread over 8 buckets. For each of the first `fingerprint` pattern bytes,
+ * two 16-entry tables map the low and the high nibble of an input byte to the set of
+ * buckets whose patterns have a byte with that nibble at that offset. A PSHUFB lookup of
+ * both nibbles for 16/32 input bytes at once, AND-ed across the fingerprint offsets, leaves
+ * a non-zero bucket mask only at candidate start positions, which are then verified.
+ */
+typedef struct teddy teddy_t;
+
+/**
+ * @brief Builds a Teddy matcher if the pattern set and the CPU are suitable.
+ * Patterns must be non-empty (lowercase if case_insensitive is set).
+ * @return The matcher, or NULL if there are too many patterns, the CPU lacks SSSE3, or
+ * memory runs out. The caller then falls back to Aho-Corasick.
+ */
+teddy_t *teddy_build(char *const *patterns, const size_t *lengths, size_t count, int case_insensitive);
+
+/**
+ * @brief Finds the leftmost position in hay at which some pattern starts.
+ * @param match_len Receives the length of the matched pattern.
+ * @return Pointer to the start of the match, or NULL if no pattern occurs.
+ */
+const char *teddy_find(const teddy_t *t, const char *hay, size_t hay_len, size_t *match_len);
+
+/**
+ * @brief Name of the vector width used by the matcher ("ssse3" or "avx2").
+ */
+const char *teddy_kernel_name(const teddy_t *t);
+
+void teddy_free(teddy_t *t);
+
+#endif
@@ -1,85 +1,1287 @@
 /**
  * @file mygrep.c
  * @brief A simplified implementation of the Unix 'grep' utility.
- * Supports case-insensitive search (-i) and custom output files (-o).
+ * Supports case-insensitive search (-i), custom output files (-o), multiple patterns (-e, -f)
+ * and extended regular expressions (-E), and can report only counts (-c) or file names (-l).
+ * Matching lines can be prefixed with their line number (-n) and byte offset (-b), and
+ * surrounded by context lines (-A, -B, -C). With -m, each input is abandoned after a number
+ * of matching lines.
  * Demonstrates POSIX argument parsing (getopt), stream processing, and dynamic memory management.
+ * Case-insensitive matching applies Unicode simple case folding to lines with multibyte
+ * UTF-8 characters; pure-ASCII text keeps the ASCII kernels.
+ * Regular files are memory-mapped and searched as a whole; pipes and stdin are read through
+ * a fixed-size block, whatever their line length.
+ * With -j, several files are searched concurrently while output keeps the command-line order,
+ * and huge files are split into newline-aligned chunks that are searched on separate threads.
+ * With -r, directory trees are walked on their own thread while the pool searches the files found.
+ * Many small files searched on one thread are opened and read ahead through io_uring where available.
+ * A directory searched repeatedly can be indexed (--index-build) so that --index only scans
+ * the blocks whose trigrams can contain a keyword.
+ * With --follow, growing files stay open and their appended lines are searched as inotify
+ * reports them, across log rotation and truncation.
+ * With --fuzzy, lines match that contain a string within a small edit distance of a
+ * pattern.
+ * With --since/--until, only the lines of a time window of a timestamped log are searched;
+ * the window is found by bisecting the mapped file on its timestamps (window.c).
+ * With --stats, the bytes, lines and matches of each input and the time spent reading,
+ * searching and writing it are reported on stderr as JSON.
+ * With --serve, files stay mapped in a daemon that answers queries on a Unix socket
+ * (serve.c); --connect sends it one.
+ * Matching itself lives in libmygrep (matcher.h, scan.h); this file handles the command
+ * line, files, threads and output order.
  */
 
-#define _POSIX_C_SOURCE 200809L // Required for getline
+#define _POSIX_C_SOURCE 200809L // Required for open_memstream
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
-#include <ctype.h>
-#include <unistd.h> // for getopt
+#include <limits.h> // for NAME_MAX
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h> // for getopt_long
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include "search.h"
+#include "matcher.h"
+#include "scan.h"
+#include "walk.h"
+#include "uring.h"
+#include "index.h"
+#include "serve.h"
+
+// Jobs a worker may finish ahead of the one currently being printed (bounds buffered output)
+#define JOBS_AHEAD_PER_WORKER 4
+
+// Smaller regular files are read instead: for a few pages, setting up and tearing down a
+// mapping costs more than copying (this dominates -r over trees of small files)
+#define MAP_MIN_FILE_SIZE ((size_t)64 << 10)
+
+// With -j, mapped files of at least this size are split into chunks of CHUNK_SIZE bytes
+#define PARALLEL_MIN_FILE_SIZE ((size_t)64 << 20)
+#define CHUNK_SIZE ((size_t)16 << 20)
+
+static size_t scan_chunks_parallel(const char *buf, size_t len, FILE *output, const matcher_t *m,
+                                   const options_t *opts, size_t threads);
 
 /**
- * Reads a stream line by line and prints lines containing the keyword.
- * * @param input The input file stream (or stdin).
+ * Memory-maps a regular file and searches it with scan_buffer; with --since/--until, only
+ * the lines of the time window.
+ * @param fd The opened input file.
  * @param output The output file stream (or stdout).
- * @param keyword The search term.
- * @param case_insensitive Flag: 1 for case-insensitive search, 0 otherwise.
- */
-void process_stream(FILE *input, FILE *output, const char *keyword, int case_insensitive) {
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
-
-    // getline automatically reallocates 'line' buffer as needed
-    while ((read = getline(&line, &len, input)) != -1) {
-        
-        // Create a temporary copy for comparison to preserve original line for output
-        char *comparison_line = malloc(read + 1);
-        if (!comparison_line) {
+ * @param m The compiled patterns.
+ * @param opts The reporting options.
+ * @param threads Threads available for this file; huge files are searched in parallel chunks.
+ * @param matches Receives the number of matching lines, or SIZE_MAX with errno set if the
+ * search failed.
+ * @return 0 if the file was searched, -1 if it is not mapped (pipe, tty, small or special file;
+ * without a time window).
+ */
+static int process_mapped(int fd, FILE *output, const matcher_t *m, const options_t *opts, size_t threads,
+                          size_t *matches) {
+    struct stat st;
+
+    // Files reporting size 0 (e.g. in /proc) may still have content, so they are streamed
+    if (fd < 0 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) return -1;
+    if (opts->window != NULL && st.st_size <= 0) {
+        // Bisecting a time window needs the mapping whatever the size
+        *matches = 0;
+        return 0;
+    }
+    if (st.st_size <= 0 || (opts->window == NULL && (size_t)st.st_size < MAP_MIN_FILE_SIZE)) return -1;
+
+    size_t size = (size_t)st.st_size;
+    input_stats_t *stats = stats_current(opts);
+    uint64_t start = stats != NULL ? stats_clock() : 0;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, size, opts->window != NULL ? MADV_RANDOM : MADV_SEQUENTIAL);
+    if (stats != NULL) stats->read_ns += stats_clock() - start;
+
+    if (opts->window != NULL) {
+        // The bisection touches a few pages across the file; only the window is read through
+        size_t from, to;
+        window_range(opts->window, map, size, &from, &to);
+        size_t page = from & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+        madvise(map + page, to - page, MADV_SEQUENTIAL);
+        input_pos_t pos;
+        *matches = scan_range(map, from, to, output, m, opts, &pos);
+        munmap(map, size);
+        return 0;
+    }
+
+    // -l and -m stop at a match limit, which a serial scan reaches soonest; context groups
+    // may span chunk boundaries
+    if (threads > 1 && size >= PARALLEL_MIN_FILE_SIZE && match_limit(opts) == SIZE_MAX && !opts->context) {
+        *matches = scan_chunks_parallel(map, size, output, m, opts, threads);
+        munmap(map, size);
+        return 0;
+    }
+
+    input_pos_t pos = input_start;
+    *matches = scan_buffer(map, size, output, m, opts, match_limit(opts) == SIZE_MAX ? NULL : &pos);
+    munmap(map, size);
+    if (match_limit(opts) != SIZE_MAX && input_done(&pos, opts) && pos.offset < size) {
+        // Stopped early: drop the pages that sequential read-ahead brought in past the stop,
+        // and any of the rest still cached, rather than let them crowd out useful ones
+        posix_fadvise(fd, (off_t)pos.offset, 0, POSIX_FADV_DONTNEED);
+    }
+    return 0;
+}
+
+/**
+ * Searches an open file: mapped if it is a large regular file, read in blocks otherwise.
+ * @return Number of matching lines, or SIZE_MAX with errno set if reading or searching failed.
+ */
+static size_t search_fd(int fd, FILE *output, const matcher_t *m, const options_t *opts, size_t threads) {
+    size_t matches;
+    if (process_mapped(fd, output, m, opts, threads, &matches) == -1) {
+        matches = process_stream(fd, output, m, opts);
+    }
+    return matches;
+}
+
+/**
+ * --since/--until bisect the mapped file, which a pipe or device does not offer.
+ * @return 1 after an error message if the time window cannot be applied to fd, 0 otherwise.
+ */
+static int window_unsupported(const char *prog, FILE *errors, const char *path, int fd, const options_t *opts) {
+    struct stat st;
+    if (opts->window == NULL || (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))) return 0;
+    fprintf(errors, "%s: Error searching '%s': --since/--until need a regular file\n", prog, path);
+    return 1;
+}
+
+/**
+ * Opens one input file, searches it with search_fd and reports the result.
+ * @param prog Program name for error messages.
+ * @param path The file to search.
+ * @param output Where matching lines go.
+ * @param errors Where error messages go (stderr, or a per-file buffer in parallel mode).
+ * @param m The compiled patterns.
+ * @param opts The reporting options.
+ * @param threads Threads available for splitting a huge file into chunks.
+ */
+static void search_file(const char *prog, const char *path, FILE *output, FILE *errors, const matcher_t *m,
+                        const options_t *opts, size_t threads) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        // Standard grep behavior: print error to stderr but CONTINUE with next file
+        fprintf(errors, "%s: Error opening input file '%s': %s\n", prog, path, strerror(errno));
+        return;
+    }
+    if (window_unsupported(prog, errors, path, fd, opts)) {
+        close(fd);
+        return;
+    }
+
+    options_t input_opts = *opts;
+    input_opts.name = path;
+    input_stats_t stats = {0};
+    stats_enter(opts, &stats);
+    size_t matches = search_fd(fd, output, m, &input_opts, threads);
+    stats_leave(opts, &stats);
+    close(fd);
+    if (matches == SIZE_MAX) {
+        fprintf(errors, "%s: Error searching '%s': %s\n", prog, path, strerror(errno));
+        return;
+    }
+    report_input(output, path, matches, opts);
+    stats_report(opts, errors, path, &stats, matches);
+}
+
+/**
+ * @brief One unit of parallel work: a whole file, or a newline-aligned chunk of a mapping.
+ * A worker searches it into memory buffers; the printer writes those buffers out once
+ * all earlier jobs have been written.
+ */
+typedef struct {
+    const char *path;  // File to open, or NULL for a chunk job
+    int owns_path;     // Set if path was allocated by the directory walker
+    const char *chunk; // Chunk start inside a mapping (chunk jobs only)
+    size_t chunk_len;
+    input_pos_t chunk_pos; // Position of the chunk within the file (-n, -b)
+    char *out;         // Matching lines, filled through open_memstream
+    size_t out_len;
+    char *err;         // Error messages, filled through open_memstream (file jobs only)
+    size_t err_len;
+    size_t matches;    // Matching lines found in a chunk job
+    int error;         // errno of a chunk job whose search failed, or 0
+    int grouped;       // -A/-B/-C: the file job wrote a group (the printer separates it from earlier ones)
+    input_stats_t stats; // --stats: what searching a chunk job took
+    int done;          // Set by the worker once out/err are complete
+} job_t;
+
+/**
+ * @brief Ordered work queue shared by a worker pool and the printer (the calling thread).
+ * Workers take jobs in order; the printer consumes finished jobs in the same order.
+ */
+typedef struct {
+    job_t **jobs;
+    size_t count;
+    size_t capacity;
+    size_t next;          // Next job to hand to a worker
+    size_t printed;       // Jobs already written out
+    size_t window;        // Max jobs handed out beyond the printed ones
+    int closed;           // Set when no more jobs will be added
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t *workers;
+    size_t worker_count;
+    size_t file_threads;  // Threads each file job may use for chunking a huge file
+    const matcher_t *matcher;
+    const options_t *opts;
+    const char *prog;
+} job_queue_t;
+
+static void queue_push(job_queue_t *q, const char *path, int owns_path, const char *chunk, size_t chunk_len,
+                       input_pos_t chunk_pos) {
+    job_t *job = calloc(1, sizeof(*job));
+    if (!job) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    job->path = path;
+    job->owns_path = owns_path;
+    job->chunk = chunk;
+    job->chunk_len = chunk_len;
+    job->chunk_pos = chunk_pos;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->capacity) {
+        size_t capacity = q->capacity ? q->capacity * 2 : 64;
+        job_t **jobs = realloc(q->jobs, capacity * sizeof(*jobs));
+        if (!jobs) {
             perror("Memory allocation failed");
-            free(line);
             exit(EXIT_FAILURE);
         }
-        strcpy(comparison_line, line);
+        q->jobs = jobs;
+        q->capacity = capacity;
+    }
+    q->jobs[q->count++] = job;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * Marks the end of the job list; workers exit and pool_finish returns once it is worked off.
+ */
+static void queue_close(job_queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * Worker thread: searches queued files or chunks into per-job memory buffers.
+ */
+static void *search_worker(void *arg) {
+    job_queue_t *q = arg;
 
-        // Normalize to lowercase if case-insensitive requested
-        if (case_insensitive) {
-            for (int i = 0; comparison_line[i]; i++) {
-                comparison_line[i] = tolower((unsigned char)comparison_line[i]);
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        // Wait for a job, but never run too far ahead of the printer
+        while (q->next >= q->count || q->next >= q->printed + q->window) {
+            if (q->closed && q->next >= q->count) {
+                pthread_mutex_unlock(&q->lock);
+                return NULL;
             }
+            pthread_cond_wait(&q->changed, &q->lock);
         }
+        job_t *job = q->jobs[q->next++];
+        pthread_mutex_unlock(&q->lock);
 
-        // Check for keyword occurrence
-        if (strstr(comparison_line, keyword) != NULL) {
-            fprintf(output, "%s", line);
+        FILE *out = open_memstream(&job->out, &job->out_len);
+        if (!out) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        if (job->path != NULL) {
+            FILE *err = open_memstream(&job->err, &job->err_len);
+            if (!err) {
+                perror("Memory allocation failed");
+                exit(EXIT_FAILURE);
+            }
+            // Whether earlier files wrote groups is only known to the printer
+            options_t job_opts = *q->opts;
+            job_opts.grouped = &job->grouped;
+            search_file(q->prog, job->path, out, err, q->matcher, &job_opts, q->file_threads);
+            fclose(err);
+        } else {
+            stats_enter(q->opts, &job->stats);
+            job->matches = scan_buffer(job->chunk, job->chunk_len, out, q->matcher, q->opts, &job->chunk_pos);
+            if (job->matches == SIZE_MAX) {
+                job->error = errno;
+                job->matches = 0;
+            }
+            stats_leave(q->opts, &job->stats);
         }
+        fclose(out);
 
-        free(comparison_line);
+        pthread_mutex_lock(&q->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&q->changed);
     }
-    
-    free(line); // getline buffer must be freed by caller
+}
+
+/**
+ * Initializes a queue and starts its worker pool.
+ * @param file_threads Threads each file job may use to split a huge file into chunks.
+ */
+static void pool_start(job_queue_t *q, const char *prog, const matcher_t *m, const options_t *opts, size_t threads,
+                       size_t file_threads) {
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    q->matcher = m;
+    q->opts = opts;
+    q->prog = prog;
+    q->window = threads * JOBS_AHEAD_PER_WORKER;
+    q->file_threads = file_threads;
+
+    q->workers = malloc(threads * sizeof(*q->workers));
+    if (!q->workers) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t t = 0; t < threads; t++) {
+        int rc = pthread_create(&q->workers[t], NULL, search_worker, q);
+        if (rc != 0) {
+            fprintf(stderr, "%s: Error creating worker thread: %s\n", prog, strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+    q->worker_count = threads;
+}
+
+/**
+ * Writes all jobs in queue order as they finish, until the queue is closed and empty, and
+ * stops the pool. Jobs may still be pushed (by another thread) while this runs.
+ * @return Total number of matching lines reported by chunk jobs, or SIZE_MAX with errno
+ * set if a chunk job failed.
+ */
+static size_t pool_finish(job_queue_t *q, FILE *output) {
+    size_t matches = 0;
+    int error = 0;
+    input_stats_t *stats = stats_current(q->opts); // The file whose chunks these are, if any
+    pthread_mutex_lock(&q->lock);
+
+    for (;;) {
+        // Wait until the next job is done, or until no job will come any more
+        while (q->printed < q->count ? !q->jobs[q->printed]->done : !q->closed) {
+            pthread_cond_wait(&q->changed, &q->lock);
+        }
+        if (q->printed == q->count) break;
+
+        job_t *job = q->jobs[q->printed];
+        pthread_mutex_unlock(&q->lock);
+
+        uint64_t start = stats != NULL ? stats_clock() : 0;
+        if (job->grouped && q->opts->grouped != NULL) {
+            if (*q->opts->grouped) fwrite("--\n", 1, 3, output);
+            *q->opts->grouped = 1;
+        }
+        fwrite(job->out, 1, job->out_len, output);
+        matches += job->matches;
+        if (job->error != 0) error = job->error;
+        if (stats != NULL) {
+            // Chunks are searched on other threads, so their time is already part of the
+            // file's elapsed time; only what they wrote is carried over
+            stats->bytes += job->stats.bytes;
+            stats->lines += job->stats.lines;
+            stats->write_ns += stats_clock() - start;
+        }
+        if (job->err_len > 0) {
+            fflush(output);
+            fwrite(job->err, 1, job->err_len, stderr);
+        }
+        free(job->out);
+        free(job->err);
+        if (job->owns_path) free((char *)job->path);
+        free(job);
+
+        pthread_mutex_lock(&q->lock);
+        q->jobs[q->printed++] = NULL;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    for (size_t t = 0; t < q->worker_count; t++) pthread_join(q->workers[t], NULL);
+    free(q->workers);
+    free(q->jobs);
+    pthread_cond_destroy(&q->changed);
+    pthread_mutex_destroy(&q->lock);
+    if (error != 0) {
+        errno = error;
+        return SIZE_MAX;
+    }
+    return matches;
+}
+
+/**
+ * Searches files on a pool of worker threads. Output is identical to searching them one
+ * after another: each file's matches are buffered and written in command-line order.
+ */
+static void search_files_parallel(const char *prog, char *const *paths, size_t count, FILE *output,
+                                  const matcher_t *m, const options_t *opts, size_t threads) {
+    size_t workers = threads < count ? threads : count;
+    job_queue_t q;
+
+    // Threads left over when there are fewer files than threads go to chunking huge files
+    pool_start(&q, prog, m, opts, workers, threads / workers);
+    for (size_t i = 0; i < count; i++) queue_push(&q, paths[i], 0, NULL, 0, input_start);
+    queue_close(&q);
+    pool_finish(&q, output);
+}
+
+/**
+ * Splits a huge buffer into chunks that end right after a newline and searches them on a
+ * pool of worker threads. No line crosses a chunk boundary, so every chunk is searched
+ * independently, and writing the chunk results in order reproduces the serial output.
+ * @return Number of matching lines in the whole buffer, or SIZE_MAX with errno set.
+ */
+static size_t scan_chunks_parallel(const char *buf, size_t len, FILE *output, const matcher_t *m,
+                                   const options_t *opts, size_t threads) {
+    job_queue_t q;
+    pool_start(&q, NULL, m, opts, threads, 1);
+
+    size_t offset = 0;
+    input_pos_t pos = input_start;
+    while (offset < len) {
+        size_t end = offset + CHUNK_SIZE;
+        if (end >= len) {
+            end = len;
+        } else {
+            // Extend the chunk to the end of the line it cuts through
+            const char *newline = memchr(buf + end, '\n', len - end);
+            end = newline ? (size_t)(newline - buf) + 1 : len;
+        }
+        queue_push(&q, NULL, 0, buf + offset, end - offset, pos);
+        // A chunk's first line number needs the newlines of all chunks before it; counting
+        // them runs well ahead of the workers' search
+        if (opts->mode == OUTPUT_LINES && opts->line_numbers) {
+            pos.line += search_count_byte(buf + offset, end - offset, '\n');
+        }
+        pos.offset = end;
+        offset = end;
+    }
+
+    queue_close(&q);
+    return pool_finish(&q, output);
+}
+
+/**
+ * Reports every file of the -r operands to visit: directories are walked, other operands
+ * (including missing ones, so that search_file reports the error) are passed on as they
+ * are. Without operands the working directory is walked.
+ */
+static void walk_operands(const char *prog, char *const *roots, size_t count, const walk_filter_t *filter,
+                          walk_visit_fn visit, void *ctx) {
+    if (count == 0) walk_tree(prog, "", filter, visit, ctx);
+    for (size_t i = 0; i < count; i++) {
+        struct stat st;
+        if (stat(roots[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            walk_tree(prog, roots[i], filter, visit, ctx);
+            continue;
+        }
+        char *path = strdup(roots[i]);
+        if (!path) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        visit(ctx, path);
+    }
+}
+
+/**
+ * @brief Everything needed to search the files handed over by the directory walker or
+ * the io_uring reader.
+ */
+typedef struct {
+    const char *prog;
+    char *const *roots;   // -r: command-line operands; none means the working directory
+    size_t count;
+    const walk_filter_t *filter;
+    FILE *output;         // Serial search only
+    const matcher_t *matcher;
+    const options_t *opts;
+    job_queue_t *queue;   // Parallel search only
+    uring_reader_t *reader; // Serial search through io_uring only
+} file_search_t;
+
+static void search_walked_file(void *arg, char *path) {
+    file_search_t *t = arg;
+    search_file(t->prog, path, t->output, stderr, t->matcher, t->opts, 1);
+    free(path);
+}
+
+static void queue_walked_file(void *arg, char *path) {
+    file_search_t *t = arg;
+    queue_push(t->queue, path, 1, NULL, 0, input_start);
+}
+
+static void read_walked_file(void *arg, char *path) {
+    file_search_t *t = arg;
+    uring_reader_add(t->reader, path);
+}
+
+/**
+ * io_uring reader callback: searches a file whose content was read ahead, or its
+ * descriptor if it is not a small regular file.
+ */
+static void search_read_file(void *arg, const char *path, int fd, const char *data, size_t len, int error) {
+    file_search_t *t = arg;
+    if (fd < 0) {
+        fprintf(stderr, "%s: Error opening input file '%s': %s\n", t->prog, path, strerror(error));
+        return;
+    }
+    if (data == NULL && window_unsupported(t->prog, stderr, path, fd, t->opts)) return;
+
+    // Content read ahead was read while earlier files were searched: no read time here
+    options_t input_opts = *t->opts;
+    input_opts.name = path;
+    input_stats_t stats = {0};
+    size_t matches;
+    stats_enter(t->opts, &stats);
+    if (data != NULL && t->opts->window != NULL) {
+        size_t from, to;
+        input_pos_t pos;
+        window_range(t->opts->window, data, len, &from, &to);
+        matches = scan_range(data, from, to, t->output, t->matcher, &input_opts, &pos);
+    } else if (data != NULL) {
+        matches = scan_buffer(data, len, t->output, t->matcher, &input_opts, NULL);
+    } else {
+        matches = search_fd(fd, t->output, t->matcher, &input_opts, 1);
+    }
+    stats_leave(t->opts, &stats);
+    if (matches == SIZE_MAX) {
+        fprintf(stderr, "%s: Error searching '%s': %s\n", t->prog, path, strerror(errno));
+        return;
+    }
+    report_input(t->output, path, matches, t->opts);
+    stats_report(t->opts, stderr, path, &stats, matches);
+}
+
+/**
+ * Searches files one after another on the calling thread. Several files go through the
+ * io_uring reader when it is available, so the opens and reads of the next files overlap
+ * with searching the current one.
+ * @param threads Threads available for splitting a huge file into chunks.
+ */
+static void search_files_serial(const char *prog, char *const *paths, size_t count, FILE *output,
+                                const matcher_t *m, const options_t *opts, size_t threads) {
+    file_search_t search = {prog, NULL, 0, NULL, output, m, opts, NULL, NULL};
+    if (count > 1 && threads == 1) search.reader = uring_reader_new(search_read_file, &search);
+
+    if (search.reader == NULL) {
+        for (size_t i = 0; i < count; i++) search_file(prog, paths[i], output, stderr, m, opts, threads);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        char *path = strdup(paths[i]);
+        if (!path) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        uring_reader_add(search.reader, path);
+    }
+    uring_reader_finish(search.reader);
+}
+
+/**
+ * Walker thread: queues the files of every operand and closes the queue when done.
+ */
+static void *tree_walker(void *arg) {
+    file_search_t *t = arg;
+    walk_operands(t->prog, t->roots, t->count, t->filter, queue_walked_file, t);
+    queue_close(t->queue);
+    return NULL;
+}
+
+/**
+ * Searches directory trees recursively (-r). With several threads, a walker thread lists
+ * directories and feeds the files into the job queue while the workers already search
+ * them, so the first results appear before the walk is complete. With one thread, files
+ * are searched as the walk finds them, read ahead through io_uring where available.
+ * Output follows the walk order either way.
+ */
+static void search_tree(const char *prog, char *const *roots, size_t count, FILE *output, const matcher_t *m,
+                        const options_t *opts, const walk_filter_t *filter, size_t threads) {
+    job_queue_t q;
+    file_search_t tree = {prog, roots, count, filter, output, m, opts, &q, NULL};
+
+    if (threads == 1) {
+        // Handing each file to another thread costs more than searching a typical small file
+        tree.reader = uring_reader_new(search_read_file, &tree);
+        if (tree.reader != NULL) {
+            walk_operands(prog, roots, count, filter, read_walked_file, &tree);
+            uring_reader_finish(tree.reader);
+        } else {
+            walk_operands(prog, roots, count, filter, search_walked_file, &tree);
+        }
+        return;
+    }
+
+    pthread_t walker;
+    pool_start(&q, prog, m, opts, threads, 1);
+    int rc = pthread_create(&walker, NULL, tree_walker, &tree);
+    if (rc != 0) {
+        fprintf(stderr, "%s: Error creating walker thread: %s\n", prog, strerror(rc));
+        exit(EXIT_FAILURE);
+    }
+    pool_finish(&q, output);
+    pthread_join(walker, NULL);
+}
+
+/**
+ * @brief An indexed search (--index): the mapped index of the directory and the blocks
+ * that may contain a match.
+ */
+typedef struct {
+    const char *prog;
+    size_t prefix_len;    // Length of the "dir/" prefix of walked paths
+    const index_t *index;
+    const unsigned char *candidates; // One flag per block, or NULL: every block
+    FILE *output;
+    const matcher_t *matcher;
+    const options_t *opts;
+} index_search_t;
+
+
+/**
+ * Searches the candidate blocks of an indexed file that is unchanged since indexing.
+ * Blocks start on a line, so each is searched on its own with the line number and offset
+ * recorded in the index; after-context owed at the end of a block continues into the next.
+ * @return Number of matching lines, or SIZE_MAX with errno set if the search failed.
+ */
+static size_t search_indexed_blocks(const index_search_t *s, int fd, const index_file_t *file) {
+    if (file->size == 0) return 0;
+    size_t size = (size_t)file->size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return process_stream(fd, s->output, s->matcher, s->opts);
+
+    size_t matches = 0;
+    if (s->candidates == NULL) {
+        madvise(data, size, MADV_SEQUENTIAL);
+        matches = scan_buffer(data, size, s->output, s->matcher, s->opts, NULL);
+        munmap(data, size);
+        return matches;
+    }
+
+    // Only the candidate blocks are touched; read-ahead around them would be wasted
+    madvise(data, size, MADV_RANDOM);
+    input_pos_t pos = input_start;
+    for (uint32_t i = 0; i < file->block_count; i++) {
+        if (!s->candidates[file->first_block + i] && pos.after_left == 0) continue;
+        const index_block_t *block = index_block(s->index, file->first_block + i);
+        if (block->offset + block->length > size) break; // Damaged index: stop at the file end
+        pos.line = block->first_line;
+        pos.offset = block->offset;
+        pos.history = block->offset; // Before-context may reach back into earlier blocks
+        size_t found = scan_buffer(data + block->offset, block->length, s->output, s->matcher, s->opts, &pos);
+        if (found == SIZE_MAX) {
+            matches = SIZE_MAX;
+            break;
+        }
+        matches += found;
+        if (input_done(&pos, s->opts)) break;
+    }
+    munmap(data, size);
+    return matches;
+}
+
+/**
+ * Walker callback of --index: files that are unchanged since indexing are searched through
+ * the index, new and modified ones in full.
+ */
+static void search_indexed_file(void *arg, char *path) {
+    index_search_t *s = arg;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "%s: Error opening input file '%s': %s\n", s->prog, path, strerror(errno));
+        free(path);
+        return;
+    }
+
+    const index_file_t *file = index_find_file(s->index, path + s->prefix_len);
+    struct stat st;
+    size_t matches;
+    options_t input_opts = *s->opts;
+    input_opts.name = path;
+    index_search_t input_search = *s;
+    input_search.opts = &input_opts;
+    input_stats_t stats = {0};
+    stats_enter(s->opts, &stats);
+    if (file != NULL && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size == file->size &&
+        (int64_t)st.st_mtim.tv_sec == file->mtime_sec && (int64_t)st.st_mtim.tv_nsec == file->mtime_nsec) {
+        matches = search_indexed_blocks(&input_search, fd, file);
+    } else {
+        matches = search_fd(fd, s->output, s->matcher, &input_opts, 1);
+    }
+    stats_leave(s->opts, &stats);
+    close(fd);
+    if (matches == SIZE_MAX) {
+        fprintf(stderr, "%s: Error searching '%s': %s\n", s->prog, path, strerror(errno));
+    } else {
+        report_input(s->output, path, matches, s->opts);
+        stats_report(s->opts, stderr, path, &stats, matches);
+    }
+    free(path);
+}
+
+/**
+ * Searches a directory through its index (--index), like -r on the directory. Output
+ * follows the walk order, so it is the same as that of -r.
+ * @return 0 on success, -1 if the index cannot be opened.
+ */
+static int search_index(const char *prog, const char *dir, FILE *output, const matcher_t *m,
+                        const options_t *opts, const walk_filter_t *filter) {
+    index_t *idx = index_open(dir);
+    if (idx == NULL) {
+        fprintf(stderr, "%s: Error opening index of '%s': %s (run --index-build first)\n", prog, dir,
+                strerror(errno));
+        return -1;
+    }
+
+    const char *literal = NULL;
+    size_t literal_len = 0;
+    const char *const *literals = NULL;
+    const size_t *lengths = NULL;
+    size_t count = matcher_literals(m, &literal, &literal_len, &literals, &lengths);
+    unsigned char *candidates = index_candidates(idx, literals, lengths, count);
+
+    size_t dir_len = strlen(dir);
+    index_search_t search = {prog, dir_len + (dir_len > 0 && dir[dir_len - 1] != '/'), idx, candidates,
+                             output, m, opts};
+    walk_tree(prog, dir, filter, search_indexed_file, &search);
+
+    free(candidates);
+    index_close(idx);
+    return 0;
+}
+
+// --follow watches: the open file itself, and its directory for a new file under its name
+#define FOLLOW_FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define FOLLOW_DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+/**
+ * @brief A file followed with --follow.
+ */
+typedef struct {
+    const char *path;     // As given on the command line
+    char *dir;            // The directory holding it, watched for its re-creation after rotation
+    const char *name;     // Base name, compared with the names of directory events
+    int fd;
+    int wd;               // Watch on the open file, -1 once the kernel dropped it
+    int dir_wd;
+    off_t offset;         // Bytes of the open file read so far
+    int done;             // -m: the limit was reached (or an error ended the search); no longer followed
+    stream_t stream;
+    options_t opts;       // The options with this file's name
+    input_stats_t stats;  // --stats: over all the file's events, reported when following ends
+} follow_file_t;
+
+/**
+ * @brief Everything the --follow event loop needs.
+ */
+typedef struct {
+    const char *prog;
+    int inotify_fd;
+    follow_file_t *files;
+    size_t count;
+    size_t active;        // Files not yet done
+    int failed;           // Some file is no longer followed because its search failed
+    FILE *output;
+    const matcher_t *matcher;
+    const options_t *opts;
+} follow_t;
+
+/**
+ * Stops following a file: it has its -m matches, or searching it failed.
+ */
+static void follow_stop(follow_t *f, follow_file_t *file) {
+    if (file->wd != -1) inotify_rm_watch(f->inotify_fd, file->wd);
+    inotify_rm_watch(f->inotify_fd, file->dir_wd);
+    file->wd = -1;
+    file->dir_wd = -1;
+    file->done = 1;
+    f->active--;
+}
+
+/**
+ * Reports a failed search of a followed file and stops following it: the stream is left
+ * in an unknown state.
+ */
+static void follow_fail(follow_t *f, follow_file_t *file) {
+    fprintf(stderr, "%s: Error searching '%s': %s\n", f->prog, file->path, strerror(errno));
+    follow_stop(f, file);
+    f->failed = 1;
+}
+
+/**
+ * Searches the bytes appended to a followed file since the last call. A file that became
+ * shorter than what was read has been truncated: it is searched again from its start.
+ */
+static void follow_drain(follow_t *f, follow_file_t *file) {
+    struct stat st;
+    if (file->done) return;
+    if (fstat(file->fd, &st) == 0 && st.st_size < file->offset) {
+        if (stream_finish(&file->stream, f->output, f->matcher, &file->opts) == -1) {
+            follow_fail(f, file);
+            return;
+        }
+        if (lseek(file->fd, 0, SEEK_SET) == -1) {
+            fprintf(stderr, "%s: Error reading input file '%s': %s\n", f->prog, file->path, strerror(errno));
+            return;
+        }
+        file->offset = 0;
+    }
+
+    ssize_t got;
+    while ((got = stream_read(&file->stream, file->fd, f->output, f->matcher, &file->opts)) > 0) file->offset += got;
+    if (got < 0) {
+        follow_fail(f, file);
+    } else if (input_done(&file->stream.pos, f->opts)) {
+        follow_stop(f, file); // -m reached
+    }
+}
+
+/**
+ * Switches to a new file under the followed path after rotation, once the old file has
+ * been read to its end. Nothing happens while the path is missing or still names the
+ * open file.
+ */
+static void follow_reopen(follow_t *f, follow_file_t *file) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return;
+    struct stat st_new, st_old;
+    if (fstat(fd, &st_new) == -1 || fstat(file->fd, &st_old) == -1 ||
+        (st_new.st_dev == st_old.st_dev && st_new.st_ino == st_old.st_ino)) {
+        close(fd);
+        return;
+    }
+
+    // The last lines written to the old file before it was rotated still count
+    follow_drain(f, file);
+    if (file->done) {
+        close(fd);
+        return;
+    }
+    if (stream_finish(&file->stream, f->output, f->matcher, &file->opts) == -1) {
+        follow_fail(f, file);
+        close(fd);
+        return;
+    }
+    if (file->wd != -1) inotify_rm_watch(f->inotify_fd, file->wd);
+    close(file->fd);
+
+    file->fd = fd;
+    file->offset = 0;
+    file->wd = inotify_add_watch(f->inotify_fd, file->path, FOLLOW_FILE_EVENTS);
+    // The new file is searched from its start; the watch is in place before reading
+    follow_drain(f, file);
+}
+
+static void follow_event(follow_t *f, const struct inotify_event *event) {
+    for (size_t i = 0; i < f->count; i++) {
+        follow_file_t *file = &f->files[i];
+        if (file->done) continue;
+        stats_enter(f->opts, &file->stats);
+        if (event->mask & IN_Q_OVERFLOW) {
+            // Events were lost: check every file
+            follow_drain(f, file);
+            follow_reopen(f, file);
+        } else if (event->wd == file->wd && (event->mask & IN_IGNORED)) {
+            file->wd = -1;
+        } else if (event->wd == file->wd) {
+            follow_drain(f, file);
+            if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) follow_reopen(f, file);
+        } else if (event->wd == file->dir_wd && event->len > 0 && strcmp(event->name, file->name) == 0) {
+            follow_reopen(f, file);
+        }
+        stats_leave(f->opts, &file->stats);
+    }
+}
+
+/**
+ * Follows growing files (--follow): each file stays open and its appended lines are
+ * searched as soon as inotify reports a write, with the same stream search as pipes, so
+ * an unfinished last line waits for its newline. Following starts at the current end of
+ * each file. When a file is moved away or deleted and a new one appears under its name
+ * (log rotation), the rest of the old file is searched and the new one is followed from
+ * its start, as is a file that was truncated. Line numbers and offsets
+ * count from the start of the open file. With -m, a file is followed until it has its
+ * matches. --stats reports each file once following ends, over all its events. Returns only if no file is left to follow.
+ * @return 0 if every file got its -m matches, -1 if no file could be followed (any more)
+ * or searching one failed.
+ */
+static int follow_files(const char *prog, char *const *paths, size_t count, FILE *output, const matcher_t *m,
+                         const options_t *opts) {
+    follow_t f = {prog, inotify_init1(IN_CLOEXEC), NULL, 0, 0, 0, output, m, opts};
+    if (f.inotify_fd == -1) {
+        fprintf(stderr, "%s: Error setting up inotify: %s\n", prog, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    f.files = calloc(count, sizeof(*f.files));
+    if (!f.files) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        follow_file_t *file = &f.files[f.count];
+        struct stat st;
+        file->path = paths[i];
+        file->opts = *opts;
+        file->opts.name = paths[i];
+        file->fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (file->fd == -1 || fstat(file->fd, &st) == -1) {
+            fprintf(stderr, "%s: Error opening input file '%s': %s\n", prog, paths[i], strerror(errno));
+            if (file->fd != -1) close(file->fd);
+            continue;
+        }
+        file->wd = inotify_add_watch(f.inotify_fd, paths[i], FOLLOW_FILE_EVENTS);
+        const char *slash = strrchr(paths[i], '/');
+        file->name = slash ? slash + 1 : paths[i];
+        file->dir = slash ? strndup(paths[i], slash == paths[i] ? 1 : (size_t)(slash - paths[i])) : strdup(".");
+        if (!file->dir) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        file->dir_wd = inotify_add_watch(f.inotify_fd, file->dir, FOLLOW_DIR_EVENTS);
+        if (file->wd == -1 || file->dir_wd == -1) {
+            fprintf(stderr, "%s: Error watching input file '%s': %s\n", prog, paths[i], strerror(errno));
+            close(file->fd);
+            free(file->dir);
+            continue;
+        }
+
+        // Skip what is already there, but number the lines that follow it
+        if (stream_init(&file->stream, m) == -1) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        file->offset = st.st_size;
+        file->stream.pos.offset = (size_t)st.st_size;
+        if (opts->line_numbers && S_ISREG(st.st_mode) && st.st_size > 0) {
+            char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+            if (data != MAP_FAILED) {
+                file->stream.pos.line += search_count_byte(data, (size_t)st.st_size, '\n');
+                munmap(data, (size_t)st.st_size);
+            }
+        }
+        if (lseek(file->fd, st.st_size, SEEK_SET) == -1) {
+            fprintf(stderr, "%s: Error reading input file '%s': %s\n", prog, paths[i], strerror(errno));
+            close(file->fd);
+            free(file->dir);
+            stream_free(&file->stream);
+            continue;
+        }
+        f.count++;
+    }
+    f.active = f.count;
+
+    // The event structs are variable-length; the union keeps the buffer aligned for them
+    union {
+        struct inotify_event event;
+        char bytes[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+    } events;
+    while (f.active > 0) {
+        ssize_t got = read(f.inotify_fd, &events, sizeof(events));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            fprintf(stderr, "%s: Error reading inotify events: %s\n", prog, strerror(errno));
+            break;
+        }
+        for (char *p = events.bytes; p < events.bytes + got;) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            follow_event(&f, event);
+            p += sizeof(*event) + event->len;
+        }
+    }
+
+    for (size_t i = 0; i < f.count; i++) {
+        stats_report(opts, stderr, f.files[i].path, &f.files[i].stats, f.files[i].stream.matches);
+        close(f.files[i].fd);
+        free(f.files[i].dir);
+        stream_free(&f.files[i].stream);
+    }
+    int rc = f.count > 0 && f.active == 0 && !f.failed ? 0 : -1;
+    free(f.files);
+    close(f.inotify_fd);
+    return rc;
+}
+
+/**
+ * Parses the line count of -A, -B or -C, or the match count of -m.
+ * @return 0 on success, -1 if the argument is not a non-negative number.
+ */
+static int parse_context_lines(const char *arg, size_t *lines) {
+    char *end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (errno != 0 || *end != '\0' || end == arg || value < 0) return -1;
+    *lines = (size_t)value;
+    return 0;
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-E] [-c | -l] [-i] [-n] [-b] [-H | -h] [-m num] [-A num] [-B num] [-C num] [-j threads] [-o outfile] [-r [--include=glob] [--exclude=glob] "
+            "[--exclude-dir=glob]] [--index dir] [--follow] [--stats] [--fuzzy k] "
+            "[--since time] [--until time] [--time-format fmt] {keyword | -e pattern... | -f patternfile...} [file...]\n"
+            "       %s [--include=glob] [--exclude=glob] [--exclude-dir=glob] --index-build dir\n"
+            "       %s [-j threads] --serve socket file...\n"
+            "       %s --connect socket [query option...] keyword [served file...]\n", prog, prog, prog, prog);
 }
 
 int main(int argc, char *argv[]) {
     int case_insensitive = 0;
+    int extended = 0;
+    options_t opts = {OUTPUT_LINES, 0, 0, 0, 0, 0, 0, SIZE_MAX, NULL, NULL, NULL, NULL};
+    int recursive = 0;
+    walk_filter_t filter = {{0}};
+    const char *index_build_dir = NULL; // --index-build
+    const char *index_dir = NULL;       // --index
+    int follow = 0;                     // --follow
+    long fuzzy = 0;                     // --fuzzy: edit distance allowed
+    stats_t stats;                      // --stats: opts.stats points here
+    int have_patterns = 0; // Set once -e or -f supplied the patterns
+    long threads = 1;
+    int threads_given = 0;
+    int filenames = -1;                 // -H: 1, -h: 0, -1: name the inputs if there are several
+    const char *serve_path = NULL;      // --serve
+    const char *since = NULL;           // --since
+    const char *until = NULL;           // --until
+    const char *time_format = WINDOW_DEFAULT_FORMAT; // --time-format
+    time_window_t window;               // opts.window points here with --since/--until
+    int grouped = 0;                    // opts.grouped points here
     char *outfile_path = NULL;
     FILE *output = stdout;
+    matcher_t matcher = {0};
     
+    // --connect passes the rest of the command line to a daemon as it is, unparsed
+    if (argc >= 3 && strcmp(argv[1], "--connect") == 0) {
+        return serve_connect(argv[0], argv[2], argv + 3, (size_t)(argc - 3)) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Pick the fastest literal search kernel for this CPU once at startup
+    matcher_init();
+
+    enum { OPT_INCLUDE = 256, OPT_EXCLUDE, OPT_EXCLUDE_DIR, OPT_INDEX_BUILD, OPT_INDEX, OPT_FOLLOW, OPT_STATS, OPT_FUZZY,
+           OPT_SERVE, OPT_SINCE, OPT_UNTIL, OPT_TIME_FORMAT };
+    static const struct option long_options[] = {
+        {"include", required_argument, NULL, OPT_INCLUDE},
+        {"exclude", required_argument, NULL, OPT_EXCLUDE},
+        {"exclude-dir", required_argument, NULL, OPT_EXCLUDE_DIR},
+        {"index-build", required_argument, NULL, OPT_INDEX_BUILD},
+        {"index", required_argument, NULL, OPT_INDEX},
+        {"follow", no_argument, NULL, OPT_FOLLOW},
+        {"stats", no_argument, NULL, OPT_STATS},
+        {"fuzzy", required_argument, NULL, OPT_FUZZY},
+        {"serve", required_argument, NULL, OPT_SERVE},
+        {"since", required_argument, NULL, OPT_SINCE},
+        {"until", required_argument, NULL, OPT_UNTIL},
+        {"time-format", required_argument, NULL, OPT_TIME_FORMAT},
+        {NULL, 0, NULL, 0},
+    };
+
     int opt;
-    // Parse command line arguments using POSIX getopt
-    // "i" = flag, "o:" = option requiring an argument
-    while ((opt = getopt(argc, argv, "io:")) != -1) {
+    // Parse command line arguments using getopt_long
+    // "E", "H", "b", "c", "h", "l", "i", "n", "r" = flags, "o:", "e:", "f:", "j:", "m:", "A:", "B:", "C:" =
+    // options requiring an argument
+    while ((opt = getopt_long(argc, argv, "EHbchlino:e:f:j:m:rA:B:C:", long_options, NULL)) != -1) {
         switch (opt) {
+            case 'r':
+                recursive = 1;
+                break;
+            case OPT_INCLUDE:
+                glob_list_add(&filter.include, optarg);
+                break;
+            case OPT_EXCLUDE:
+                glob_list_add(&filter.exclude, optarg);
+                break;
+            case OPT_EXCLUDE_DIR:
+                glob_list_add(&filter.exclude_dir, optarg);
+                break;
+            case OPT_INDEX_BUILD:
+                index_build_dir = optarg;
+                break;
+            case OPT_INDEX:
+                index_dir = optarg;
+                break;
+            case OPT_FOLLOW:
+                follow = 1;
+                break;
+            case OPT_STATS:
+                opts.stats = &stats;
+                break;
+            case OPT_SERVE:
+                serve_path = optarg;
+                break;
+            case OPT_SINCE:
+                since = optarg;
+                break;
+            case OPT_UNTIL:
+                until = optarg;
+                break;
+            case OPT_TIME_FORMAT:
+                time_format = optarg;
+                break;
+            case OPT_FUZZY: {
+                char *end;
+                errno = 0;
+                fuzzy = strtol(optarg, &end, 10);
+                if (errno != 0 || *end != '\0' || end == optarg || fuzzy < 0 || fuzzy > FUZZY_MAX_ERRORS) {
+                    fprintf(stderr, "%s: Invalid edit distance '%s' (0 to %d)\n", argv[0], optarg, FUZZY_MAX_ERRORS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'E':
+                extended = 1;
+                break;
+            case 'c':
+                opts.mode = OUTPUT_COUNT;
+                break;
+            case 'l':
+                opts.mode = OUTPUT_FILES;
+                break;
             case 'i':
                 case_insensitive = 1;
                 break;
+            case 'n':
+                opts.line_numbers = 1;
+                break;
+            case 'b':
+                opts.byte_offsets = 1;
+                break;
+            case 'H':
+                filenames = 1;
+                break;
+            case 'h':
+                filenames = 0;
+                break;
+            case 'A':
+            case 'B':
+            case 'C': {
+                size_t lines;
+                if (parse_context_lines(optarg, &lines) == -1) {
+                    fprintf(stderr, "%s: Invalid context length '%s'\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                if (opt != 'B') opts.after = lines;
+                if (opt != 'A') opts.before = lines;
+                opts.context = 1;
+                break;
+            }
+            case 'm':
+                if (parse_context_lines(optarg, &opts.max_count) == -1) {
+                    fprintf(stderr, "%s: Invalid match count '%s'\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
             case 'o':
                 outfile_path = optarg;
                 break;
+            case 'e':
+                if (matcher_add_list(&matcher, optarg) == -1) {
+                    perror("Memory allocation failed");
+                    exit(EXIT_FAILURE);
+                }
+                have_patterns = 1;
+                break;
+            case 'f':
+                if (matcher_add_file(&matcher, optarg) == -1) {
+                    fprintf(stderr, "%s: Error opening pattern file '%s': %s\n",
+                            argv[0], optarg, strerror(errno));
+                    return EXIT_FAILURE;
+                }
+                have_patterns = 1;
+                break;
+            case 'j': {
+                char *end;
+                errno = 0;
+                threads = strtol(optarg, &end, 10);
+                if (errno != 0 || *end != '\0' || end == optarg || threads < 1) {
+                    fprintf(stderr, "%s: Invalid thread count '%s'\n", argv[0], optarg);
+                    return EXIT_FAILURE;
+                }
+                threads_given = 1;
+                break;
+            }
             case '?':
-                fprintf(stderr, "Usage: %s [-i] [-o outfile] keyword [file...]\n", argv[0]);
+                print_usage(argv[0]);
                 return EXIT_FAILURE;
             default:
                 abort(); // Should not be reached
         }
     }
 
+    // The index itself is never indexed or searched
+    glob_list_add(&filter.exclude, INDEX_FILE_GLOB);
+    if (index_build_dir != NULL) {
+        int rc = index_build(argv[0], index_build_dir, &filter);
+        walk_filter_free(&filter);
+        return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (index_dir != NULL && (recursive || argc - optind > (have_patterns ? 0 : 1))) {
+        fprintf(stderr, "%s: --index searches its directory; no file operands or -r allowed\n", argv[0]);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (serve_path != NULL) {
+        // Every operand is a file to serve; the queries bring their own keywords and options
+        if (recursive || index_dir != NULL || follow || have_patterns || optind >= argc || since != NULL ||
+            until != NULL) {
+            fprintf(stderr, "%s: --serve needs file operands and no keyword, -r, --index, --follow or "
+                    "--since/--until\n", argv[0]);
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t workers = threads_given ? (size_t)threads : online > 0 ? (size_t)online : 1;
+        int rc = serve(argv[0], serve_path, argv + optind, (size_t)(argc - optind), workers);
+        walk_filter_free(&filter);
+        return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (fuzzy > 0 && extended) {
+        fprintf(stderr, "%s: --fuzzy matches literal patterns and cannot be combined with -E\n", argv[0]);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (follow && (recursive || index_dir != NULL || opts.mode != OUTPUT_LINES ||
+                   argc - optind <= (have_patterns ? 0 : 1))) {
+        fprintf(stderr, "%s: --follow needs file operands and cannot be combined with -r, --index, -c or -l\n",
+                argv[0]);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // The time window is bisected in each mapped file, so there must be files
+    if (since != NULL || until != NULL) {
+        if (index_dir != NULL || follow || (!recursive && argc - optind <= (have_patterns ? 0 : 1))) {
+            fprintf(stderr, "%s: --since/--until need file operands and cannot be combined with --index or "
+                    "--follow\n", argv[0]);
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (window_init(&window, time_format, since, until) == -1) {
+            fprintf(stderr, "%s: Invalid time for --since/--until (format '%s', or HH:MM[:SS])\n", argv[0],
+                    time_format);
+            return EXIT_FAILURE;
+        }
+        opts.window = &window;
+    }
+
     // Prepare output stream
     if (outfile_path != NULL) {
         output = fopen(outfile_path, "w");
@@ -90,53 +1292,80 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Check if keyword is provided
-    if (optind >= argc) {
-        fprintf(stderr, "Error: No keyword provided.\n");
-        fprintf(stderr, "Usage: %s [-i] [-o outfile] keyword [file...]\n", argv[0]);
-        if (output != stdout) fclose(output);
-        return EXIT_FAILURE;
+    // Without -e/-f the first operand is the keyword
+    if (!have_patterns) {
+        if (optind >= argc) {
+            fprintf(stderr, "Error: No keyword provided.\n");
+            print_usage(argv[0]);
+            if (output != stdout) fclose(output);
+            return EXIT_FAILURE;
+        }
+        if (matcher_add(&matcher, argv[optind], strlen(argv[optind])) == -1) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        optind++;
     }
 
-    // Retrieve keyword and advance index
-    char *raw_keyword = argv[optind];
-    char *search_keyword = strdup(raw_keyword); // Duplicate to avoid modifying argv
-    if (!search_keyword) {
-        perror("Memory allocation failed");
-        return EXIT_FAILURE;
+    // Compile all patterns once; every input below reuses the result
+    if (matcher_compile(&matcher, case_insensitive, extended, (unsigned)fuzzy) == -1) {
+        fprintf(stderr, "%s: %s\n", argv[0], matcher.error);
+        exit(EXIT_FAILURE);
     }
-    optind++;
 
-    if (case_insensitive) {
-        for (int i = 0; search_keyword[i]; i++) {
-            search_keyword[i] = tolower((unsigned char)search_keyword[i]);
-        }
+    if (opts.stats != NULL && stats_init(&stats) == -1) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
     }
 
     // Process inputs: either stdin (if no files) or list of files
-    if (optind >= argc) {
-        process_stream(stdin, output, search_keyword, case_insensitive);
-    } else {
-        for (int i = optind; i < argc; i++) {
-            char *current_path = argv[i];
-            FILE *input = fopen(current_path, "r");
-
-            if (input == NULL) {
-                // Standard grep behavior: print error to stderr but CONTINUE with next file
-                fprintf(stderr, "%s: Error opening input file '%s': %s\n", 
-                        argv[0], current_path, strerror(errno));
-                continue; 
-            }
-            
-            process_stream(input, output, search_keyword, case_insensitive);
-            fclose(input);
+    opts.with_filename = filenames >= 0 ? filenames : recursive || index_dir != NULL || argc - optind > 1;
+    opts.grouped = &grouped;
+    int status = EXIT_SUCCESS;
+    if (opts.max_count == 0) {
+        // -m 0: as with grep, no input is read at all
+    } else if (index_dir != NULL) {
+        if (search_index(argv[0], index_dir, output, &matcher, &opts, &filter) == -1) status = EXIT_FAILURE;
+    } else if (follow) {
+        // Following ends when every file has its -m matches, or if no file can be followed
+        if (follow_files(argv[0], argv + optind, (size_t)(argc - optind), output, &matcher, &opts) == -1) {
+            status = EXIT_FAILURE;
         }
+    } else if (recursive) {
+        search_tree(argv[0], argv + optind, (size_t)(argc - optind), output, &matcher, &opts, &filter,
+                    (size_t)threads);
+    } else if (optind >= argc) {
+        input_stats_t input_stats = {0};
+        stats_enter(&opts, &input_stats);
+        opts.name = "(standard input)";
+        size_t matches = process_stream(fileno(stdin), output, &matcher, &opts);
+        stats_leave(&opts, &input_stats);
+        if (matches == SIZE_MAX) {
+            fprintf(stderr, "%s: Error searching standard input: %s\n", argv[0], strerror(errno));
+            status = EXIT_FAILURE;
+        } else {
+            report_input(output, "(standard input)", matches, &opts);
+            stats_report(&opts, stderr, "(standard input)", &input_stats, matches);
+        }
+    } else if (threads > 1 && argc - optind > 1) {
+        search_files_parallel(argv[0], argv + optind, (size_t)(argc - optind), output, &matcher, &opts,
+                              (size_t)threads);
+    } else {
+        search_files_serial(argv[0], argv + optind, (size_t)(argc - optind), output, &matcher, &opts,
+                            (size_t)threads);
+    }
+
+    if (opts.stats != NULL) {
+        fflush(output); // The statistics come after the last result
+        stats_report_total(&stats);
+        stats_destroy(&stats);
     }
 
-    free(search_keyword);
+    matcher_free(&matcher);
+    walk_filter_free(&filter);
     if (output != stdout) {
         fclose(output);
     }
 
-    return EXIT_SUCCESS;
+    return status;
 }
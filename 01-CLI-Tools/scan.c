@@ -0,0 +1,718 @@
+/**
+ * @file scan.c
+ * @brief Searching buffers and streams line by line, writing matches in writev batches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>   // for clock_gettime
+#include <unistd.h>
+#include <fcntl.h>  // for posix_fadvise
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "scan.h"
+#include "search.h"
+#include "fold.h"
+
+// Streams are read in blocks of this size; longer lines are searched in pieces
+#define STREAM_BLOCK_SIZE ((size_t)1 << 20)
+
+// Matching lines are collected as spans and written with one writev per batch
+#define WRITER_MAX_SPANS 1024                   // IOV_MAX on Linux
+#define WRITER_FLUSH_BYTES ((size_t)256 << 10)
+#define WRITER_LABEL_BYTES ((size_t)16 << 10)  // -n/-b prefixes of one batch
+#define LABEL_MAX 45                            // ":<line>:<offset>:" with two 20-digit numbers
+
+int stats_init(stats_t *all) {
+    memset(all, 0, sizeof(*all));
+    if (pthread_key_create(&all->current, NULL) != 0) return -1;
+    pthread_mutex_init(&all->lock, NULL);
+    all->started = stats_clock();
+    return 0;
+}
+
+void stats_destroy(stats_t *all) {
+    pthread_key_delete(all->current);
+    pthread_mutex_destroy(&all->lock);
+}
+
+uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+input_stats_t *stats_current(const options_t *opts) {
+    return opts->stats != NULL ? pthread_getspecific(opts->stats->current) : NULL;
+}
+
+void stats_enter(const options_t *opts, input_stats_t *stats) {
+    if (opts->stats == NULL) return;
+    stats->entered = stats_clock();
+    pthread_setspecific(opts->stats->current, stats);
+}
+
+void stats_leave(const options_t *opts, input_stats_t *stats) {
+    if (opts->stats == NULL) return;
+    stats->elapsed_ns += stats_clock() - stats->entered;
+    pthread_setspecific(opts->stats->current, NULL);
+}
+
+/**
+ * Adds the bytes of buf[0, len) that were searched, and their lines.
+ */
+static void stats_add_searched(input_stats_t *stats, const char *buf, size_t len) {
+    stats->bytes += len;
+    stats->lines += search_count_byte(buf, len, '\n');
+}
+
+/**
+ * Bytes per nanosecond, which is GB/s.
+ */
+static double stats_rate(size_t bytes, uint64_t ns) {
+    return ns > 0 ? (double)bytes / (double)ns : 0.0;
+}
+
+/**
+ * Writes a string as a JSON string literal.
+ */
+static void stats_write_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void stats_report(const options_t *opts, FILE *errors, const char *name, const input_stats_t *stats,
+                  size_t matches) {
+    if (opts->stats == NULL) return;
+    uint64_t io_ns = stats->read_ns + stats->write_ns;
+    uint64_t search_ns = stats->elapsed_ns > io_ns ? stats->elapsed_ns - io_ns : 0;
+    fputs("{\"file\":", errors);
+    stats_write_string(errors, name);
+    fprintf(errors,
+            ",\"bytes\":%zu,\"lines\":%zu,\"matches\":%zu,\"read_ns\":%llu,\"search_ns\":%llu,"
+            "\"write_ns\":%llu,\"elapsed_ns\":%llu,\"gbps\":%.3f}\n",
+            stats->bytes, stats->lines, matches, (unsigned long long)stats->read_ns,
+            (unsigned long long)search_ns, (unsigned long long)stats->write_ns,
+            (unsigned long long)stats->elapsed_ns, stats_rate(stats->bytes, stats->elapsed_ns));
+
+    stats_t *all = opts->stats;
+    pthread_mutex_lock(&all->lock);
+    all->files++;
+    all->total.bytes += stats->bytes;
+    all->total.lines += stats->lines;
+    all->total.matches += matches;
+    all->total.read_ns += stats->read_ns;
+    all->total.write_ns += stats->write_ns;
+    all->total.elapsed_ns += stats->elapsed_ns;
+    pthread_mutex_unlock(&all->lock);
+}
+
+void stats_report_total(const stats_t *all) {
+    uint64_t wall_ns = stats_clock() - all->started;
+    const input_stats_t *t = &all->total;
+    uint64_t io_ns = t->read_ns + t->write_ns;
+    fprintf(stderr,
+            "{\"files\":%zu,\"bytes\":%zu,\"lines\":%zu,\"matches\":%zu,\"read_ns\":%llu,\"search_ns\":%llu,"
+            "\"write_ns\":%llu,\"wall_ns\":%llu,\"gbps\":%.3f}\n",
+            all->files, t->bytes, t->lines, t->matches, (unsigned long long)t->read_ns,
+            (unsigned long long)(t->elapsed_ns > io_ns ? t->elapsed_ns - io_ns : 0),
+            (unsigned long long)t->write_ns, (unsigned long long)wall_ns, stats_rate(t->bytes, wall_ns));
+}
+
+size_t match_limit(const options_t *opts) {
+    return opts->mode == OUTPUT_FILES && opts->max_count > 1 ? 1 : opts->max_count;
+}
+
+const input_pos_t input_start = {1, 0, 0, 0, 0, 0, 0};
+
+int input_done(const input_pos_t *pos, const options_t *opts) {
+    return pos->matches >= match_limit(opts) && pos->after_left == 0;
+}
+
+/**
+ * Input offset of a position in (or, within the history, before) a buffer.
+ */
+static size_t input_offset(const input_pos_t *pos, const char *buf, const char *p) {
+    return p >= buf ? pos->offset + (size_t)(p - buf) : pos->offset - (size_t)(buf - p);
+}
+
+/**
+ * @brief Output batch: (pointer, length) spans of matched lines that still live in the
+ * searched buffer. Spans are written together with writev, so a line is neither formatted
+ * nor copied; adjacent lines merge into one span. The buffer must stay valid until
+ * writer_flush. Only the -n/-b prefixes are formatted, into the writer's own label area;
+ * a file name prefix is a span pointing at the name.
+ */
+typedef struct {
+    FILE *output;         // Destination stream
+    int fd;               // Its descriptor, or -1 for streams without one (open_memstream)
+    struct iovec spans[WRITER_MAX_SPANS];
+    int count;
+    size_t bytes;
+    char labels[WRITER_LABEL_BYTES];
+    size_t labels_used;
+    const char *name;     // Prefixed to every line (with_filename), or NULL
+    size_t name_len;
+    input_stats_t *stats; // --stats: charged with the time spent writing, or NULL
+    int error;            // errno of the first failed write, 0 if none; later batches are dropped
+} writer_t;
+
+static void writer_init(writer_t *w, FILE *output, const options_t *opts) {
+    // Whatever stdio still buffers for this stream must go out before the batches
+    fflush(output);
+    w->stats = stats_current(opts);
+    w->output = output;
+    w->fd = fileno(output);
+    w->count = 0;
+    w->bytes = 0;
+    w->labels_used = 0;
+    w->error = 0;
+    w->name = opts->with_filename ? opts->name : NULL;
+    w->name_len = w->name != NULL ? strlen(w->name) : 0;
+}
+
+/**
+ * Writes all collected spans. Partial writes are resumed. A write error is kept in
+ * w->error, and nothing more is written, so that the output never has a hole in it.
+ * @return 0 if everything written so far went out, -1 with errno set otherwise.
+ */
+static int writer_flush(writer_t *w) {
+    struct iovec *iov = w->spans;
+    int count = w->error == 0 ? w->count : 0;
+    uint64_t start = w->stats != NULL && count > 0 ? stats_clock() : 0;
+
+    for (int i = 0; w->fd < 0 && i < count; i++) {
+        if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, w->output) != iov[i].iov_len) {
+            w->error = errno != 0 ? errno : EIO;
+            break;
+        }
+    }
+    while (w->fd >= 0 && count > 0) {
+        ssize_t written = writev(w->fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            w->error = errno;
+            break;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    if (start != 0) w->stats->write_ns += stats_clock() - start;
+    w->count = 0;
+    w->bytes = 0;
+    w->labels_used = 0;
+    if (w->error == 0) return 0;
+    errno = w->error;
+    return -1;
+}
+
+static void writer_add(writer_t *w, const char *data, size_t len) {
+    if (w->count > 0 && (const char *)w->spans[w->count - 1].iov_base + w->spans[w->count - 1].iov_len == data) {
+        w->spans[w->count - 1].iov_len += len;
+    } else {
+        if (w->count == WRITER_MAX_SPANS) writer_flush(w);
+        w->spans[w->count].iov_base = (void *)data;
+        w->spans[w->count].iov_len = len;
+        w->count++;
+    }
+    w->bytes += len;
+    if (w->bytes >= WRITER_FLUSH_BYTES) writer_flush(w);
+}
+
+/**
+ * Writes a number in decimal followed by a separator to dst.
+ * @return Number of characters written.
+ */
+static size_t format_label_field(char *dst, size_t value, char separator) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    for (size_t i = 0; i < n; i++) dst[i] = digits[n - 1 - i];
+    dst[n] = separator;
+    return n + 1;
+}
+
+/**
+ * Reports whether lines get a prefix (file name, -n or -b), so that each is written on its own.
+ */
+static int writer_labels(const writer_t *w, const options_t *opts) {
+    return w->name != NULL || opts->line_numbers || opts->byte_offsets;
+}
+
+/**
+ * Adds the file name/-n/-b prefix of a line; nothing if there is none.
+ * @param line The line number.
+ * @param offset The input offset of the line's first byte.
+ * @param separator ':' for a matching line, '-' for a context line.
+ */
+static void writer_add_label(writer_t *w, const options_t *opts, size_t line, size_t offset, char separator) {
+    if (!writer_labels(w, opts)) return;
+    // Room for the label and the line after it, so that writer_add does not flush between them
+    if (w->labels_used + LABEL_MAX > WRITER_LABEL_BYTES || w->count + 3 > WRITER_MAX_SPANS) writer_flush(w);
+
+    if (w->name != NULL) writer_add(w, w->name, w->name_len);
+    char *label = w->labels + w->labels_used;
+    size_t len = 0;
+    if (w->name != NULL) label[len++] = separator;
+    if (opts->line_numbers) len += format_label_field(label + len, line, separator);
+    if (opts->byte_offsets) len += format_label_field(label + len, offset, separator);
+    w->labels_used += len;
+    writer_add(w, label, len);
+}
+
+/**
+ * Writes up to max_lines context lines starting at `from`, stopping before `limit`.
+ * Without prefixes the lines go out as one span.
+ * @param line Number of the line at `from`; advanced past the lines written.
+ * @param offset Input offset of `from`.
+ * @param lines_written Receives the number of lines written.
+ * @return The end of the last line written.
+ */
+static const char *write_context(writer_t *w, const options_t *opts, const char *from, const char *limit,
+                                 size_t max_lines, size_t *line, size_t offset, size_t *lines_written) {
+    const char *p = from;
+    size_t n = 0;
+    while (n < max_lines && p < limit) {
+        const char *newline = memchr(p, '\n', (size_t)(limit - p));
+        const char *next = newline ? newline + 1 : limit;
+        if (writer_labels(w, opts)) {
+            writer_add_label(w, opts, *line + n, offset + (size_t)(p - from), '-');
+            writer_add(w, p, (size_t)(next - p));
+        }
+        p = next;
+        n++;
+    }
+    if (!writer_labels(w, opts) && p > from) writer_add(w, from, (size_t)(p - from));
+    *line += n;
+    *lines_written = n;
+    return p;
+}
+
+/**
+ * Writes the -B lines in front of a line that is about to be written, preceded by "--"
+ * if they do not continue the previous group, or start an input's output after groups of
+ * earlier inputs (opts->grouped). The lines are found by stepping back over
+ * newlines from line_start, never past `floor`, so no line is looked at twice.
+ * @param floor Earliest line start that may be written: just past the last line written,
+ * or the start of the kept history.
+ * @param line Number of the line at line_start.
+ * @param offset Input offset of line_start.
+ */
+static void write_before_context(writer_t *w, const options_t *opts, input_pos_t *state, const char *floor,
+                                 const char *line_start, size_t line, size_t offset) {
+    const char *start = line_start;
+    size_t count = 0;
+    while (count < opts->before && start > floor) {
+        const char *p = start - 1; // The previous line's '\n'
+        while (p > floor && p[-1] != '\n') p--;
+        start = p;
+        count++;
+    }
+
+    size_t start_offset = offset - (size_t)(line_start - start);
+    if (state->printed ? start_offset > state->printed_end : opts->grouped != NULL && *opts->grouped) {
+        writer_add(w, "--\n", 3);
+    }
+    if (opts->grouped != NULL) *opts->grouped = 1;
+    size_t first = line - count, written;
+    write_context(w, opts, start, line_start, count, &first, start_offset, &written);
+}
+
+size_t scan_buffer(const char *buf, size_t len, FILE *output, const matcher_t *m, const options_t *opts,
+                   input_pos_t *pos) {
+    if (matcher_prepare(m) == -1) return SIZE_MAX;
+    const char *end = buf + len;
+    const char *p = buf;
+    size_t matches = 0;
+    input_pos_t state = pos ? *pos : input_start;
+    size_t line = state.line;
+    const char *counted = buf; // Newlines before this point are included in `line`
+    int numbered = opts->mode == OUTPUT_LINES && opts->line_numbers;
+    int context = opts->mode == OUTPUT_LINES && opts->context;
+
+    // Context may reach back into the kept history, but not into lines already written
+    const char *floor = buf - state.history;
+    if (state.printed && state.printed_end > state.offset - state.history) {
+        floor = buf - (state.offset - state.printed_end);
+    }
+    size_t floor_line = state.line; // Number of the line at floor, known while after-context is owed
+    size_t limit = match_limit(opts);
+
+    writer_t writer;
+    if (opts->mode == OUTPUT_LINES) writer_init(&writer, output, opts);
+
+    while (p < end && state.matches < limit) {
+        size_t kw_len;
+        const char *hit = matcher_find(m, p, (size_t)(end - p), &kw_len);
+        if (hit == NULL) break;
+
+        const char *line_start = hit;
+        while (line_start > buf && line_start[-1] != '\n') line_start--;
+        const char *newline = memchr(hit, '\n', (size_t)(end - hit));
+        const char *line_end = newline ? newline + 1 : end;
+
+        // A keyword containing '\n' may span two lines here; the line-based search never sees that
+        if (hit + kw_len > line_end) {
+            p = hit + 1;
+            continue;
+        }
+
+        matches++;
+        state.matches++;
+        if (opts->mode == OUTPUT_LINES) {
+            if (numbered) {
+                line += search_count_byte(counted, (size_t)(line_start - counted), '\n');
+                counted = line_start;
+            }
+            size_t line_offset = input_offset(&state, buf, line_start);
+            if (context) {
+                if (state.after_left > 0) {
+                    // The previous match's after-context ends at this line at the latest
+                    size_t written;
+                    floor = write_context(&writer, opts, floor, line_start, state.after_left, &floor_line,
+                                          input_offset(&state, buf, floor), &written);
+                    state.after_left -= written;
+                    state.printed_end = input_offset(&state, buf, floor);
+                }
+                write_before_context(&writer, opts, &state, floor, line_start, line, line_offset);
+                floor = line_end;
+                floor_line = line + 1;
+                state.after_left = opts->after;
+                state.printed = 1;
+                state.printed_end = input_offset(&state, buf, line_end);
+            }
+            writer_add_label(&writer, opts, line, line_offset, ':');
+            writer_add(&writer, line_start, (size_t)(line_end - line_start));
+        }
+        p = line_end;
+    }
+    if (context && state.after_left > 0) {
+        size_t written;
+        floor = write_context(&writer, opts, floor, end, state.after_left, &floor_line,
+                              input_offset(&state, buf, floor), &written);
+        state.after_left -= written;
+        state.printed_end = input_offset(&state, buf, floor);
+    }
+    if (opts->mode == OUTPUT_LINES && writer_flush(&writer) == -1) return SIZE_MAX;
+
+    // With -m or -l, the rest of the input is never searched
+    int done = input_done(&state, opts);
+    const char *stop = !done ? end : context && floor > p ? floor : p;
+    input_stats_t *stats = stats_current(opts);
+    if (stats != NULL) stats_add_searched(stats, buf, (size_t)(stop - buf));
+    if (pos != NULL) {
+        if (done) {
+            state.offset = input_offset(&state, buf, stop);
+        } else {
+            if (numbered) state.line = line + search_count_byte(counted, (size_t)(end - counted), '\n');
+            state.offset += len;
+        }
+        *pos = state;
+    }
+    return matches;
+}
+
+size_t scan_range(const char *buf, size_t from, size_t to, FILE *output, const matcher_t *m,
+                  const options_t *opts, input_pos_t *pos) {
+    *pos = input_start;
+    pos->offset = from;
+    if (opts->mode == OUTPUT_LINES && opts->line_numbers) pos->line += search_count_byte(buf, from, '\n');
+    return scan_buffer(buf + from, to - from, output, m, opts, pos);
+}
+
+
+/**
+ * Copies the spilled beginning of a long line to the output, one block-sized window of
+ * the file at a time, and empties the spill file.
+ * @return 0 on success, -1 with errno set if the spill file cannot be read back or the
+ * output cannot be written.
+ */
+static int long_line_unspill(long_line_t *line, writer_t *writer) {
+    if (line->spilled == 0) return 0;
+    if (fflush(line->spill) == EOF) return -1;
+    for (size_t offset = 0; offset < line->spilled; offset += STREAM_BLOCK_SIZE) {
+        size_t len = line->spilled - offset < STREAM_BLOCK_SIZE ? line->spilled - offset : STREAM_BLOCK_SIZE;
+        char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(line->spill), (off_t)offset);
+        if (map == MAP_FAILED) return -1;
+        writer_add(writer, map, len);
+        int flushed = writer_flush(writer);
+        munmap(map, len);
+        if (flushed == -1) {
+            errno = writer->error;
+            return -1;
+        }
+    }
+    line->spilled = 0;
+    return 0;
+}
+
+/**
+ * Handles the next piece of a long line: the first len bytes of buf, of which the first
+ * line->kept were handled with the previous piece. The line ends at the first '\n', or
+ * with the piece if end_of_input is set.
+ * @param pos Position of the line's first byte and the input's context state; the -B
+ * history lies in front of buf. Advanced past the line when it ends.
+ * @param matches Incremented if the line ends and matches.
+ * @return Number of leading bytes the caller drops from the buffer. If the line goes on,
+ * that is all but line->kept bytes; otherwise it is the line up to and including its '\n'.
+ * SIZE_MAX with errno set if the spill file fails or the output cannot be written.
+ */
+static size_t long_line_feed(long_line_t *line, const char *buf, size_t len, int end_of_input, FILE *output,
+                             const matcher_t *m, const options_t *opts, input_pos_t *pos, size_t *matches) {
+    const char *newline = memchr(buf + line->kept, '\n', len - line->kept);
+    size_t text_end = newline ? (size_t)(newline - buf) : len;
+    size_t piece_end = newline ? text_end + 1 : len;
+    int ends = newline != NULL || end_of_input;
+    int was_matched = line->matched;
+    int context = opts->context;
+
+    // Past the -m limit, a line is only looked at as after-context
+    if (!line->matched && pos->matches < match_limit(opts)) {
+        if (m->regex != NULL && m->unicode_fold) {
+            // A character split by the piece border is folded with the next piece
+            dfa_cache_t *cache = matcher_dfa_cache(m);
+            const char *from = buf + line->kept - line->pending;
+            size_t from_len = (size_t)(buf + text_end - from);
+            size_t complete = ends ? from_len : fold_complete(from, from_len);
+            line->pending = from_len - complete;
+            regex_feed_folded(m, cache, &line->regex, from, complete);
+            line->matched = ends ? dfa_partial_end(cache, &line->regex) : line->regex.matched;
+        } else if (m->regex != NULL) {
+            dfa_cache_t *cache = matcher_dfa_cache(m);
+            dfa_partial_feed(cache, &line->regex, buf + line->kept, text_end - line->kept);
+            line->matched = ends ? dfa_partial_end(cache, &line->regex) : line->regex.matched;
+        } else {
+            size_t kw_len;
+            line->matched = matcher_find(m, buf, text_end, &kw_len) != NULL;
+        }
+    }
+    if (line->matched && opts->mode == OUTPUT_FILES) ends = 1; // -l needs no more of the line
+
+    // A line that does not match is still written if the last match owes it as context
+    int owed = pos->after_left > 0;
+    if (opts->mode == OUTPUT_LINES && (line->matched || (ends && owed) || !ends)) {
+        const char *fresh = buf + line->kept;
+        size_t fresh_len = piece_end - line->kept;
+        if (line->matched || ends) {
+            writer_t writer;
+            writer_init(&writer, output, opts);
+            if (!was_matched) {
+                if (context && line->matched) {
+                    const char *floor = buf - pos->history;
+                    if (pos->printed && pos->printed_end > pos->offset - pos->history) {
+                        floor = buf - (pos->offset - pos->printed_end);
+                    }
+                    write_before_context(&writer, opts, pos, floor, buf, pos->line, pos->offset);
+                }
+                writer_add_label(&writer, opts, pos->line, pos->offset, line->matched ? ':' : '-');
+            }
+            if (long_line_unspill(line, &writer) == -1) return SIZE_MAX;
+            writer_add(&writer, fresh, fresh_len);
+            if (writer_flush(&writer) == -1) return SIZE_MAX;
+        } else {
+            if (line->spill == NULL && (line->spill = tmpfile()) == NULL) return SIZE_MAX;
+            if (fwrite(fresh, 1, fresh_len, line->spill) != fresh_len) return SIZE_MAX;
+            line->spilled += fresh_len;
+        }
+    }
+
+    input_stats_t *stats = stats_current(opts);
+    if (stats != NULL) stats_add_searched(stats, buf + line->kept, piece_end - line->kept);
+
+    if (!ends) {
+        size_t keep = line->pending > matcher_overlap(m) ? line->pending : matcher_overlap(m);
+        if (keep > len) keep = len;
+        line->kept = keep;
+        line->consumed += len - keep;
+        return len - keep;
+    }
+
+    if (line->matched) {
+        (*matches)++;
+        pos->matches++;
+    }
+    if (line->spill != NULL) {
+        // Only the space is given back; the file is reused by the next long line
+        if (ftruncate(fileno(line->spill), 0) == -1) return SIZE_MAX;
+        rewind(line->spill);
+        line->spilled = 0;
+    }
+    size_t line_len = line->consumed + piece_end;
+    if (opts->mode == OUTPUT_LINES && context && (line->matched || owed)) {
+        pos->after_left = line->matched ? opts->after : pos->after_left - 1;
+        pos->printed = 1;
+        pos->printed_end = pos->offset + line_len;
+    }
+    pos->line++;
+    pos->offset += line_len;
+    line->active = 0;
+    return piece_end;
+}
+
+/**
+ * Start of the -B history to keep after searching buf[0, end): the last `lines` complete
+ * lines, as far as they fit into `limit` bytes.
+ */
+static size_t history_start(const char *buf, size_t end, size_t lines, size_t limit) {
+    size_t start = end;
+    for (size_t n = 0; n < lines && start > 0; n++) {
+        size_t p = start - 1; // The previous line's '\n'
+        while (p > 0 && buf[p - 1] != '\n') p--;
+        if (end - p > limit) break;
+        start = p;
+    }
+    return start;
+}
+
+
+int stream_init(stream_t *s, const matcher_t *m) {
+    memset(s, 0, sizeof(*s));
+    s->capacity = STREAM_BLOCK_SIZE + matcher_overlap(m);
+    s->pos = input_start;
+    s->buf = malloc(s->capacity);
+    return s->buf != NULL ? 0 : -1;
+}
+
+void stream_free(stream_t *s) {
+    if (s->line.spill != NULL) fclose(s->line.spill);
+    free(s->buf);
+}
+
+ssize_t stream_read(stream_t *s, int fd, FILE *output, const matcher_t *m, const options_t *opts) {
+    size_t history_lines = opts->mode == OUTPUT_LINES ? opts->before : 0;
+    char *buf = s->buf;
+    if (input_done(&s->pos, opts)) return 0;
+    if (matcher_prepare(m) == -1) return -1;
+
+    input_stats_t *stats = stats_current(opts);
+    uint64_t start = stats != NULL ? stats_clock() : 0;
+    ssize_t got;
+    do {
+        got = read(fd, buf + s->used, s->capacity - s->used);
+    } while (got < 0 && errno == EINTR);
+    if (stats != NULL) stats->read_ns += stats_clock() - start;
+    if (got <= 0) return got;
+    s->used += (size_t)got;
+
+    // Bytes before `searched` hold no newline; bytes before `used` have all been read
+    while (!input_done(&s->pos, opts)) {
+        size_t history = s->pos.history;
+        if (s->line.active) {
+            size_t done = long_line_feed(&s->line, buf + history, s->used - history, 0, output, m, opts, &s->pos,
+                                         &s->matches);
+            if (done == SIZE_MAX) return -1;
+            memmove(buf + history, buf + history + done, s->used - history - done);
+            s->used -= done;
+            if (s->line.active) {
+                s->searched = s->used;
+                break;
+            }
+            // Lines before a long one are of no use as history any more
+            memmove(buf, buf + history, s->used - history);
+            s->used -= history;
+            s->pos.history = 0;
+            s->searched = 0;
+            continue;
+        }
+
+        size_t complete = s->used;
+        while (complete > s->searched && buf[complete - 1] != '\n') complete--;
+        if (complete > s->searched) {
+            size_t found = scan_buffer(buf + history, complete - history, output, m, opts, &s->pos);
+            if (found == SIZE_MAX) return -1;
+            s->matches += found;
+            size_t keep = history_start(buf, complete, history_lines, STREAM_BLOCK_SIZE / 2);
+            memmove(buf, buf + keep, s->used - keep);
+            s->used -= keep;
+            s->pos.history = complete - keep;
+        }
+        s->searched = s->used;
+        if (s->used < s->capacity) break;
+
+        // Apart from the history, the block holds a single unfinished line
+        s->line.active = 1;
+        s->line.matched = 0;
+        s->line.kept = 0;
+        s->line.consumed = 0;
+        s->line.pending = 0;
+        dfa_partial_begin(&s->line.regex);
+    }
+    return got;
+}
+
+int stream_finish(stream_t *s, FILE *output, const matcher_t *m, const options_t *opts) {
+    size_t found = 0;
+    if (!input_done(&s->pos, opts)) {
+        if (matcher_prepare(m) == -1) {
+            found = SIZE_MAX;
+        } else if (s->line.active) {
+            found = long_line_feed(&s->line, s->buf + s->pos.history, s->used - s->pos.history, 1, output, m, opts,
+                                   &s->pos, &s->matches);
+        } else if (s->used > s->pos.history) {
+            found = scan_buffer(s->buf + s->pos.history, s->used - s->pos.history, output, m, opts, &s->pos);
+            if (found != SIZE_MAX) s->matches += found;
+        }
+    }
+    s->used = 0;
+    s->searched = 0;
+    s->pos = input_start;
+    s->line.active = 0;
+    return found == SIZE_MAX ? -1 : 0;
+}
+
+size_t process_stream(int fd, FILE *output, const matcher_t *m, const options_t *opts) {
+    stream_t s;
+    if (stream_init(&s, m) == -1) return SIZE_MAX;
+    ssize_t got;
+    while ((got = stream_read(&s, fd, output, m, opts)) > 0) continue;
+    if (got == -1) {
+        int saved = errno;
+        stream_free(&s);
+        errno = saved;
+        return SIZE_MAX;
+    }
+    if (input_done(&s.pos, opts)) {
+        // Ended early: a regular file's read-ahead past this point is of no use. Pipes
+        // have no offset and are left alone
+        off_t at = lseek(fd, 0, SEEK_CUR);
+        if (at != -1) posix_fadvise(fd, at, 0, POSIX_FADV_DONTNEED);
+    }
+    int rc = stream_finish(&s, output, m, opts);
+    int saved = errno;
+    size_t matches = rc == 0 ? s.matches : SIZE_MAX;
+    stream_free(&s);
+    errno = saved;
+    return matches;
+}
+
+void report_input(FILE *output, const char *name, size_t matches, const options_t *opts) {
+    if (opts->mode == OUTPUT_COUNT) {
+        if (opts->with_filename) fprintf(output, "%s:", name);
+        fprintf(output, "%zu\n", matches);
+    } else if (opts->mode == OUTPUT_FILES && matches > 0) {
+        fprintf(output, "%s\n", name);
+    }
+}
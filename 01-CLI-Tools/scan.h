@@ -0,0 +1,265 @@
+/**
+ * @file scan.h
+ * @brief Line-oriented search of libmygrep: runs a compiled matcher_t over a buffer or a
+ * stream and writes the matching lines grep-style, with line numbers, byte offsets,
+ * context lines, counts, match limits and per-input statistics as options_t selects.
+ * Buffers are searched in place and matching lines are written straight from them with
+ * writev; streams are read through a fixed-size block, however long their lines are.
+ * All functions are thread-safe as long as each thread writes to its own output stream.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "matcher.h"
+#include "dfa.h"
+#include "window.h"
+
+typedef enum {
+    OUTPUT_LINES,  // Print every matching line
+    OUTPUT_COUNT,  // -c: print the number of matching lines per input
+    OUTPUT_FILES   // -l: print the name of each input with a match
+} output_mode_t;
+
+/**
+ * @brief What searching one input took (--stats). Elapsed time is summed over the
+ * stretches in which a thread worked on the input; search time is what reads and writes
+ * leave of it, so page faults of a mapped file count as search.
+ */
+typedef struct {
+    size_t bytes;         // Bytes searched (with -m or -l: up to where the search stopped)
+    size_t lines;         // Newlines among them
+    size_t matches;
+    uint64_t read_ns;     // In read() and mmap()
+    uint64_t write_ns;    // Writing matching lines (in parallel mode: into the job buffer)
+    uint64_t elapsed_ns;
+    uint64_t entered;     // Clock at stats_enter
+} input_stats_t;
+
+/**
+ * @brief Statistics collection for --stats, shared by all threads.
+ */
+typedef struct {
+    pthread_key_t current;   // The input_stats_t of the input each thread works on, if any
+    pthread_mutex_t lock;    // Guards the totals
+    input_stats_t total;
+    size_t files;
+    uint64_t started;        // Clock when the search began
+} stats_t;
+
+/**
+ * @brief How results are reported, fixed by the command line.
+ */
+typedef struct {
+    output_mode_t mode;
+    int with_filename;    // Prefix each line and count with the input's name (several input files, -r or -H)
+    int line_numbers;     // -n: prefix each line with its line number
+    int byte_offsets;     // -b: prefix each line with the byte offset of its start
+    size_t before;        // -B: context lines written before each match
+    size_t after;         // -A: context lines written after each match
+    int context;          // Set by -A/-B/-C (even with 0 lines): groups are separated by "--"
+    size_t max_count;     // -m: matching lines after which an input is abandoned (SIZE_MAX: no limit)
+    stats_t *stats;       // --stats: where statistics are collected, or NULL
+    const time_window_t *window; // --since/--until: only lines in this window are searched, or NULL
+    const char *name;     // With with_filename: name of the input being searched (set per input)
+    int *grouped;         // With -A/-B/-C: set once a group is written, so the next input's first
+                          // group is separated by "--" too (NULL: inputs are not separated)
+} options_t;
+
+
+/**
+ * @brief Where a buffer starts within its input, so that -n and -b can report positions
+ * relative to the whole input, and the context state carried from one buffer of an input
+ * to the next. Searching a buffer advances it to the buffer's end, or, once -m has ended
+ * the input, to where the search stopped.
+ */
+typedef struct {
+    size_t line;          // Number of the buffer's first line, counting from 1
+    size_t offset;        // Input offset of the buffer's first byte
+    size_t history;       // -B: bytes of earlier lines kept in memory right before the buffer
+    size_t after_left;    // -A: context lines still owed to the last match
+    size_t printed_end;   // Input offset just past the last line written (with -A/-B)
+    int printed;          // Some line of the input has been written (with -A/-B)
+    size_t matches;       // Matching lines of the input so far (for -m)
+} input_pos_t;
+
+
+extern const input_pos_t input_start; // A new input: line 1, offset 0
+
+/**
+ * @brief A line that does not fit into the stream buffer, searched piece by piece as it
+ * arrives. Only the last overlap bytes of a piece stay in the buffer. Until the line is
+ * known to match, its pieces are spilled to a temporary file (normal output only); the
+ * spilled part is written once a match is found, and later pieces go out directly.
+ */
+typedef struct {
+    int active;           // The buffer holds the continuation of a long line
+    int matched;
+    size_t kept;          // Leading buffer bytes that were already handled with the last piece
+    size_t consumed;      // Bytes of the line already dropped from the buffer
+    dfa_partial_t regex;  // With -E: DFA state at the end of the last piece
+    size_t pending;       // With -E and Unicode folding: kept bytes of a character split by the last piece
+    FILE *spill;          // Created on first use and emptied after every long line
+    size_t spilled;
+} long_line_t;
+
+/**
+ * @brief A stream being searched block by block (see process_stream). The state lives
+ * between reads, so --follow can search a file's appended bytes whenever they arrive.
+ */
+typedef struct {
+    char *buf;
+    size_t capacity;
+    size_t used;          // Bytes in buf
+    size_t searched;      // Bytes before this point hold no newline; the rest is unread by the search
+    size_t matches;
+    input_pos_t pos;      // pos.history: bytes at the front of buf kept for -B
+    long_line_t line;
+} stream_t;
+
+/**
+ * @brief Prepares statistics collection for --stats; the clock of the whole search starts.
+ * @return 0 on success, -1 if the thread key cannot be created.
+ */
+int stats_init(stats_t *all);
+
+void stats_destroy(stats_t *all);
+
+/**
+ * @brief Monotonic clock in nanoseconds.
+ */
+uint64_t stats_clock(void);
+
+/**
+ * @brief The statistics of the input the calling thread works on, or NULL without --stats.
+ */
+input_stats_t *stats_current(const options_t *opts);
+
+/**
+ * @brief Charges the calling thread's work to an input until stats_leave. An input may be
+ * entered several times (--follow); its statistics start zeroed.
+ */
+void stats_enter(const options_t *opts, input_stats_t *stats);
+
+void stats_leave(const options_t *opts, input_stats_t *stats);
+
+/**
+ * @brief Writes the statistics of a finished input as one line of JSON and adds them to
+ * the totals.
+ * @param errors Where the line goes: stderr, or the job's error buffer in parallel mode,
+ * which keeps the records in input order.
+ * @param name The file name, or "(standard input)".
+ */
+void stats_report(const options_t *opts, FILE *errors, const char *name, const input_stats_t *stats,
+                  size_t matches);
+
+/**
+ * @brief Writes the totals over all inputs to stderr as the last line of JSON. Per-input
+ * times are summed (so they exceed the wall time with -j); the rate is over the wall time.
+ */
+void stats_report_total(const stats_t *all);
+
+/**
+ * @brief Matching lines after which the rest of an input is not searched: -m, or the first
+ * one for -l.
+ */
+size_t match_limit(const options_t *opts);
+
+/**
+ * @brief The input has reached its match limit and owes no more after-context.
+ */
+int input_done(const input_pos_t *pos, const options_t *opts);
+
+/**
+ * @brief Searches a complete buffer (e.g. a memory-mapped file) and writes every matching line.
+ * Newlines are only located around matches, and lines are written straight from the buffer
+ * in writev batches.
+ * With -c nothing is written, and with -l the scan stops at the first matching line.
+ * With -m the scan stops at the limit; the after-context of the last match is still
+ * written, and matching lines within it are written as context.
+ * For -n, the newlines between one match and the next are counted in bulk with
+ * search_count_byte, so lines without a match are never stepped through one by one.
+ * With -A/-B, context lines are located from the match outward; a group that reaches the
+ * previous one continues it, and lines already written are never revisited.
+ * @param buf The buffer holding the whole input.
+ * @param len Number of bytes in the buffer.
+ * @param output The output file stream (or stdout).
+ * @param m The compiled patterns.
+ * @param opts The reporting options.
+ * @param pos Position of buf within its input (-n, -b) and context state, advanced to the
+ * end of buf; NULL if buf is a whole input, which spares counting the lines after the last
+ * match.
+ * @return Number of matching lines found, or SIZE_MAX with errno set if the search state
+ * cannot be allocated (see matcher_prepare) or the output cannot be written (nothing is
+ * written after the failed batch); pos is then unchanged.
+ */
+size_t scan_buffer(const char *buf, size_t len, FILE *output, const matcher_t *m, const options_t *opts,
+                   input_pos_t *pos);
+
+/**
+ * @brief Searches the bytes [from, to) of a whole input held in memory with scan_buffer,
+ * e.g. the lines of a time window found by window_range. from must be the start of a line.
+ * Line numbers and byte offsets count from the start of buf; context lines stay inside
+ * the range.
+ * @param pos Receives the position where the search ended.
+ * @return Number of matching lines found, or SIZE_MAX with errno set as for scan_buffer.
+ */
+size_t scan_range(const char *buf, size_t from, size_t to, FILE *output, const matcher_t *m,
+                  const options_t *opts, input_pos_t *pos);
+
+/**
+ * @brief Prepares a stream for a new input.
+ * @return 0 on success, -1 with errno set if memory runs out.
+ */
+int stream_init(stream_t *s, const matcher_t *m);
+
+void stream_free(stream_t *s);
+
+/**
+ * @brief Reads once from fd into the block and searches the complete lines that arrived;
+ * an unfinished last line waits for the next read.
+ * @return The read() result: bytes read, 0 at the end of the input (or once -l or -m has
+ * ended it), -1 with errno set if reading, searching or writing fails (out of memory, or a
+ * long line's spill file). After an error the stream can only be freed.
+ */
+ssize_t stream_read(stream_t *s, int fd, FILE *output, const matcher_t *m, const options_t *opts);
+
+/**
+ * @brief Searches the unfinished last line of the input, then empties the stream so that
+ * it starts over as a new input (line 1, offset 0). The match count is kept.
+ * @return 0 on success, -1 with errno set if searching fails.
+ */
+int stream_finish(stream_t *s, FILE *output, const matcher_t *m, const options_t *opts);
+
+/**
+ * @brief Searches a stream (pipe, stdin, special file) that cannot be mapped. The stream is read
+ * into a fixed block, and the complete lines of each block are searched with scan_buffer,
+ * so matching lines are written straight from the block. An unfinished last line is
+ * carried over into the next block. read() returns whatever a pipe holds, so lines from
+ * a slow producer are still reported as they arrive.
+ * A line that fills the whole block is searched in pieces (see long_line_t), so memory
+ * stays bounded by the block size however long a line is.
+ * With -B, the last lines of a searched block stay in front of the next one as history
+ * for its before-context, up to half a block; a long line is then searched in pieces of
+ * the rest of the block.
+ * @param fd The input descriptor (or stdin's).
+ * @param output The output file stream (or stdout).
+ * @param m The compiled patterns.
+ * @param opts The reporting options.
+ * @return Number of matching lines (with -l: 1 as soon as a match is found; with -m: at
+ * most its limit), or SIZE_MAX with errno set if reading, searching or writing fails.
+ */
+size_t process_stream(int fd, FILE *output, const matcher_t *m, const options_t *opts);
+
+/**
+ * @brief Writes the per-input result of -c or -l; nothing for normal output.
+ * @param name The file name, or "(standard input)".
+ */
+void report_input(FILE *output, const char *name, size_t matches, const options_t *opts);
+
+#endif
@@ -0,0 +1,796 @@
+/**
+ * @file search.c
+ * @brief Literal substring search kernels with runtime CPU dispatch.
+ * The vector kernels compare the first and the last needle byte against 16/32/64
+ * consecutive haystack positions at once. Only positions where both bytes agree are
+ * verified with memcmp, which rejects almost all candidates for real-world text.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "search.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+// Algorithm selection in search_plan_init; see `make bench` (bench_search) for the numbers.
+// Keywords shorter than SIMD_MIN_SKIP_NEEDLE always use the vector scan. From there on,
+// Horspool wins over the scalar kernel at once and over SSE2 from about 128 bytes, while
+// the AVX2/AVX-512 scans stay ahead at every measured length. Keywords that repeat a short
+// unit (e.g. "=========") risk a quadratic search: on similar input every position passes
+// the first/last byte filter and Horspool's skips collapse. They keep the vector scan, which
+// is 20 times faster than Two-Way on ordinary text, but as in glibc's memmem the scan gives
+// way to Two-Way once failed verifications have compared more than GUARD_WORK_FACTOR bytes
+// per byte scanned (plus GUARD_WORK_SLACK), which keeps the search linear.
+#define SIMD_MIN_SKIP_NEEDLE 16
+#define HORSPOOL_MIN_NEEDLE_SCALAR 16
+#define HORSPOOL_MIN_NEEDLE_SSE2 128
+#define TWO_WAY_MIN_REPEATS 4
+#define GUARD_WORK_FACTOR 4
+#define GUARD_WORK_SLACK 4096
+
+/**
+ * Portable kernel: memchr skips to candidates for the first byte, memcmp verifies the rest.
+ */
+const char *search_scalar(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    if (needle_len == 0) return hay;
+    if (hay_len < needle_len) return NULL;
+
+    const char *last = hay + (hay_len - needle_len);
+    const char *p = hay;
+    while (p <= last && (p = memchr(p, needle[0], (size_t)(last - p) + 1)) != NULL) {
+        if (memcmp(p + 1, needle + 1, needle_len - 1) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * ASCII lowercase table. Only 'A'-'Z' are folded, which matches tolower() in the C locale.
+ */
+static unsigned char fold_table[256];
+
+static inline unsigned char fold_byte(char c) {
+    return fold_table[(unsigned char)c];
+}
+
+/**
+ * Compares two byte ranges with ASCII case folded on the haystack side.
+ * The needle is expected to be lowercase already.
+ */
+static inline int equal_folded(const char *hay, const char *needle_lower, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (fold_byte(hay[i]) != (unsigned char)needle_lower[i]) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Portable case-insensitive kernel: checks the folded first and last byte before the middle.
+ */
+const char *search_scalar_ci(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    if (needle_len == 0) return hay;
+    if (hay_len < needle_len) return NULL;
+
+    unsigned char first = fold_byte(needle[0]);
+    unsigned char last = fold_byte(needle[needle_len - 1]);
+    const char *end = hay + (hay_len - needle_len);
+    for (const char *p = hay; p <= end; p++) {
+        if (fold_byte(p[0]) == first && fold_byte(p[needle_len - 1]) == last &&
+            equal_folded(p + 1, needle + 1, needle_len - 1)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+#ifdef SEARCH_X86
+
+/*
+ * Case folding inside the vector kernels: for a letter, OR-ing 0x20 into the haystack byte
+ * maps both cases to lowercase, so (block | 0x20) == lower catches 'a' and 'A' in one compare.
+ * 'A'-'Z' and 'a'-'z' are the only bytes that land on a lowercase letter this way, so the
+ * compare stays exact. Non-letter needle bytes use mask 0 and are compared as they are.
+ */
+static inline unsigned char fold_mask(char c) {
+    unsigned char lower = fold_byte(c);
+    return (lower >= 'a' && lower <= 'z') ? 0x20 : 0x00;
+}
+
+/**
+ * Verifies every candidate bit of a first/last byte mask starting at hay + i.
+ * Returns the first confirmed match or NULL if all candidates were false positives.
+ */
+static inline const char *verify_mask(const char *hay, size_t i, unsigned long long mask,
+                                      const char *needle, size_t needle_len, int fold) {
+    while (mask != 0) {
+        unsigned bit = (unsigned)__builtin_ctzll(mask);
+        const char *cand = hay + i + bit;
+        // First and last byte already matched, only the middle is left to compare
+        if (needle_len <= 2) return cand;
+        if (fold ? equal_folded(cand + 1, needle + 1, needle_len - 2)
+                 : memcmp(cand + 1, needle + 1, needle_len - 2) == 0) {
+            return cand;
+        }
+        mask &= mask - 1;
+    }
+    return NULL;
+}
+
+/**
+ * Charges failed candidates to a guarded scan (see GUARD_WORK_FACTOR).
+ * @param work Bytes compared by failed verifications so far; each is counted at the needle length.
+ * @param scanned Haystack bytes scanned so far.
+ * @return 1 once the scan should hand over to Two-Way.
+ */
+static inline int guard_exhausted(size_t *work, size_t scanned, size_t needle_len, size_t failed) {
+    *work += failed * needle_len;
+    return *work > scanned * GUARD_WORK_FACTOR + GUARD_WORK_SLACK;
+}
+
+__attribute__((target("sse2")))
+static inline const char *scan_sse2(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                    int fold, const char **resume) {
+    const search_fn tail = fold ? search_scalar_ci : search_scalar;
+    if (needle_len < 2 || hay_len < needle_len) return tail(hay, hay_len, needle, needle_len);
+
+    const __m128i first = _mm_set1_epi8(fold ? (char)fold_byte(needle[0]) : needle[0]);
+    const __m128i last = _mm_set1_epi8(fold ? (char)fold_byte(needle[needle_len - 1]) : needle[needle_len - 1]);
+    const __m128i first_mask = _mm_set1_epi8((char)(fold ? fold_mask(needle[0]) : 0));
+    const __m128i last_mask = _mm_set1_epi8((char)(fold ? fold_mask(needle[needle_len - 1]) : 0));
+    size_t i = 0;
+    size_t work = 0; // With resume: bytes compared by failed verifications
+
+    for (; i + needle_len - 1 + 16 <= hay_len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(hay + i + needle_len - 1));
+        if (fold) {
+            block_first = _mm_or_si128(block_first, first_mask);
+            block_last = _mm_or_si128(block_last, last_mask);
+        }
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last));
+        unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+        if (mask != 0) {
+            const char *found = verify_mask(hay, i, mask, needle, needle_len, fold);
+            if (found) return found;
+            if (resume != NULL && guard_exhausted(&work, i, needle_len, (size_t)__builtin_popcount(mask))) {
+                *resume = hay + i + 16;
+                return NULL;
+            }
+        }
+    }
+    // Positions from i onward are too close to the end for a full vector load
+    return tail(hay + i, hay_len - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static inline const char *scan_avx2(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                    int fold, const char **resume) {
+    const search_fn tail = fold ? search_scalar_ci : search_scalar;
+    if (needle_len < 2 || hay_len < needle_len) return tail(hay, hay_len, needle, needle_len);
+
+    const __m256i first = _mm256_set1_epi8(fold ? (char)fold_byte(needle[0]) : needle[0]);
+    const __m256i last = _mm256_set1_epi8(fold ? (char)fold_byte(needle[needle_len - 1]) : needle[needle_len - 1]);
+    const __m256i first_mask = _mm256_set1_epi8((char)(fold ? fold_mask(needle[0]) : 0));
+    const __m256i last_mask = _mm256_set1_epi8((char)(fold ? fold_mask(needle[needle_len - 1]) : 0));
+    size_t i = 0;
+    size_t work = 0; // With resume: bytes compared by failed verifications
+
+    for (; i + needle_len - 1 + 32 <= hay_len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(hay + i + needle_len - 1));
+        if (fold) {
+            block_first = _mm256_or_si256(block_first, first_mask);
+            block_last = _mm256_or_si256(block_last, last_mask);
+        }
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(eq);
+        if (mask != 0) {
+            const char *found = verify_mask(hay, i, mask, needle, needle_len, fold);
+            if (found) return found;
+            if (resume != NULL && guard_exhausted(&work, i, needle_len, (size_t)__builtin_popcount(mask))) {
+                *resume = hay + i + 32;
+                return NULL;
+            }
+        }
+    }
+    // Positions from i onward are too close to the end for a full vector load
+    return tail(hay + i, hay_len - i, needle, needle_len);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static inline const char *scan_avx512(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                      int fold, const char **resume) {
+    const search_fn tail = fold ? search_scalar_ci : search_scalar;
+    if (needle_len < 2 || hay_len < needle_len) return tail(hay, hay_len, needle, needle_len);
+
+    const __m512i first = _mm512_set1_epi8(fold ? (char)fold_byte(needle[0]) : needle[0]);
+    const __m512i last = _mm512_set1_epi8(fold ? (char)fold_byte(needle[needle_len - 1]) : needle[needle_len - 1]);
+    const __m512i first_mask = _mm512_set1_epi8((char)(fold ? fold_mask(needle[0]) : 0));
+    const __m512i last_mask = _mm512_set1_epi8((char)(fold ? fold_mask(needle[needle_len - 1]) : 0));
+    size_t i = 0;
+    size_t work = 0; // With resume: bytes compared by failed verifications
+
+    for (; i + needle_len - 1 + 64 <= hay_len; i += 64) {
+        __m512i block_first = _mm512_loadu_si512((const void *)(hay + i));
+        __m512i block_last = _mm512_loadu_si512((const void *)(hay + i + needle_len - 1));
+        if (fold) {
+            block_first = _mm512_or_si512(block_first, first_mask);
+            block_last = _mm512_or_si512(block_last, last_mask);
+        }
+        __mmask64 mask = _mm512_cmpeq_epi8_mask(first, block_first) & _mm512_cmpeq_epi8_mask(last, block_last);
+        if (mask != 0) {
+            const char *found = verify_mask(hay, i, (unsigned long long)mask, needle, needle_len, fold);
+            if (found) return found;
+            if (resume != NULL && guard_exhausted(&work, i, needle_len, (size_t)__builtin_popcountll(mask))) {
+                *resume = hay + i + 64;
+                return NULL;
+            }
+        }
+    }
+    // Positions from i onward are too close to the end for a full vector load
+    return tail(hay + i, hay_len - i, needle, needle_len);
+}
+
+__attribute__((target("sse2")))
+static const char *search_sse2_impl(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    return scan_sse2(hay, hay_len, needle, needle_len, 0, NULL);
+}
+
+__attribute__((target("sse2")))
+static const char *search_sse2_ci_impl(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    return scan_sse2(hay, hay_len, needle, needle_len, 1, NULL);
+}
+
+__attribute__((target("avx2")))
+static const char *search_avx2_impl(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    return scan_avx2(hay, hay_len, needle, needle_len, 0, NULL);
+}
+
+__attribute__((target("avx2")))
+static const char *search_avx2_ci_impl(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    return scan_avx2(hay, hay_len, needle, needle_len, 1, NULL);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static const char *search_avx512_impl(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    return scan_avx512(hay, hay_len, needle, needle_len, 0, NULL);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static const char *search_avx512_ci_impl(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    return scan_avx512(hay, hay_len, needle, needle_len, 1, NULL);
+}
+
+/*
+ * Byte counting: compare-equal gives one mask bit per matching byte, and popcnt adds them
+ * up. 64 bytes are combined into one mask per popcnt, so the loop is bound by memory
+ * bandwidth rather than by the count of matches. mygrep -n counts the short gaps between
+ * matches, so the tail is done with one overlapping vector instead of a byte loop.
+ */
+__attribute__((target("sse2")))
+static inline uint64_t eq_mask_sse2(const char *p, __m128i b) {
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), b));
+}
+
+__attribute__((target("sse2,popcnt")))
+static size_t count_byte_sse2(const char *buf, size_t len, char byte) {
+    const __m128i b = _mm_set1_epi8(byte);
+    size_t count = 0, i = 0;
+    if (len < 16) {
+        for (; i < len; i++) count += buf[i] == byte;
+        return count;
+    }
+    for (; i + 64 <= len; i += 64) {
+        uint64_t mask = eq_mask_sse2(buf + i, b) | eq_mask_sse2(buf + i + 16, b) << 16 |
+                        eq_mask_sse2(buf + i + 32, b) << 32 | eq_mask_sse2(buf + i + 48, b) << 48;
+        count += (size_t)__builtin_popcountll(mask);
+    }
+    for (; i + 16 <= len; i += 16) count += (size_t)__builtin_popcountll(eq_mask_sse2(buf + i, b));
+    // The last 16 bytes overlap what was counted; only their top len - i bits are new
+    if (i < len) count += (size_t)__builtin_popcountll(eq_mask_sse2(buf + len - 16, b) >> (16 - (len - i)));
+    return count;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t eq_mask_avx2(const char *p, __m256i b) {
+    return (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), b));
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_byte_avx2(const char *buf, size_t len, char byte) {
+    if (len < 32) return count_byte_sse2(buf, len, byte);
+    const __m256i b = _mm256_set1_epi8(byte);
+    size_t count = 0, i = 0;
+    for (; i + 128 <= len; i += 128) {
+        uint64_t lo = eq_mask_avx2(buf + i, b) | eq_mask_avx2(buf + i + 32, b) << 32;
+        uint64_t hi = eq_mask_avx2(buf + i + 64, b) | eq_mask_avx2(buf + i + 96, b) << 32;
+        count += (size_t)__builtin_popcountll(lo) + (size_t)__builtin_popcountll(hi);
+    }
+    for (; i + 32 <= len; i += 32) count += (size_t)__builtin_popcountll(eq_mask_avx2(buf + i, b));
+    if (i < len) count += (size_t)__builtin_popcountll(eq_mask_avx2(buf + len - 32, b) >> (32 - (len - i)));
+    return count;
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static size_t count_byte_avx512(const char *buf, size_t len, char byte) {
+    const __m512i b = _mm512_set1_epi8(byte);
+    size_t count = 0, i = 0;
+    for (; i + 128 <= len; i += 128) {
+        uint64_t lo = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)(buf + i)), b);
+        uint64_t hi = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)(buf + i + 64)), b);
+        count += (size_t)__builtin_popcountll(lo) + (size_t)__builtin_popcountll(hi);
+    }
+    for (; i < len; i += 64) {
+        // Masked-off bytes are not read, so the last load cannot run past the buffer
+        size_t rest = len - i;
+        __mmask64 k = rest >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << rest) - 1;
+        uint64_t mask = _mm512_mask_cmpeq_epi8_mask(k, _mm512_maskz_loadu_epi8(k, buf + i), b);
+        count += (size_t)__builtin_popcountll(mask);
+    }
+    return count;
+}
+
+/*
+ * ASCII spans: every byte of a multibyte UTF-8 character has its top bit set, which
+ * movemask collects directly. 64 bytes are ORed together per test, and the vector that
+ * breaks the run is located exactly afterwards.
+ */
+__attribute__((target("sse2")))
+static size_t ascii_span_sse2(const char *buf, size_t len) {
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i *)(buf + i)),
+                                                _mm_loadu_si128((const __m128i *)(buf + i + 16))),
+                                   _mm_or_si128(_mm_loadu_si128((const __m128i *)(buf + i + 32)),
+                                                _mm_loadu_si128((const __m128i *)(buf + i + 48))));
+        if (_mm_movemask_epi8(any) != 0) break;
+    }
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(buf + i)));
+        if (mask != 0) return i + (size_t)__builtin_ctz(mask);
+    }
+    for (; i < len; i++) {
+        if ((unsigned char)buf[i] >= 0x80) return i;
+    }
+    return len;
+}
+
+__attribute__((target("avx2")))
+static size_t ascii_span_avx2(const char *buf, size_t len) {
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i any = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256((const __m256i *)(buf + i)),
+                                                      _mm256_loadu_si256((const __m256i *)(buf + i + 32))),
+                                      _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(buf + i + 64)),
+                                                      _mm256_loadu_si256((const __m256i *)(buf + i + 96))));
+        if (_mm256_movemask_epi8(any) != 0) break;
+    }
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)));
+        if (mask != 0) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + ascii_span_sse2(buf + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t ascii_span_avx512(const char *buf, size_t len) {
+    for (size_t i = 0; i < len; i += 64) {
+        size_t rest = len - i;
+        __mmask64 k = rest >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << rest) - 1;
+        uint64_t mask = _mm512_movepi8_mask(_mm512_maskz_loadu_epi8(k, buf + i));
+        if (mask != 0) return i + (size_t)__builtin_ctzll(mask);
+    }
+    return len;
+}
+
+/*
+ * Guarded scans for keywords that could make the verifications quadratic: like the kernels
+ * above, but they stop with *resume set once failed candidates exceed the budget.
+ */
+__attribute__((target("sse2")))
+static const char *guarded_sse2(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                const char **resume) {
+    return scan_sse2(hay, hay_len, needle, needle_len, 0, resume);
+}
+
+__attribute__((target("sse2")))
+static const char *guarded_sse2_ci(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                   const char **resume) {
+    return scan_sse2(hay, hay_len, needle, needle_len, 1, resume);
+}
+
+__attribute__((target("avx2")))
+static const char *guarded_avx2(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                const char **resume) {
+    return scan_avx2(hay, hay_len, needle, needle_len, 0, resume);
+}
+
+__attribute__((target("avx2")))
+static const char *guarded_avx2_ci(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                   const char **resume) {
+    return scan_avx2(hay, hay_len, needle, needle_len, 1, resume);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static const char *guarded_avx512(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                  const char **resume) {
+    return scan_avx512(hay, hay_len, needle, needle_len, 0, resume);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static const char *guarded_avx512_ci(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                     const char **resume) {
+    return scan_avx512(hay, hay_len, needle, needle_len, 1, resume);
+}
+
+const search_fn search_sse2 = search_sse2_impl;
+const search_fn search_avx2 = search_avx2_impl;
+const search_fn search_avx512 = search_avx512_impl;
+const search_fn search_sse2_ci = search_sse2_ci_impl;
+const search_fn search_avx2_ci = search_avx2_ci_impl;
+const search_fn search_avx512_ci = search_avx512_ci_impl;
+
+#else
+
+const search_fn search_sse2 = NULL;
+const search_fn search_avx2 = NULL;
+const search_fn search_avx512 = NULL;
+const search_fn search_sse2_ci = NULL;
+const search_fn search_avx2_ci = NULL;
+const search_fn search_avx512_ci = NULL;
+
+#endif
+
+static size_t count_byte_scalar(const char *buf, size_t len, char byte) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) count += buf[i] == byte;
+    return count;
+}
+
+static size_t ascii_span_scalar(const char *buf, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        if (word & 0x8080808080808080ULL) break;
+    }
+    for (; i < len; i++) {
+        if ((unsigned char)buf[i] >= 0x80) return i;
+    }
+    return len;
+}
+
+static search_fn active_kernel = search_scalar;
+static size_t (*active_count)(const char *, size_t, char) = count_byte_scalar;
+static size_t (*active_ascii_span)(const char *, size_t) = ascii_span_scalar;
+static search_fn active_kernel_ci = search_scalar_ci;
+// Guarded vector scans for SEARCH_GUARDED; NULL without vector kernels
+typedef const char *(*guarded_fn)(const char *hay, size_t hay_len, const char *needle, size_t needle_len,
+                                  const char **resume);
+static guarded_fn active_guarded = NULL;
+static guarded_fn active_guarded_ci = NULL;
+static const char *active_name = "scalar";
+static size_t horspool_min_needle = HORSPOOL_MIN_NEEDLE_SCALAR;
+
+int search_cpu_supports(const char *kernel) {
+#ifdef SEARCH_X86
+    __builtin_cpu_init();
+    if (strcmp(kernel, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(kernel, "ssse3") == 0) return __builtin_cpu_supports("ssse3");
+    if (strcmp(kernel, "popcnt") == 0) return __builtin_cpu_supports("popcnt");
+    if (strcmp(kernel, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(kernel, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    }
+#else
+    (void)kernel;
+#endif
+    return 0;
+}
+
+void search_init(void) {
+    for (int c = 0; c < 256; c++) {
+        fold_table[c] = (unsigned char)((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+    }
+
+    if (search_cpu_supports("avx512")) {
+        active_kernel = search_avx512;
+        active_kernel_ci = search_avx512_ci;
+        active_name = "avx512";
+        horspool_min_needle = SIZE_MAX;
+    } else if (search_cpu_supports("avx2")) {
+        active_kernel = search_avx2;
+        active_kernel_ci = search_avx2_ci;
+        active_name = "avx2";
+        horspool_min_needle = SIZE_MAX;
+    } else if (search_cpu_supports("sse2")) {
+        active_kernel = search_sse2;
+        active_kernel_ci = search_sse2_ci;
+        active_name = "sse2";
+        horspool_min_needle = HORSPOOL_MIN_NEEDLE_SSE2;
+    }
+
+#ifdef SEARCH_X86
+    if (search_cpu_supports("avx512")) {
+        active_guarded = guarded_avx512;
+        active_guarded_ci = guarded_avx512_ci;
+    } else if (search_cpu_supports("avx2")) {
+        active_guarded = guarded_avx2;
+        active_guarded_ci = guarded_avx2_ci;
+    } else if (search_cpu_supports("sse2")) {
+        active_guarded = guarded_sse2;
+        active_guarded_ci = guarded_sse2_ci;
+    }
+#endif
+
+#ifdef SEARCH_X86
+    // count_byte_avx2 hands short inputs to count_byte_sse2, which needs popcnt too
+    if (search_cpu_supports("popcnt")) {
+        if (search_cpu_supports("avx512")) {
+            active_count = count_byte_avx512;
+        } else if (search_cpu_supports("avx2")) {
+            active_count = count_byte_avx2;
+        } else if (search_cpu_supports("sse2")) {
+            active_count = count_byte_sse2;
+        }
+    }
+    if (search_cpu_supports("avx512")) {
+        active_ascii_span = ascii_span_avx512;
+    } else if (search_cpu_supports("avx2")) {
+        active_ascii_span = ascii_span_avx2;
+    } else if (search_cpu_supports("sse2")) {
+        active_ascii_span = ascii_span_sse2;
+    }
+#endif
+}
+
+const char *search_kernel_name(void) {
+    return active_name;
+}
+
+size_t search_count_byte(const char *buf, size_t len, char byte) {
+    return active_count(buf, len, byte);
+}
+
+size_t search_ascii_span(const char *buf, size_t len) {
+    return active_ascii_span(buf, len);
+}
+
+const char *search_literal(const char *hay, size_t hay_len, const char *needle, size_t needle_len) {
+    return active_kernel(hay, hay_len, needle, needle_len);
+}
+
+const char *search_literal_ci(const char *hay, size_t hay_len, const char *needle_lower, size_t needle_len) {
+    return active_kernel_ci(hay, hay_len, needle_lower, needle_len);
+}
+
+/**
+ * Boyer-Moore-Horspool: compares the last window byte first and skips by the distance of
+ * that byte's last occurrence in the needle (without the final position).
+ */
+static const char *horspool_find(const search_plan_t *plan, const char *hay, size_t hay_len) {
+    const char *needle = plan->needle;
+    size_t n = plan->len;
+    if (hay_len < n) return NULL;
+
+    unsigned char last = (unsigned char)needle[n - 1];
+    size_t j = 0;
+    if (plan->case_insensitive) {
+        while (j <= hay_len - n) {
+            unsigned char c = (unsigned char)hay[j + n - 1];
+            if (fold_table[c] == last && equal_folded(hay + j, needle, n - 1)) return hay + j;
+            j += plan->shift[c];
+        }
+    } else {
+        while (j <= hay_len - n) {
+            unsigned char c = (unsigned char)hay[j + n - 1];
+            if (c == last && memcmp(hay + j, needle, n - 1) == 0) return hay + j;
+            j += plan->shift[c];
+        }
+    }
+    return NULL;
+}
+
+static inline unsigned char plan_byte(const search_plan_t *plan, char c) {
+    return plan->case_insensitive ? fold_table[(unsigned char)c] : (unsigned char)c;
+}
+
+/**
+ * Computes the critical factorization of the needle (Crochemore-Perrin): the maximal
+ * suffix under both the byte order and its reverse, keeping the later start.
+ * @param period Receives the period of the chosen suffix.
+ * @return The factorization position.
+ */
+static size_t critical_factorization(const search_plan_t *plan, size_t *period) {
+    const char *needle = plan->needle;
+    size_t n = plan->len;
+    size_t max_suffix, max_suffix_rev, j, k, p;
+    unsigned char a, b;
+
+    // max_suffix starts at SIZE_MAX on purpose: max_suffix + k wraps to k - 1
+    max_suffix = SIZE_MAX;
+    j = 0;
+    k = p = 1;
+    while (j + k < n) {
+        a = plan_byte(plan, needle[j + k]);
+        b = plan_byte(plan, needle[max_suffix + k]);
+        if (a < b) {
+            j += k;
+            k = 1;
+            p = j - max_suffix;
+        } else if (a == b) {
+            if (k != p) {
+                k++;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            max_suffix = j++;
+            k = p = 1;
+        }
+    }
+    *period = p;
+
+    max_suffix_rev = SIZE_MAX;
+    j = 0;
+    k = p = 1;
+    while (j + k < n) {
+        a = plan_byte(plan, needle[j + k]);
+        b = plan_byte(plan, needle[max_suffix_rev + k]);
+        if (b < a) {
+            j += k;
+            k = 1;
+            p = j - max_suffix_rev;
+        } else if (a == b) {
+            if (k != p) {
+                k++;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            max_suffix_rev = j++;
+            k = p = 1;
+        }
+    }
+
+    if (max_suffix_rev + 1 < max_suffix + 1) return max_suffix + 1;
+    *period = p;
+    return max_suffix_rev + 1;
+}
+
+/**
+ * Two-Way string matching: scans the right half of the needle left to right, then the left
+ * half right to left, and shifts by the period. Linear time and constant extra space even
+ * for needles like "aaaa...ab" that make skip-based searches quadratic.
+ */
+static const char *two_way_find(const search_plan_t *plan, const char *hay, size_t hay_len) {
+    const char *needle = plan->needle;
+    size_t n = plan->len;
+    size_t suffix = plan->suffix, period = plan->period;
+    size_t i, j = 0;
+    if (hay_len < n) return NULL;
+
+    if (plan->periodic) {
+        // Remember how much of the left half is known to match after a period shift
+        size_t memory = 0;
+        while (j <= hay_len - n) {
+            i = suffix > memory ? suffix : memory;
+            while (i < n && plan_byte(plan, needle[i]) == plan_byte(plan, hay[i + j])) i++;
+            if (n <= i) {
+                i = suffix - 1;
+                while (memory < i + 1 && plan_byte(plan, needle[i]) == plan_byte(plan, hay[i + j])) i--;
+                if (i + 1 < memory + 1) return hay + j;
+                j += period;
+                memory = n - period;
+            } else {
+                j += i - suffix + 1;
+                memory = 0;
+            }
+        }
+    } else {
+        while (j <= hay_len - n) {
+            i = suffix;
+            while (i < n && plan_byte(plan, needle[i]) == plan_byte(plan, hay[i + j])) i++;
+            if (n <= i) {
+                i = suffix - 1;
+                while (i != SIZE_MAX && plan_byte(plan, needle[i]) == plan_byte(plan, hay[i + j])) i--;
+                if (i == SIZE_MAX) return hay + j;
+                j += period;
+            } else {
+                j += i - suffix + 1;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Vector scan that hands the rest of the haystack to Two-Way once failed verifications
+ * exceed their budget.
+ */
+static const char *guarded_find(const search_plan_t *plan, const char *hay, size_t hay_len) {
+    guarded_fn scan = plan->case_insensitive ? active_guarded_ci : active_guarded;
+    if (scan == NULL) return two_way_find(plan, hay, hay_len);
+    const char *resume = NULL;
+    const char *found = scan(hay, hay_len, plan->needle, plan->len, &resume);
+    if (found != NULL || resume == NULL) return found;
+    return two_way_find(plan, resume, hay_len - (size_t)(resume - hay));
+}
+
+void search_plan_init(search_plan_t *plan, const char *needle, size_t len, int case_insensitive) {
+    memset(plan, 0, sizeof(*plan));
+    plan->needle = needle;
+    plan->len = len;
+    plan->case_insensitive = case_insensitive;
+    plan->algo = SEARCH_SIMD;
+    if (len < 2) return; // Nothing to skip over; the SIMD kernels handle these via memchr
+
+    // Horspool shift table; with -i both cases of a letter get the same shift
+    for (int c = 0; c < 256; c++) plan->shift[c] = len;
+    for (size_t i = 0; i + 1 < len; i++) {
+        unsigned char c = (unsigned char)needle[i];
+        plan->shift[c] = len - 1 - i;
+        if (case_insensitive && c >= 'a' && c <= 'z') plan->shift[c - ('a' - 'A')] = len - 1 - i;
+    }
+
+    // Two-Way factorization; a needle is periodic if its left part repeats at the period
+    size_t period;
+    plan->suffix = critical_factorization(plan, &period);
+    plan->periodic = 1;
+    for (size_t i = 0; i < plan->suffix; i++) {
+        if (plan_byte(plan, needle[i]) != plan_byte(plan, needle[i + period])) {
+            plan->periodic = 0;
+            break;
+        }
+    }
+    if (plan->periodic) {
+        plan->period = period;
+    } else {
+        size_t right = len - plan->suffix;
+        plan->period = (plan->suffix > right ? plan->suffix : right) + 1;
+    }
+
+    if (len < SIMD_MIN_SKIP_NEEDLE) {
+        plan->algo = SEARCH_SIMD;
+    } else if (plan->periodic && plan->period * TWO_WAY_MIN_REPEATS <= len) {
+        plan->algo = active_guarded != NULL ? SEARCH_GUARDED : SEARCH_TWO_WAY;
+    } else if (len >= horspool_min_needle) {
+        plan->algo = SEARCH_HORSPOOL;
+    } else {
+        plan->algo = SEARCH_SIMD;
+    }
+}
+
+const char *search_plan_find(const search_plan_t *plan, const char *hay, size_t hay_len) {
+    switch (plan->algo) {
+        case SEARCH_HORSPOOL:
+            return horspool_find(plan, hay, hay_len);
+        case SEARCH_TWO_WAY:
+            return two_way_find(plan, hay, hay_len);
+        case SEARCH_GUARDED:
+            return guarded_find(plan, hay, hay_len);
+        case SEARCH_SIMD:
+        default:
+            if (plan->case_insensitive) return search_literal_ci(hay, hay_len, plan->needle, plan->len);
+            return search_literal(hay, hay_len, plan->needle, plan->len);
+    }
+}
+
+const char *search_algo_name(search_algo_t algo) {
+    switch (algo) {
+        case SEARCH_HORSPOOL:
+            return "horspool";
+        case SEARCH_TWO_WAY:
+            return "two-way";
+        case SEARCH_GUARDED:
+            return "guarded";
+        case SEARCH_SIMD:
+        default:
+            return "simd";
+    }
+}
@@ -0,0 +1,116 @@
+/**
+ * @file search.h
+ * @brief Literal substring search kernels used by mygrep.
+ * Provides a scalar kernel plus SSE2/AVX2/AVX-512 kernels that test the first and last
+ * keyword byte across a whole vector at once, each in a case-sensitive and an ASCII
+ * case-insensitive flavour. The fastest kernels supported by the CPU are selected once
+ * at startup by search_init().
+ */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+/**
+ * @brief Signature shared by all literal search kernels.
+ * Returns a pointer to the first occurrence of needle inside hay, or NULL.
+ * The haystack does not need to be NUL-terminated.
+ */
+typedef const char *(*search_fn)(const char *hay, size_t hay_len, const char *needle, size_t needle_len);
+
+/**
+ * @brief Selects the best kernel for the running CPU. Must be called before search_literal().
+ */
+void search_init(void);
+
+/**
+ * @brief Name of the kernel chosen by search_init() ("scalar", "sse2", "avx2" or "avx512").
+ */
+const char *search_kernel_name(void);
+
+/**
+ * @brief Finds the first occurrence of needle in hay using the dispatched kernel.
+ */
+const char *search_literal(const char *hay, size_t hay_len, const char *needle, size_t needle_len);
+
+/**
+ * @brief Case-insensitive variant of search_literal(). ASCII case is folded inside the
+ * comparison, so the haystack is searched in place without a lowercased copy.
+ * @param needle_lower The keyword, already converted to lowercase.
+ */
+const char *search_literal_ci(const char *hay, size_t hay_len, const char *needle_lower, size_t needle_len);
+
+// Individual kernels, exposed for benchmarking. A kernel is NULL if it was not compiled in.
+const char *search_scalar(const char *hay, size_t hay_len, const char *needle, size_t needle_len);
+const char *search_scalar_ci(const char *hay, size_t hay_len, const char *needle, size_t needle_len);
+extern const search_fn search_sse2;
+extern const search_fn search_avx2;
+extern const search_fn search_avx512;
+extern const search_fn search_sse2_ci;
+extern const search_fn search_avx2_ci;
+extern const search_fn search_avx512_ci;
+
+/**
+ * @brief Counts the occurrences of a byte (mygrep -n counts newlines with it). The vector
+ * kernels compare a whole vector at once and popcount the resulting bit mask, so a region
+ * without matches costs one pass instead of a step per line.
+ */
+size_t search_count_byte(const char *buf, size_t len, char byte);
+
+/**
+ * @brief Length of the pure-ASCII prefix of buf: the offset of the first byte with the top
+ * bit set (part of a multibyte UTF-8 character), or len. mygrep -i folds only the lines
+ * that have such bytes, and the vector kernels find them at memory speed.
+ */
+size_t search_ascii_span(const char *buf, size_t len);
+
+/**
+ * @brief Search algorithms a plan can choose from.
+ */
+typedef enum {
+    SEARCH_SIMD,     // First/last byte vector scan; best for short keywords
+    SEARCH_HORSPOOL, // Boyer-Moore-Horspool skip loop; longer keywords without wide vectors
+    SEARCH_TWO_WAY,  // Crochemore-Perrin Two-Way; linear worst case for repetitive keywords
+    SEARCH_GUARDED   // Vector scan that switches to Two-Way when verifications fail too often
+} search_algo_t;
+
+/**
+ * @brief A keyword prepared once for repeated searching.
+ * search_plan_init() picks the algorithm from the keyword length and structure and the
+ * kernel chosen by search_init(). It precomputes the tables of every algorithm, so `algo`
+ * may be overridden afterwards (the benchmark does this to compare them on one keyword).
+ */
+typedef struct {
+    const char *needle;  // Not copied; must outlive the plan (lowercase if case_insensitive)
+    size_t len;
+    int case_insensitive;
+    search_algo_t algo;
+    size_t shift[256];   // Horspool: skip distance keyed by the haystack byte under the last needle byte
+    size_t suffix;       // Two-Way: critical factorization position
+    size_t period;       // Two-Way: period of the right half (or the safe shift for non-periodic needles)
+    int periodic;        // Two-Way: the needle is a repetition of its period
+} search_plan_t;
+
+/**
+ * @brief Prepares a keyword for search_plan_find(). Requires search_init() to have run.
+ */
+void search_plan_init(search_plan_t *plan, const char *needle, size_t len, int case_insensitive);
+
+/**
+ * @brief Finds the first occurrence of the planned keyword in hay.
+ */
+const char *search_plan_find(const search_plan_t *plan, const char *hay, size_t hay_len);
+
+/**
+ * @brief Name of an algorithm ("simd", "horspool", "two-way", "guarded").
+ */
+const char *search_algo_name(search_algo_t algo);
+
+/**
+ * @brief Reports whether the CPU has the named feature set ("sse2", "ssse3", "popcnt", "avx2",
+ * "avx512").
+ */
+int search_cpu_supports(const char *kernel);
+
+#endif
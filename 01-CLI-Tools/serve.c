@@ -0,0 +1,857 @@
+/**
+ * @file serve.c
+ * @brief The --serve daemon: mapped files, inotify tracking, a connection queue worked
+ * off by a thread pool, and queries run with libmygrep.
+ */
+
+#define _POSIX_C_SOURCE 200809L // Required for strndup and sigaction
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h> // for NAME_MAX
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/inotify.h>
+#include "serve.h"
+#include "matcher.h"
+#include "scan.h"
+
+// Address space mapped past the end of a file beyond half its size, so that appended data
+// shows up in the existing mapping and its pages stay faulted in
+#define SERVE_MAP_HEADROOM ((size_t)64 << 20)
+
+// A query is a short argument list; anything longer is refused
+#define SERVE_MAX_REQUEST ((size_t)64 << 10)
+#define SERVE_REQUEST_TIMEOUT 5 // Seconds a client may take to send its query
+
+// The reply's trailer (see serve.h): error messages of at most SERVE_MAX_ERRORS bytes,
+// then their length (2 bytes, big-endian), the status byte and SERVE_TRAILER_MAGIC
+#define SERVE_MAX_ERRORS ((size_t)4 << 10)
+#define SERVE_FOOTER_BYTES 4
+#define SERVE_TRAILER_MAGIC 0xA5
+
+// The mapped file itself, and its directory for a new file under its name
+#define SERVE_FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define SERVE_DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+/**
+ * @brief A mapping of one file, shared by the queries searching it. It outlives a newer
+ * mapping of the file until the last of those queries is done.
+ */
+typedef struct {
+    char *data;           // MAP_SHARED, so bytes appended to the file show up
+    size_t length;        // Address space mapped; the file's size may grow up to this
+    size_t refs;          // The served file's own reference and one per running query
+} mapping_t;
+
+/**
+ * @brief A served file and where its current contents are.
+ */
+typedef struct {
+    const char *path;     // As given on the command line, which queries name it by
+    char *dir;            // The directory holding it, watched for its re-creation after rotation
+    const char *name;     // Base name, compared with the names of directory events
+    int fd;               // -1 while the path cannot be opened
+    int error;            // errno of the last failed open
+    int wd;               // Watch on the open file, -1 once the kernel dropped it
+    int dir_wd;
+    mapping_t *map;       // NULL while fd is -1
+    size_t size;          // Bytes of the mapping new queries search
+    int changed;          // Written to since size was taken
+    int moved;            // The path may name a different file now
+} served_file_t;
+
+/**
+ * @brief Shared state of the daemon. The main thread accepts connections and reads
+ * inotify events; the workers take connections off the queue and answer them.
+ */
+typedef struct {
+    const char *prog;
+    served_file_t *files;
+    size_t count;
+    int inotify_fd;
+    pthread_mutex_t lock; // Guards the files and the connection queue
+    pthread_cond_t queued;
+    int *connections;     // Accepted and not yet taken by a worker: [head, tail)
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    int closed;           // Set at shutdown: workers exit once the queue is empty
+} server_t;
+
+/**
+ * @brief One parsed query.
+ */
+typedef struct {
+    matcher_t matcher;
+    options_t opts;
+    int case_insensitive;
+    int extended;
+    unsigned errors;      // --fuzzy
+    int filenames;        // -H: 1, -h: 0, -1: name the files if several are searched
+    int grouped;          // opts.grouped points here
+    int have_patterns;
+    char *selected;       // Per served file: named by the query (all of them if none is)
+    size_t selected_count;
+} query_t;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// A file truncated under a query leaves mapped pages past its new end, and reading them
+// raises SIGBUS in the worker scanning them. The worker resumes at scan_fault instead.
+// Thread-local variables rather than a pthread key: the handler may only touch those.
+// The jump abandons whatever the guarded code (scan_buffer, while scan_armed is set) was
+// doing, so that code must stay allocation-free and lock-free: no malloc, no stdio
+// buffering of the mapping's bytes, no mutex. matcher_prepare allocates its state
+// beforehand, and the writer hands the lines to writev.
+static __thread sigjmp_buf scan_fault;
+static __thread volatile sig_atomic_t scan_armed = 0;
+
+static void request_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void mapping_fault(int sig) {
+    if (scan_armed) siglongjmp(scan_fault, 1);
+    // Not a scan of a mapping: the fault is re-raised by the same access and is fatal
+    signal(sig, SIG_DFL);
+}
+
+/**
+ * Maps an open file with room to grow.
+ * @return The mapping with one reference, or NULL with errno set.
+ */
+static mapping_t *mapping_create(int fd, size_t size) {
+    mapping_t *map = malloc(sizeof(*map));
+    if (!map) return NULL;
+    map->length = size + size / 2 + SERVE_MAP_HEADROOM;
+    map->data = mmap(NULL, map->length, PROT_READ, MAP_SHARED, fd, 0);
+    if (map->data == MAP_FAILED) {
+        int saved = errno;
+        free(map);
+        errno = saved;
+        return NULL;
+    }
+    // Pages past the end of the file must never be touched; the rest is read ahead now
+    // rather than by the first query
+    if (size > 0) madvise(map->data, size, MADV_WILLNEED);
+    map->refs = 1;
+    return map;
+}
+
+static void mapping_release(mapping_t *map) {
+    if (map == NULL || --map->refs > 0) return;
+    munmap(map->data, map->length);
+    free(map);
+}
+
+/**
+ * Opens and maps the file at the served path, replacing the current one. Called with the
+ * lock held.
+ * @return 0 on success, -1 with file->error set.
+ */
+static int served_open(server_t *s, served_file_t *file) {
+    struct stat st;
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        file->error = errno;
+        return -1;
+    }
+    int rc = fstat(fd, &st);
+    if (rc == -1 || !S_ISREG(st.st_mode)) {
+        file->error = rc == -1 ? errno : EINVAL; // Only regular files can be mapped and kept
+        close(fd);
+        return -1;
+    }
+    mapping_t *map = mapping_create(fd, (size_t)st.st_size);
+    if (map == NULL) {
+        file->error = errno;
+        close(fd);
+        return -1;
+    }
+
+    if (file->fd != -1) close(file->fd);
+    mapping_release(file->map);
+    file->fd = fd;
+    file->map = map;
+    file->size = (size_t)st.st_size;
+    file->changed = 0;
+    // The watch follows the inode; a new file needs its own
+    if (file->wd != -1) inotify_rm_watch(s->inotify_fd, file->wd);
+    file->wd = inotify_add_watch(s->inotify_fd, file->path, SERVE_FILE_EVENTS);
+    return 0;
+}
+
+/**
+ * Brings a file up to date after inotify events: a new file under the path is mapped, a
+ * grown file's new size is taken, and a file that shrank or outgrew its mapping is mapped
+ * again. Called with the lock held.
+ */
+static void served_refresh(server_t *s, served_file_t *file) {
+    if (file->moved || file->fd == -1) {
+        file->moved = 0;
+        struct stat st_new, st_old;
+        if (stat(file->path, &st_new) == 0 &&
+            (file->fd == -1 || fstat(file->fd, &st_old) == -1 || st_new.st_dev != st_old.st_dev ||
+             st_new.st_ino != st_old.st_ino)) {
+            if (served_open(s, file) == 0) return;
+        }
+        // Until a new file appears, the old one (if any) is still served
+        file->changed = 1;
+    }
+    if (!file->changed || file->fd == -1) return;
+
+    struct stat st;
+    file->changed = 0;
+    if (fstat(file->fd, &st) == -1) return;
+    size_t size = (size_t)st.st_size;
+    if (size < file->size || size > file->map->length) {
+        // Truncated, or grown past the headroom
+        mapping_t *map = mapping_create(file->fd, size);
+        if (map == NULL) return;
+        mapping_release(file->map);
+        file->map = map;
+    }
+    file->size = size;
+}
+
+/**
+ * Takes a reference to a file's current contents for a query.
+ * @param size Receives the number of bytes to search.
+ * @return The mapping, or NULL with errno set if the file cannot be opened.
+ */
+static mapping_t *served_acquire(server_t *s, served_file_t *file, size_t *size) {
+    pthread_mutex_lock(&s->lock);
+    served_refresh(s, file);
+    mapping_t *map = file->map;
+    if (map != NULL) {
+        map->refs++;
+        *size = file->size;
+    } else {
+        errno = file->error;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return map;
+}
+
+static void served_release(server_t *s, mapping_t *map) {
+    pthread_mutex_lock(&s->lock);
+    mapping_release(map);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Marks a file that shrank under a query, whether or not inotify has reported it yet, so
+ * that the next query takes its size and maps it afresh.
+ */
+static void served_stale(server_t *s, served_file_t *file) {
+    pthread_mutex_lock(&s->lock);
+    file->changed = 1;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Records which files an inotify event concerns; the work is left to the next query.
+ */
+static void serve_event(server_t *s, const struct inotify_event *event) {
+    pthread_mutex_lock(&s->lock);
+    for (size_t i = 0; i < s->count; i++) {
+        served_file_t *file = &s->files[i];
+        if (event->mask & IN_Q_OVERFLOW) {
+            // Events were lost: check every file
+            file->moved = 1;
+        } else if (event->wd == file->wd && (event->mask & IN_IGNORED)) {
+            file->wd = -1;
+        } else if (event->wd == file->wd) {
+            if (event->mask & IN_MODIFY) file->changed = 1;
+            if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) file->moved = 1;
+        } else if (event->wd == file->dir_wd && event->len > 0 && strcmp(event->name, file->name) == 0) {
+            file->moved = 1;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Parses a count argument of a query (-m, -A, -B, -C, --fuzzy).
+ * @return 0 on success, -1 if it is not a non-negative number.
+ */
+static int parse_count(const char *arg, size_t *value) {
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (errno != 0 || *end != '\0' || end == arg || n < 0) return -1;
+    *value = (size_t)n;
+    return 0;
+}
+
+/**
+ * Parses the words of a query the way getopt would parse a mygrep command line: options
+ * may be grouped ("-in"), an option's argument may be attached ("-m5") or the next word,
+ * and "--" ends the options.
+ * @param error Receives a message if the query is invalid.
+ * @return 0 on success, -1 on an invalid query.
+ */
+static int query_parse(const server_t *s, query_t *q, char **words, size_t count, char *error, size_t error_size) {
+    int options_done = 0;
+    for (size_t w = 0; w < count; w++) {
+        const char *word = words[w];
+        if (options_done || word[0] != '-' || word[1] == '\0') {
+            if (!q->have_patterns) {
+                // As on the command line, the first operand is the keyword without -e
+                if (matcher_add(&q->matcher, word, strlen(word)) == -1) goto no_memory;
+                q->have_patterns = 1;
+                continue;
+            }
+            size_t f = 0;
+            while (f < s->count && strcmp(s->files[f].path, word) != 0) f++;
+            if (f == s->count) {
+                snprintf(error, error_size, "File '%s' is not served", word);
+                return -1;
+            }
+            if (!q->selected[f]) q->selected_count++;
+            q->selected[f] = 1;
+            continue;
+        }
+        if (strcmp(word, "--") == 0) {
+            options_done = 1;
+            continue;
+        }
+        if (strncmp(word, "--fuzzy", 7) == 0 && (word[7] == '\0' || word[7] == '=')) {
+            const char *arg = word[7] == '=' ? word + 8 : w + 1 < count ? words[++w] : NULL;
+            size_t errors;
+            if (arg == NULL || parse_count(arg, &errors) == -1 || errors > FUZZY_MAX_ERRORS) {
+                snprintf(error, error_size, "Invalid edit distance (0 to %d)", FUZZY_MAX_ERRORS);
+                return -1;
+            }
+            q->errors = (unsigned)errors;
+            continue;
+        }
+
+        for (const char *c = word + 1; *c != '\0'; c++) {
+            if (strchr("mABCe", *c) == NULL) {
+                switch (*c) {
+                    case 'E': q->extended = 1; break;
+                    case 'i': q->case_insensitive = 1; break;
+                    case 'c': q->opts.mode = OUTPUT_COUNT; break;
+                    case 'l': q->opts.mode = OUTPUT_FILES; break;
+                    case 'n': q->opts.line_numbers = 1; break;
+                    case 'b': q->opts.byte_offsets = 1; break;
+                    case 'H': q->filenames = 1; break;
+                    case 'h': q->filenames = 0; break;
+                    default:
+                        snprintf(error, error_size, "Unsupported option '-%c' in query", *c);
+                        return -1;
+                }
+                continue;
+            }
+
+            // The rest of the word, or the next word, is the argument
+            const char *arg = c[1] != '\0' ? c + 1 : w + 1 < count ? words[++w] : NULL;
+            if (arg == NULL) {
+                snprintf(error, error_size, "Option '-%c' requires an argument", *c);
+                return -1;
+            }
+            if (*c == 'e') {
+                if (matcher_add_list(&q->matcher, arg) == -1) goto no_memory;
+                q->have_patterns = 1;
+                break;
+            }
+            size_t n;
+            if (parse_count(arg, &n) == -1) {
+                snprintf(error, error_size, "Invalid %s '%s'", *c == 'm' ? "match count" : "context length", arg);
+                return -1;
+            }
+            if (*c == 'm') {
+                q->opts.max_count = n;
+            } else {
+                if (*c != 'B') q->opts.after = n;
+                if (*c != 'A') q->opts.before = n;
+                q->opts.context = 1;
+            }
+            break;
+        }
+    }
+    if (!q->have_patterns) {
+        snprintf(error, error_size, "No keyword provided");
+        return -1;
+    }
+    return 0;
+
+no_memory:
+    snprintf(error, error_size, "Memory allocation failed: %s", strerror(errno));
+    return -1;
+}
+
+/**
+ * Reads a query until the client shuts down its side of the connection.
+ * @return The request's length, or -1 if it failed, timed out or was too long.
+ */
+static ssize_t read_request(int conn, char *buf, size_t size) {
+    size_t used = 0;
+    for (;;) {
+        ssize_t got = read(conn, buf + used, size - used);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return -1;
+        if (got == 0) return (ssize_t)used;
+        used += (size_t)got;
+        if (used == size) return -1;
+    }
+}
+
+/**
+ * Searches the first size bytes of a mapping for a query. If the file is truncated during
+ * the search, the pages past its new end fault when read, or make writev fail with EFAULT
+ * when written, and the search is abandoned: the lines written up to then stay in the
+ * reply.
+ * @param out The reply; a stream on the connection's descriptor, so that lines are never
+ * copied into its stdio buffer.
+ * @param truncated Set if the search was abandoned.
+ * @return Number of matching lines, or SIZE_MAX (with errno set as for scan_buffer, or
+ * with *truncated set).
+ */
+static size_t scan_mapping(const mapping_t *map, size_t size, FILE *out, query_t *q, int *truncated) {
+    input_pos_t pos = input_start;
+    *truncated = 0;
+    // Everything the search needs is allocated before the guarded code runs
+    if (matcher_prepare(&q->matcher) == -1) return SIZE_MAX;
+    if (sigsetjmp(scan_fault, 1) != 0) {
+        scan_armed = 0;
+        *truncated = 1;
+        return SIZE_MAX;
+    }
+    scan_armed = 1;
+    size_t matches = scan_buffer(map->data, size, out, &q->matcher, &q->opts,
+                                 match_limit(&q->opts) == SIZE_MAX ? NULL : &pos);
+    scan_armed = 0;
+    if (matches == SIZE_MAX && errno == EFAULT) *truncated = 1;
+    return matches;
+}
+
+/**
+ * Ends a reply with its trailer: the error messages, cut to the last whole line within
+ * SERVE_MAX_ERRORS bytes, their length, and the status (1 if there were any).
+ */
+static void write_trailer(FILE *out, const char *errors, size_t len) {
+    int status = len > 0;
+    if (len > SERVE_MAX_ERRORS) {
+        len = SERVE_MAX_ERRORS;
+        while (len > 0 && errors[len - 1] != '\n') len--;
+    }
+    unsigned char footer[SERVE_FOOTER_BYTES] = {(unsigned char)(len >> 8), (unsigned char)len,
+                                                (unsigned char)status, SERVE_TRAILER_MAGIC};
+    fwrite(errors, 1, len, out);
+    fwrite(footer, 1, sizeof(footer), out);
+}
+
+/**
+ * Answers one connection: reads the query, compiles its matcher and searches the selected
+ * files' current mappings, writing the results straight to the socket. Error messages
+ * are collected for the trailer.
+ */
+static void serve_query(server_t *s, int conn) {
+    char *request = malloc(SERVE_MAX_REQUEST);
+    char **words = malloc((SERVE_MAX_REQUEST / 2 + 1) * sizeof(*words));
+    query_t q = {{0}};
+    q.selected = calloc(s->count, 1);
+    char *error_text = NULL;
+    size_t error_len = 0;
+    FILE *errors = open_memstream(&error_text, &error_len);
+    FILE *out = fdopen(conn, "w");
+    if (!request || !words || !q.selected || !errors || !out) {
+        if (out != NULL) fclose(out); else close(conn);
+        if (errors != NULL) fclose(errors);
+        free(error_text);
+        free(request);
+        free(words);
+        free(q.selected);
+        return;
+    }
+
+    // Each word ends in a NUL byte; a missing last one is forgiven
+    ssize_t len = read_request(conn, request, SERVE_MAX_REQUEST - 1);
+    size_t count = 0;
+    if (len > 0) {
+        if (request[len - 1] != '\0') request[len++] = '\0';
+        for (char *p = request; p < request + len; p += strlen(p) + 1) words[count++] = p;
+    }
+
+    char error[160];
+    q.opts = (options_t){OUTPUT_LINES, 0, 0, 0, 0, 0, 0, SIZE_MAX, NULL, NULL, NULL, NULL};
+    q.filenames = -1;
+    q.opts.grouped = &q.grouped;
+    if (len < 0) snprintf(error, sizeof(error), "Error reading query: %s", strerror(errno));
+    if (len < 0 || query_parse(s, &q, words, count, error, sizeof(error)) == -1) {
+        fprintf(errors, "%s: %s\n", s->prog, error);
+    } else if (matcher_compile(&q.matcher, q.case_insensitive, q.extended, q.errors) == -1) {
+        fprintf(errors, "%s: %s\n", s->prog, q.matcher.error);
+    } else {
+        size_t searched = q.selected_count > 0 ? q.selected_count : s->count;
+        q.opts.with_filename = q.filenames >= 0 ? q.filenames : searched > 1;
+        for (size_t f = 0; f < s->count && q.opts.max_count > 0; f++) {
+            if (q.selected_count > 0 && !q.selected[f]) continue;
+            served_file_t *file = &s->files[f];
+            size_t size;
+            mapping_t *map = served_acquire(s, file, &size);
+            if (map == NULL) {
+                fprintf(errors, "%s: Error opening input file '%s': %s\n", s->prog, file->path, strerror(errno));
+                continue;
+            }
+            q.opts.name = file->path;
+            int truncated;
+            size_t matches = scan_mapping(map, size, out, &q, &truncated);
+            int error = errno;
+            served_release(s, map);
+            if (truncated) {
+                served_stale(s, file);
+                fprintf(errors, "%s: Error searching '%s': file truncated during the search\n", s->prog, file->path);
+                continue;
+            }
+            if (matches == SIZE_MAX) {
+                fprintf(errors, "%s: Error searching '%s': %s\n", s->prog, file->path, strerror(error));
+                break;
+            }
+            report_input(out, file->path, matches, &q.opts);
+        }
+    }
+
+    fclose(errors);
+    write_trailer(out, error_text, error_len);
+    fclose(out);
+    free(error_text);
+    matcher_free(&q.matcher);
+    free(q.selected);
+    free(words);
+    free(request);
+}
+
+/**
+ * Worker thread: answers queued connections until the server shuts down.
+ */
+static void *serve_worker(void *arg) {
+    server_t *s = arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (s->head == s->tail && !s->closed) pthread_cond_wait(&s->queued, &s->lock);
+        if (s->head == s->tail) break;
+        int conn = s->connections[s->head++];
+        pthread_mutex_unlock(&s->lock);
+
+        serve_query(s, conn);
+        pthread_mutex_lock(&s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void queue_connection(server_t *s, int conn) {
+    pthread_mutex_lock(&s->lock);
+    if (s->tail == s->capacity) {
+        if (s->head > 0) {
+            // Taken connections leave room at the front
+            memmove(s->connections, s->connections + s->head, (s->tail - s->head) * sizeof(int));
+            s->tail -= s->head;
+            s->head = 0;
+        } else {
+            size_t capacity = s->capacity ? s->capacity * 2 : 64;
+            int *connections = realloc(s->connections, capacity * sizeof(*connections));
+            if (!connections) {
+                perror("Memory allocation failed");
+                exit(EXIT_FAILURE);
+            }
+            s->connections = connections;
+            s->capacity = capacity;
+        }
+    }
+    s->connections[s->tail++] = conn;
+    pthread_cond_signal(&s->queued);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Whether the socket file at addr is left over from a daemon that is gone: nothing accepts
+ * connections on it.
+ */
+static int socket_stale(const struct sockaddr_un *addr) {
+    struct stat st;
+    if (stat(addr->sun_path, &st) == -1 || !S_ISSOCK(st.st_mode)) return 0;
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) return 0;
+    int refused = connect(probe, (const struct sockaddr *)addr, sizeof(*addr)) == -1 && errno == ECONNREFUSED;
+    close(probe);
+    return refused;
+}
+
+/**
+ * Binds the listening socket. A socket file left by a daemon that is gone is replaced;
+ * one that still answers is not.
+ * @return The socket, or -1 with an error printed.
+ */
+static int listen_socket(const char *prog, const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: Socket path '%s' is too long\n", prog, path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(stderr, "%s: Error creating socket: %s\n", prog, strerror(errno));
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int stale = errno == EADDRINUSE && socket_stale(&addr);
+        if (!stale || unlink(path) == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            fprintf(stderr, "%s: Error binding socket '%s': %s\n", prog, path, strerror(stale ? errno : EADDRINUSE));
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) == -1) {
+        fprintf(stderr, "%s: Error listening on socket '%s': %s\n", prog, path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Opens, maps and watches the served files.
+ * @return Number of files that could be set up.
+ */
+static size_t serve_files_open(server_t *s, char *const *paths, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        served_file_t *file = &s->files[s->count];
+        memset(file, 0, sizeof(*file));
+        file->path = paths[i];
+        file->fd = -1;
+        file->wd = -1;
+        if (served_open(s, file) == -1) {
+            fprintf(stderr, "%s: Error opening input file '%s': %s\n", s->prog, paths[i], strerror(file->error));
+            continue;
+        }
+        const char *slash = strrchr(paths[i], '/');
+        file->name = slash ? slash + 1 : paths[i];
+        file->dir = slash ? strndup(paths[i], slash == paths[i] ? 1 : (size_t)(slash - paths[i])) : strdup(".");
+        if (!file->dir) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        file->dir_wd = inotify_add_watch(s->inotify_fd, file->dir, SERVE_DIR_EVENTS);
+        if (file->wd == -1 || file->dir_wd == -1) {
+            fprintf(stderr, "%s: Error watching input file '%s': %s\n", s->prog, paths[i], strerror(errno));
+            mapping_release(file->map);
+            close(file->fd);
+            free(file->dir);
+            continue;
+        }
+        s->count++;
+    }
+    return s->count;
+}
+
+int serve(const char *prog, const char *socket_path, char *const *paths, size_t count, size_t workers) {
+    server_t s;
+    memset(&s, 0, sizeof(s));
+    s.prog = prog;
+    s.inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (s.inotify_fd == -1) {
+        fprintf(stderr, "%s: Error setting up inotify: %s\n", prog, strerror(errno));
+        return -1;
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.queued, NULL);
+    s.files = calloc(count, sizeof(*s.files));
+    if (!s.files) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    int listen_fd = serve_files_open(&s, paths, count) > 0 ? listen_socket(prog, socket_path) : -1;
+    if (listen_fd == -1) {
+        for (size_t i = 0; i < s.count; i++) {
+            mapping_release(s.files[i].map);
+            close(s.files[i].fd);
+            free(s.files[i].dir);
+        }
+        free(s.files);
+        close(s.inotify_fd);
+        return -1;
+    }
+
+    // A client that goes away mid-reply must not end the daemon; the write just fails
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+    action.sa_handler = mapping_fault;
+    sigaction(SIGBUS, &action, NULL);
+    action.sa_handler = request_stop; // Without SA_RESTART, so that poll returns
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // The workers leave the signals to the main thread
+    sigset_t stop_signals, previous;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
+    pthread_t *threads = malloc(workers * sizeof(*threads));
+    if (!threads) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t t = 0; t < workers; t++) {
+        int rc = pthread_create(&threads[t], NULL, serve_worker, &s);
+        if (rc != 0) {
+            fprintf(stderr, "%s: Error creating worker thread: %s\n", prog, strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    // The event structs are variable-length; the union keeps the buffer aligned for them
+    union {
+        struct inotify_event event;
+        char bytes[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+    } events;
+    struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {s.inotify_fd, POLLIN, 0}};
+    while (!stop_requested) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "%s: Error waiting for queries: %s\n", prog, strerror(errno));
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            ssize_t got = read(s.inotify_fd, &events, sizeof(events));
+            for (char *p = events.bytes; got > 0 && p < events.bytes + got;) {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                serve_event(&s, event);
+                p += sizeof(*event) + event->len;
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int conn = accept(listen_fd, NULL, NULL);
+            if (conn == -1) continue;
+            // A client that connects but never finishes its query gives its worker back
+            struct timeval timeout = {SERVE_REQUEST_TIMEOUT, 0};
+            setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            queue_connection(&s, conn);
+        }
+    }
+
+    // Queries already accepted are answered before the workers exit
+    close(listen_fd);
+    unlink(socket_path);
+    pthread_mutex_lock(&s.lock);
+    s.closed = 1;
+    pthread_cond_broadcast(&s.queued);
+    pthread_mutex_unlock(&s.lock);
+    for (size_t t = 0; t < workers; t++) pthread_join(threads[t], NULL);
+    free(threads);
+
+    for (size_t i = 0; i < s.count; i++) {
+        mapping_release(s.files[i].map);
+        if (s.files[i].fd != -1) close(s.files[i].fd);
+        free(s.files[i].dir);
+    }
+    free(s.files);
+    free(s.connections);
+    close(s.inotify_fd);
+    pthread_cond_destroy(&s.queued);
+    pthread_mutex_destroy(&s.lock);
+    return 0;
+}
+
+/**
+ * Writes all of buf, resuming partial writes.
+ * @return 0 on success, -1 with errno set.
+ */
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+int serve_connect(const char *prog, const char *socket_path, char *const *words, size_t count) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: Socket path '%s' is too long\n", prog, socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "%s: Error connecting to '%s': %s\n", prog, socket_path, strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (write_all(fd, words[i], strlen(words[i]) + 1) == -1) {
+            fprintf(stderr, "%s: Error sending query: %s\n", prog, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    shutdown(fd, SHUT_WR);
+
+    // The last bytes received may belong to the trailer: they are held back until the end
+    enum { HOLD = SERVE_MAX_ERRORS + SERVE_FOOTER_BYTES };
+    char buf[(64 << 10) + HOLD];
+    size_t used = 0;
+    ssize_t got;
+    while ((got = read(fd, buf + used, sizeof(buf) - used)) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "%s: Error reading reply: %s\n", prog, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        used += (size_t)got;
+        if (used == sizeof(buf)) {
+            fwrite(buf, 1, used - HOLD, stdout);
+            memmove(buf, buf + used - HOLD, HOLD);
+            used = HOLD;
+        }
+    }
+    close(fd);
+
+    const unsigned char *footer = (const unsigned char *)buf + used - SERVE_FOOTER_BYTES;
+    size_t error_len = used >= SERVE_FOOTER_BYTES ? (size_t)footer[0] << 8 | footer[1] : 0;
+    if (used < SERVE_FOOTER_BYTES || footer[3] != SERVE_TRAILER_MAGIC || error_len > used - SERVE_FOOTER_BYTES) {
+        // The daemon went away mid-reply
+        fwrite(buf, 1, used, stdout);
+        fflush(stdout);
+        fprintf(stderr, "%s: Incomplete reply from '%s'\n", prog, socket_path);
+        return -1;
+    }
+    size_t output_len = used - SERVE_FOOTER_BYTES - error_len;
+    fwrite(buf, 1, output_len, stdout);
+    fflush(stdout);
+    fwrite(buf + output_len, 1, error_len, stderr);
+    return footer[2] == 0 ? 0 : -1;
+}
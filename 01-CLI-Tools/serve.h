@@ -0,0 +1,51 @@
+/**
+ * @file serve.h
+ * @brief Resident search daemon for mygrep --serve, and its client (--connect).
+ * The daemon keeps a fixed set of files memory-mapped and answers queries on a Unix domain
+ * socket, so a query pays neither for starting a process nor for mapping and faulting in
+ * the files again. Each file is mapped with address space to spare past its end: data
+ * appended to it shows up in the existing mapping, and inotify only tells the daemon to
+ * take the new size. A file that is truncated, or replaced under its name by log
+ * rotation, is mapped afresh for the next query. A query scanning a file while it is
+ * truncated gets an error for that file instead of the daemon dying of SIGBUS.
+ *
+ * A query is the argument list of a mygrep run without the program name, sent as words
+ * that each end in a NUL byte, followed by the end of the stream (shutdown for writing):
+ *
+ *   -n -i timeout            searches every served file
+ *   -c -e error app.log      searches one of them
+ *
+ * Supported are -E, -i, -c, -l, -n, -b, -H, -h, -m, -A, -B, -C, -e and --fuzzy; file operands
+ * must name served files as they were given to the daemon. The reply is what mygrep would
+ * print to stdout for the same arguments, followed by a trailer, and the connection is
+ * closed after it. The trailer holds what mygrep would print to stderr, as "mygrep: ..."
+ * lines of at most 4 KiB in all, then four bytes: the length of those lines (2 bytes,
+ * big-endian), the status (0, or 1 if the query could not run or a file could not be
+ * searched) and 0xA5. A reply that does not end in 0xA5 was cut short.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stddef.h>
+
+/**
+ * @brief Serves queries on the given files until SIGINT or SIGTERM.
+ * @param prog Program name for error messages.
+ * @param socket_path Path of the socket; a stale socket left there is replaced.
+ * @param paths The regular files to serve.
+ * @param workers Queries answered at the same time.
+ * @return 0 after a signal, -1 if the socket or no file could be set up.
+ */
+int serve(const char *prog, const char *socket_path, char *const *paths, size_t count, size_t workers);
+
+/**
+ * @brief Sends one query to a daemon, copies the results to stdout and the error messages
+ * of the trailer to stderr.
+ * @param words The query's arguments.
+ * @return 0 on success, -1 if the daemon cannot be reached, reports an error or cuts the
+ * reply short.
+ */
+int serve_connect(const char *prog, const char *socket_path, char *const *words, size_t count);
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * @file uring.c
+ * @brief io_uring set up with raw system calls, and the in-order file reader built on it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+#define RING_ENTRIES 256 // Per file an open, then a read, then a close
+
+enum { OP_OPEN, OP_READ, OP_CLOSE };
+
+#define USER_DATA(slot, op) (((uint64_t)(slot) << 2) | (uint64_t)(op))
+
+/**
+ * One file of the window: its requests, and what to deliver once they are complete.
+ */
+typedef struct {
+    char *path;
+    int fd;
+    int error;            // errno of a failed open
+    int ready;            // Everything needed for delivery is there
+    int use_fd;           // Deliver the descriptor instead of data
+    char *buf;            // URING_MAX_FILE_SIZE bytes
+    size_t len;           // File size, then bytes read
+} slot_t;
+
+struct uring_reader {
+    int ring_fd;
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned to_submit;   // Queued requests not yet handed to the kernel
+    unsigned in_flight;   // Requests whose completion has not been reaped
+    slot_t slots[URING_FILES_IN_FLIGHT];
+    size_t head;          // Oldest file of the window (next to deliver)
+    size_t count;         // Files in the window
+    uring_file_fn done;
+    void *ctx;
+};
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * Checks that the kernel supports every operation the reader uses.
+ */
+static int ring_supports_ops(int fd) {
+    static const int ops[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE};
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe) return 0;
+
+    int ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); i++) {
+        ok = ops[i] < probe->ops_len && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+static void ring_unmap(uring_reader_t *r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_len);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_len);
+    close(r->ring_fd);
+}
+
+static int ring_setup(uring_reader_t *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->ring_fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (r->ring_fd < 0) return -1;
+    if (!ring_supports_ops(r->ring_fd)) {
+        close(r->ring_fd);
+        return -1;
+    }
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        // Both rings live in one mapping
+        if (r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                     IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        ring_unmap(r);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                         IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = NULL;
+            ring_unmap(r);
+            return -1;
+        }
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                   IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        ring_unmap(r);
+        return -1;
+    }
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sq_entries = p.sq_entries;
+    return 0;
+}
+
+/**
+ * Hands queued requests to the kernel and, with wait set, blocks for at least one completion.
+ */
+static void ring_submit(uring_reader_t *r, int wait) {
+    for (;;) {
+        int submitted = ring_enter(r->ring_fd, r->to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted >= 0) {
+            r->to_submit -= (unsigned)submitted;
+            return;
+        }
+        if (errno != EINTR) {
+            perror("io_uring_enter failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Returns a cleared submission entry, submitting first if the queue is full.
+ */
+static struct io_uring_sqe *ring_get_sqe(uring_reader_t *r) {
+    unsigned tail = *r->sq_tail;
+    while (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries) ring_submit(r, 0);
+
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    return sqe;
+}
+
+/**
+ * Publishes the entry returned by the last ring_get_sqe.
+ */
+static void ring_queue(uring_reader_t *r, struct io_uring_sqe *sqe, uint64_t user_data) {
+    sqe->user_data = user_data;
+    __atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    r->in_flight++;
+}
+
+static void queue_read(uring_reader_t *r, size_t index) {
+    slot_t *s = &r->slots[index];
+    struct io_uring_sqe *sqe = ring_get_sqe(r);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = s->fd;
+    sqe->addr = (uint64_t)(uintptr_t)s->buf;
+    sqe->len = (uint32_t)s->len;
+    sqe->off = 0;
+    ring_queue(r, sqe, USER_DATA(index, OP_READ));
+}
+
+/**
+ * Called when the open of a file has completed: reads the file if it is a small regular
+ * file, otherwise hands over the descriptor. The type and size come from a plain fstat:
+ * IORING_OP_STATX is always handed to io_uring's worker threads, and starting those cost
+ * more than the whole search of a small file.
+ */
+static void open_complete(uring_reader_t *r, size_t index, int res) {
+    slot_t *s = &r->slots[index];
+    struct stat st;
+
+    if (res < 0) {
+        s->error = -res;
+        s->ready = 1;
+        return;
+    }
+    s->fd = res;
+    if (fstat(s->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (size_t)st.st_size <= URING_MAX_FILE_SIZE) {
+        s->len = (size_t)st.st_size;
+        queue_read(r, index);
+    } else {
+        // Large files are mapped by the caller; size 0 may be a /proc file with content
+        s->use_fd = 1;
+        s->ready = 1;
+    }
+}
+
+static void handle_completion(uring_reader_t *r, uint64_t user_data, int res) {
+    size_t index = (size_t)(user_data >> 2);
+    slot_t *s = &r->slots[index];
+    r->in_flight--;
+
+    switch ((int)(user_data & 3)) {
+        case OP_OPEN:
+            open_complete(r, index, res);
+            break;
+        case OP_READ:
+            // A short or failed read means the file changed: fall back to the descriptor
+            if (res < 0 || (size_t)res != s->len) s->use_fd = 1;
+            s->ready = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+static void ring_reap(uring_reader_t *r) {
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        handle_completion(r, cqe->user_data, cqe->res);
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+uring_reader_t *uring_reader_new(uring_file_fn done, void *ctx) {
+    uring_reader_t *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    if (ring_setup(r) == -1) {
+        free(r);
+        return NULL;
+    }
+    for (size_t i = 0; i < URING_FILES_IN_FLIGHT; i++) {
+        r->slots[i].buf = malloc(URING_MAX_FILE_SIZE);
+        if (!r->slots[i].buf) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    r->done = done;
+    r->ctx = ctx;
+    return r;
+}
+
+/**
+ * Waits until the oldest file is complete, passes it to the callback and closes it.
+ */
+static void deliver_head(uring_reader_t *r) {
+    slot_t *s = &r->slots[r->head];
+    while (!s->ready) {
+        ring_submit(r, 1);
+        ring_reap(r);
+    }
+
+    r->done(r->ctx, s->path, s->fd, s->use_fd ? NULL : s->buf, s->len, s->error);
+
+    if (s->fd >= 0) {
+        struct io_uring_sqe *sqe = ring_get_sqe(r);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = s->fd;
+        ring_queue(r, sqe, USER_DATA(r->head, OP_CLOSE));
+    }
+    free(s->path);
+    r->head = (r->head + 1) % URING_FILES_IN_FLIGHT;
+    r->count--;
+}
+
+void uring_reader_add(uring_reader_t *r, char *path) {
+    if (r->count == URING_FILES_IN_FLIGHT) deliver_head(r);
+
+    size_t index = (r->head + r->count) % URING_FILES_IN_FLIGHT;
+    slot_t *s = &r->slots[index];
+    s->path = path;
+    s->fd = -1;
+    s->error = 0;
+    s->ready = 0;
+    s->use_fd = 0;
+    s->len = 0;
+    r->count++;
+
+    // The read is queued once the open has completed
+    struct io_uring_sqe *sqe = ring_get_sqe(r);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    ring_queue(r, sqe, USER_DATA(index, OP_OPEN));
+}
+
+void uring_reader_finish(uring_reader_t *r) {
+    while (r->count > 0) deliver_head(r);
+    // Let the last closes complete before the ring goes away
+    while (r->in_flight > 0) {
+        ring_submit(r, 1);
+        ring_reap(r);
+    }
+
+    ring_unmap(r);
+    for (size_t i = 0; i < URING_FILES_IN_FLIGHT; i++) free(r->slots[i].buf);
+    free(r);
+}
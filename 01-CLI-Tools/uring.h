@@ -0,0 +1,52 @@
+/**
+ * @file uring.h
+ * @brief Batched open/read of many small files through io_uring.
+ * Files are opened and read asynchronously: while the caller searches one file,
+ * the opens and reads of the next files are already in flight, and the requests for a
+ * whole batch are handed to the kernel with a single io_uring_enter call. The ring is set
+ * up with raw system calls, so no liburing is needed. Files are delivered strictly in the
+ * order they were added.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+
+#define URING_FILES_IN_FLIGHT 64           // Files opened and read ahead of the one being searched
+#define URING_MAX_FILE_SIZE ((size_t)64 << 10) // Larger files are handed over as a descriptor
+
+typedef struct uring_reader uring_reader_t;
+
+/**
+ * @brief Receives each file, in the order the files were added.
+ * @param path The file's path.
+ * @param fd Open descriptor of the file, or -1 if it could not be opened. It is closed by
+ * the reader after the callback returns.
+ * @param data The whole file content if it was read through the ring, or NULL if the file
+ * is not a small regular file and must be searched through fd.
+ * @param len Length of data.
+ * @param error errno value if the file could not be opened, 0 otherwise.
+ */
+typedef void (*uring_file_fn)(void *ctx, const char *path, int fd, const char *data, size_t len, int error);
+
+/**
+ * @brief Sets up a ring.
+ * @return The reader, or NULL if io_uring is unavailable (old kernel, disabled by policy,
+ * or missing the openat/statx/read/close operations). The caller then uses plain I/O.
+ */
+uring_reader_t *uring_reader_new(uring_file_fn done, void *ctx);
+
+/**
+ * @brief Queues a file. May deliver earlier files to the callback first, when the number
+ * of files in flight reaches URING_FILES_IN_FLIGHT.
+ * @param path Path allocated with malloc; the reader takes ownership.
+ */
+void uring_reader_add(uring_reader_t *r, char *path);
+
+/**
+ * @brief Delivers all queued files and releases the ring.
+ */
+void uring_reader_finish(uring_reader_t *r);
+
+#endif
@@ -0,0 +1,234 @@
+/**
+ * @file walk.c
+ * @brief Directory traversal with openat/getdents64 and glob pruning.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "walk.h"
+
+#define WALK_BUFFER_SIZE ((size_t)64 << 10) // getdents64 batch: hundreds of entries per call
+#define WALK_OPEN_DEPTH 32                  // Deeper directories are closed once listed
+
+/**
+ * Record layout returned by getdents64 (see getdents(2)).
+ */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * A directory on the path from the root to the one being listed, for loop detection.
+ */
+typedef struct dir_chain {
+    dev_t dev;
+    ino_t ino;
+    size_t depth;         // 0 for the root
+    const struct dir_chain *parent;
+} dir_chain_t;
+
+/**
+ * @brief State of one walk_tree call.
+ */
+typedef struct {
+    const char *prog;
+    const walk_filter_t *filter;
+    walk_visit_fn visit;
+    void *ctx;
+    char *buf;            // getdents64 batch, shared by all levels
+} walk_t;
+
+/**
+ * @brief The entries of one directory that are visited or entered, in directory order:
+ * packed records of a d_type byte followed by the NUL-terminated name.
+ */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} entry_list_t;
+
+void glob_list_add(glob_list_t *list, const char *glob) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 4;
+        const char **globs = realloc(list->globs, capacity * sizeof(*globs));
+        if (!globs) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        list->globs = globs;
+        list->capacity = capacity;
+    }
+    list->globs[list->count++] = glob;
+}
+
+void walk_filter_free(walk_filter_t *filter) {
+    free(filter->include.globs);
+    free(filter->exclude.globs);
+    free(filter->exclude_dir.globs);
+}
+
+static int glob_list_matches(const glob_list_t *list, const char *name) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (fnmatch(list->globs[i], name, 0) == 0) return 1;
+    }
+    return 0;
+}
+
+static int file_selected(const walk_filter_t *filter, const char *name) {
+    if (filter->include.count > 0 && !glob_list_matches(&filter->include, name)) return 0;
+    return !glob_list_matches(&filter->exclude, name);
+}
+
+/**
+ * Joins a directory path and an entry name into a new string ("" + name gives name).
+ */
+static char *join_path(const char *dir, const char *name) {
+    size_t dir_len = strlen(dir), name_len = strlen(name);
+    int slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char *path = malloc(dir_len + slash + name_len + 1);
+    if (!path) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(path, dir, dir_len);
+    if (slash) path[dir_len] = '/';
+    memcpy(path + dir_len + slash, name, name_len + 1);
+    return path;
+}
+
+static void entry_list_add(entry_list_t *list, unsigned char type, const char *name) {
+    size_t len = strlen(name) + 2;
+    if (list->len + len > list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        while (capacity < list->len + len) capacity *= 2;
+        char *data = realloc(list->data, capacity);
+        if (!data) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+        list->data = data;
+        list->capacity = capacity;
+    }
+    list->data[list->len] = (char)type;
+    memcpy(list->data + list->len + 1, name, len - 1);
+    list->len += len;
+}
+
+/**
+ * Reads a whole directory into a list of the regular files that pass the filter and the
+ * subdirectories that are not excluded.
+ */
+static void list_dir(walk_t *w, int fd, const char *shown, entry_list_t *list) {
+    for (;;) {
+        long got = syscall(SYS_getdents64, fd, w->buf, WALK_BUFFER_SIZE);
+        if (got == -1) {
+            fprintf(stderr, "%s: Error reading directory '%s': %s\n", w->prog, shown, strerror(errno));
+            return;
+        }
+        if (got == 0) return;
+
+        for (long offset = 0; offset < got;) {
+            const struct linux_dirent64 *entry = (const struct linux_dirent64 *)(w->buf + offset);
+            offset += entry->d_reclen;
+            const char *entry_name = entry->d_name;
+            if (strcmp(entry_name, ".") == 0 || strcmp(entry_name, "..") == 0) continue;
+
+            // Symlinks (and file systems without d_type) need a stat to learn the target type
+            unsigned char type = entry->d_type;
+            if (type == DT_LNK || type == DT_UNKNOWN) {
+                struct stat target;
+                if (fstatat(fd, entry_name, &target, 0) == -1) continue; // Dangling link
+                type = S_ISDIR(target.st_mode) ? DT_DIR : S_ISREG(target.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+
+            if (type == DT_DIR) {
+                if (!glob_list_matches(&w->filter->exclude_dir, entry_name)) entry_list_add(list, type, entry_name);
+            } else if (type == DT_REG && file_selected(w->filter, entry_name)) {
+                // Devices, FIFOs and sockets are skipped: reading them could block or never end
+                entry_list_add(list, type, entry_name);
+            }
+        }
+    }
+}
+
+/**
+ * Lists one directory and recurses into its subdirectories. The directory is read to the
+ * end before any subdirectory is entered, so one getdents buffer serves the whole walk.
+ * Deeper than WALK_OPEN_DEPTH, the directory is closed once listed and its subdirectories
+ * are opened by path, so a deep tree does not hold a descriptor per level.
+ * @param parent_fd Descriptor of the parent directory (or AT_FDCWD).
+ * @param name Name of the directory relative to parent_fd.
+ * @param path Display path of the directory, used to build the paths of its entries.
+ * @param chain The directories above this one.
+ */
+static void walk_dir(walk_t *w, int parent_fd, const char *name, const char *path, const dir_chain_t *chain) {
+    const char *prog = w->prog;
+    const char *shown = *path ? path : ".";
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "%s: Error opening directory '%s': %s\n", prog, shown, strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        fprintf(stderr, "%s: Error reading directory '%s': %s\n", prog, shown, strerror(errno));
+        close(fd);
+        return;
+    }
+    for (const dir_chain_t *c = chain; c != NULL; c = c->parent) {
+        if (c->dev == st.st_dev && c->ino == st.st_ino) {
+            fprintf(stderr, "%s: Skipping recursive directory loop '%s'\n", prog, shown);
+            close(fd);
+            return;
+        }
+    }
+    dir_chain_t self = {st.st_dev, st.st_ino, chain != NULL ? chain->depth + 1 : 0, chain};
+
+    entry_list_t list = {NULL, 0, 0};
+    list_dir(w, fd, shown, &list);
+    if (self.depth >= WALK_OPEN_DEPTH) {
+        close(fd);
+        fd = -1;
+    }
+
+    for (size_t offset = 0; offset < list.len;) {
+        unsigned char type = (unsigned char)list.data[offset];
+        const char *entry_name = list.data + offset + 1;
+        offset += strlen(entry_name) + 2;
+        char *child = join_path(path, entry_name);
+        if (type == DT_DIR) {
+            walk_dir(w, fd >= 0 ? fd : AT_FDCWD, fd >= 0 ? entry_name : child, child, &self);
+            free(child);
+        } else {
+            w->visit(w->ctx, child);
+        }
+    }
+
+    free(list.data);
+    if (fd >= 0) close(fd);
+}
+
+void walk_tree(const char *prog, const char *root, const walk_filter_t *filter, walk_visit_fn visit, void *ctx) {
+    walk_t w = {prog, filter, visit, ctx, malloc(WALK_BUFFER_SIZE)};
+    if (!w.buf) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    walk_dir(&w, AT_FDCWD, *root ? root : ".", root, NULL);
+    free(w.buf);
+}
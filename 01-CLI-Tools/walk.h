@@ -0,0 +1,55 @@
+/**
+ * @file walk.h
+ * @brief Recursive directory traversal for mygrep -r.
+ * Directories are listed with openat/getdents64 relative to their parent's descriptor, so
+ * no path is resolved twice and d_type spares a stat for most entries. A directory is read
+ * to the end before its subdirectories are entered, and past a fixed depth its descriptor
+ * is closed and the subdirectories are opened by path, so neither buffers nor descriptors
+ * pile up along a deep path. Symbolic links are
+ * followed, but a directory that is already being walked further up (a symlink loop) is
+ * skipped. Glob filters are applied to entry names before anything is opened, so excluded
+ * subtrees are pruned without being read.
+ */
+
+#ifndef WALK_H
+#define WALK_H
+
+#include <stddef.h>
+
+/**
+ * @brief A list of fnmatch(3) patterns, matched against the base name of an entry.
+ */
+typedef struct {
+    const char **globs;   // Not owned (usually argv strings)
+    size_t count;
+    size_t capacity;
+} glob_list_t;
+
+typedef struct {
+    glob_list_t include;      // --include: if non-empty, only matching files are searched
+    glob_list_t exclude;      // --exclude: matching files are skipped
+    glob_list_t exclude_dir;  // --exclude-dir: matching directories are not entered
+} walk_filter_t;
+
+/**
+ * @brief Called for every selected regular file.
+ * @param path The file's path, allocated with malloc; the callee takes ownership.
+ */
+typedef void (*walk_visit_fn)(void *ctx, char *path);
+
+void glob_list_add(glob_list_t *list, const char *glob);
+
+void walk_filter_free(walk_filter_t *filter);
+
+/**
+ * @brief Walks a directory tree and reports its regular files in directory order.
+ * Errors (unreadable directories, loops) are reported on stderr and the walk continues.
+ * @param prog Program name for error messages.
+ * @param root The directory to walk; "" walks the working directory with relative names.
+ * @param filter Include/exclude globs.
+ * @param visit Receives each selected file.
+ * @param ctx Passed through to visit.
+ */
+void walk_tree(const char *prog, const char *root, const walk_filter_t *filter, walk_visit_fn visit, void *ctx);
+
+#endif
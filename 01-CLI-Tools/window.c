@@ -0,0 +1,170 @@
+/**
+ * @file window.c
+ * @brief Time windows for mygrep --since / --until.
+ */
+
+#define _XOPEN_SOURCE 700 // Required for strptime
+
+#include <string.h>
+#include <time.h>
+#include "window.h"
+
+// Bytes of a line that are copied out and NUL-terminated for strptime. A timestamp is
+// expected within them.
+#define WINDOW_PREFIX_MAX 128
+
+// Once the bisection has narrowed the boundary down to this many bytes, the rest is walked
+// line by line
+#define WINDOW_LINEAR_SPAN ((size_t)64 << 10)
+
+/**
+ * @brief Orders broken-down times by date and time of day without mktime: no time zone,
+ * and formats without a year (syslog) still compare within the year.
+ */
+static int64_t window_key(const struct tm *tm) {
+    int64_t day = ((int64_t)tm->tm_year * 12 + tm->tm_mon) * 31 + tm->tm_mday;
+    return day * 86400 + tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+/**
+ * @brief Parses the whole of text with a strptime format.
+ * @return 1 on success, 0 otherwise.
+ */
+static int parse_stamp(const char *text, const char *format, struct tm *tm) {
+    memset(tm, 0, sizeof(*tm));
+    const char *end = strptime(text, format, tm);
+    return end != NULL && *end == '\0';
+}
+
+/**
+ * @brief Parses one bound of the window: a timestamp, or a time of day.
+ * @return 0 on success, -1 otherwise.
+ */
+static int parse_bound(const char *text, const char *format, int64_t *key, int *time_only) {
+    struct tm tm;
+    *time_only = 0;
+    if (!parse_stamp(text, format, &tm)) {
+        if (!parse_stamp(text, "%H:%M:%S", &tm) && !parse_stamp(text, "%H:%M", &tm)) {
+            return -1;
+        }
+        *time_only = 1;
+    }
+    *key = window_key(&tm);
+    return 0;
+}
+
+int window_init(time_window_t *w, const char *format, const char *since, const char *until) {
+    memset(w, 0, sizeof(*w));
+    w->format = format;
+    if (since != NULL) {
+        if (parse_bound(since, format, &w->since, &w->since_time_only) == -1) {
+            return -1;
+        }
+        w->has_since = 1;
+    }
+    if (until != NULL) {
+        if (parse_bound(until, format, &w->until, &w->until_time_only) == -1) {
+            return -1;
+        }
+        w->has_until = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the start of the line after the one p is in, or end.
+ */
+static const char *next_line(const char *p, const char *end) {
+    const char *newline = memchr(p, '\n', end - p);
+    return newline == NULL ? end : newline + 1;
+}
+
+/**
+ * @brief Reads the timestamp a line starts with.
+ * @return 1 if the line has one, 0 otherwise.
+ */
+static int line_stamp(const time_window_t *w, const char *line, const char *end, struct tm *tm) {
+    char prefix[WINDOW_PREFIX_MAX + 1];
+    size_t len = (size_t)(end - line) < WINDOW_PREFIX_MAX ? (size_t)(end - line) : WINDOW_PREFIX_MAX;
+    const char *newline = memchr(line, '\n', len);
+    if (newline != NULL) {
+        len = newline - line;
+    }
+    memcpy(prefix, line, len);
+    prefix[len] = '\0';
+    memset(tm, 0, sizeof(*tm));
+    return strptime(prefix, w->format, tm) != NULL;
+}
+
+/**
+ * @brief Finds the first stamped line at or after p and before limit.
+ * @return The line, or NULL if there is none.
+ */
+static const char *next_stamp(const time_window_t *w, const char *p, const char *limit, const char *end,
+                              int64_t *key) {
+    struct tm tm;
+    for (; p < limit; p = next_line(p, end)) {
+        if (line_stamp(w, p, end, &tm)) {
+            *key = window_key(&tm);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the first stamped line whose timestamp is not before target, assuming the
+ * timestamps never decrease.
+ * @param lo A line start no later than the line looked for.
+ * @return Offset of that line, or len if every stamped line from lo on is earlier.
+ */
+static size_t lower_bound(const time_window_t *w, const char *buf, size_t len, size_t lo, int64_t target) {
+    const char *end = buf + len;
+    size_t hi = len;
+    int64_t key;
+    // Every stamped line before lo is earlier than target, and the line looked for starts
+    // before hi (or is missing)
+    while (hi - lo > WINDOW_LINEAR_SPAN) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *probe = buf[mid - 1] == '\n' ? buf + mid : next_line(buf + mid, end);
+        const char *stamped = next_stamp(w, probe, buf + hi, end, &key);
+        if (stamped == NULL || key >= target) {
+            hi = mid;
+        } else {
+            lo = next_line(stamped, end) - buf;
+        }
+    }
+    const char *stamped = buf + lo;
+    while ((stamped = next_stamp(w, stamped, end, end, &key)) != NULL && key < target) {
+        stamped = next_line(stamped, end);
+    }
+    return stamped == NULL ? len : (size_t)(stamped - buf);
+}
+
+void window_range(const time_window_t *w, const char *buf, size_t len, size_t *from, size_t *to) {
+    int64_t since = w->since, until = w->until;
+    *from = 0;
+    *to = len;
+    if (w->since_time_only || w->until_time_only) {
+        // A time of day refers to the date the file starts on. Its key is the seconds
+        // since midnight, and the key of a date a multiple of a day.
+        int64_t key;
+        if (next_stamp(w, buf, buf + len, buf + len, &key) == NULL) {
+            *from = len;
+            return;
+        }
+        int64_t date = key - key % 86400;
+        if (w->since_time_only) {
+            since += date;
+        }
+        if (w->until_time_only) {
+            until += date;
+        }
+    }
+    if (w->has_since) {
+        *from = lower_bound(w, buf, len, 0, since);
+    }
+    if (w->has_until) {
+        *to = lower_bound(w, buf, len, *from, until + 1);
+    }
+}
@@ -0,0 +1,49 @@
+/**
+ * @file window.h
+ * @brief Time windows for mygrep --since / --until on logs whose lines start with a
+ * timestamp and are sorted by it. The byte range of the window is found by bisecting the
+ * mapped file on the timestamps of the lines around each probe, so only the lines inside
+ * it are read and searched. A line without a timestamp (e.g. a stack trace) belongs to
+ * the stamped line before it.
+ */
+
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WINDOW_DEFAULT_FORMAT "%Y-%m-%d %H:%M:%S"
+
+/**
+ * @brief A window of time, compared at the precision of whole seconds. A bound given as a
+ * bare time of day ("14:02", "14:02:30") is completed with the date of the first
+ * timestamp of each file.
+ */
+typedef struct {
+    const char *format;   // strptime(3) format of the timestamp each line starts with
+    int has_since;
+    int has_until;
+    int since_time_only;  // since holds a time of day only
+    int until_time_only;
+    int64_t since;        // Key of the first second in the window (see window.c)
+    int64_t until;        // Key of the last second in the window
+} time_window_t;
+
+/**
+ * @brief Sets up a window; a bound that is NULL leaves the window open on that side.
+ * @param format strptime format of the line prefix, e.g. "%b %d %H:%M:%S" for syslog.
+ * @param since, until Timestamps in that format, or times of day as "HH:MM[:SS]".
+ * @return 0 on success, -1 if a bound does not parse.
+ */
+int window_init(time_window_t *w, const char *format, const char *since, const char *until);
+
+/**
+ * @brief Finds the lines of a buffer that lie in the window.
+ * @param from Receives the start of the first line at or after since.
+ * @param to Receives the end of the last line at or before until (with the unstamped lines
+ * that follow it).
+ */
+void window_range(const time_window_t *w, const char *buf, size_t len, size_t *from, size_t *to);
+
+#endif